@@ -0,0 +1 @@
+savedcmd_bootcache.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o bootcache.o bootcache.c
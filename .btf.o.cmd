@@ -0,0 +1 @@
+savedcmd_btf.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o btf.o btf.c
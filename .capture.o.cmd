@@ -0,0 +1 @@
+savedcmd_capture.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o capture.o capture.c
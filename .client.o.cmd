@@ -0,0 +1 @@
+savedcmd_client.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o client.o client.c
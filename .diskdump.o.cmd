@@ -0,0 +1 @@
+savedcmd_diskdump.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o diskdump.o diskdump.c
@@ -0,0 +1 @@
+savedcmd_file_client.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o file_client.o file_client.c
@@ -0,0 +1 @@
+savedcmd_global_data.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o global_data.o global_data.c
@@ -0,0 +1 @@
+savedcmd_kallsyms.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o kallsyms.o kallsyms.c
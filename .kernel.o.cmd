@@ -0,0 +1 @@
+savedcmd_kernel.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o kernel.o kernel.c
@@ -0,0 +1 @@
+savedcmd_libvirt_client.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o libvirt_client.o libvirt_client.c
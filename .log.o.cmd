@@ -0,0 +1 @@
+savedcmd_log.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o log.o log.c
@@ -0,0 +1 @@
+savedcmd_main.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o main.o main.c
@@ -0,0 +1 @@
+savedcmd_mapdir.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o mapdir.o mapdir.c
@@ -0,0 +1 @@
+savedcmd_mem.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o mem.o mem.c
@@ -0,0 +1 @@
+savedcmd_merge.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o merge.o merge.c
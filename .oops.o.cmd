@@ -0,0 +1 @@
+savedcmd_oops.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o oops.o oops.c
@@ -0,0 +1 @@
+savedcmd_parse_hmp.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o parse_hmp.o parse_hmp.c
@@ -0,0 +1 @@
+savedcmd_printk.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o printk.o printk.c
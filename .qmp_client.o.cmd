@@ -0,0 +1 @@
+savedcmd_qmp_client.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o qmp_client.o qmp_client.c
@@ -0,0 +1 @@
+savedcmd_startup.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o startup.o startup.c
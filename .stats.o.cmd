@@ -0,0 +1 @@
+savedcmd_stats.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o stats.o stats.c
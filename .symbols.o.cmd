@@ -0,0 +1 @@
+savedcmd_symbols.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o symbols.o symbols.c
@@ -0,0 +1 @@
+savedcmd_symindex.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o symindex.o symindex.c
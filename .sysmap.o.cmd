@@ -0,0 +1 @@
+savedcmd_sysmap.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o sysmap.o sysmap.c
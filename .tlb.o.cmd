@@ -0,0 +1 @@
+savedcmd_tlb.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o tlb.o tlb.c
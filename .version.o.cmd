@@ -0,0 +1 @@
+savedcmd_version.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o version.o version.c
@@ -0,0 +1 @@
+savedcmd_vmcoreinfo.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o vmcoreinfo.o vmcoreinfo.c
@@ -0,0 +1 @@
+savedcmd_vmlinux.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o vmlinux.o vmlinux.c
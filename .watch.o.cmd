@@ -0,0 +1 @@
+savedcmd_watch.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o watch.o watch.c
@@ -0,0 +1 @@
+savedcmd_xutil.o := gcc -std=gnu99 -Wall -Wextra -O2 -c -o xutil.o xutil.c
@@ -0,0 +1,422 @@
+/* bootcache.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "bootcache.h"
+#include "vmcoreinfo.h"
+#include "tlb.h"
+#include "printk.h"
+
+/*
+ * Everything derived during bootstrap (KASLR offset, phys_base, the
+ * VMCOREINFO and prb addresses, the layout tables) is fixed for the life
+ * of a guest kernel.  It is cached per QEMU process so that warm runs skip
+ * the register fetch and the page table walk.  An entry is keyed by the
+ * QEMU PID and start time and by the identity of the System.map, and is
+ * only trusted after the cached VMCOREINFO address is found to still hold
+ * the note it was made from: a guest reboot into another kernel changes
+ * OSRELEASE, one into the same kernel the KASLR offset, phys_base and the
+ * address of the kernel page table.
+ *
+ * The entry also keeps where the log's writer position lives and its value
+ * when the log was last read, for --probe.
+ */
+#define BOOTCACHE_MAGIC     "KDMBOOT"
+#define BOOTCACHE_VERSION   (8)
+
+struct bootcache_entry {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+
+    /* key */
+    uint64_t pid;
+    uint64_t starttime;
+    uint64_t map_dev;
+    uint64_t map_ino;
+    uint64_t map_size;
+    uint64_t map_mtime;
+
+    /* values */
+    uint64_t relocate;
+    uint64_t kt_flags;
+    uint64_t phys_base;
+    uint64_t page_offset;
+    uint64_t kernel_end;
+    uint64_t direct_map_end;
+    uint64_t kernel_pgd;
+    uint64_t pgt;                   /* SYMBOL() of it in the note, or 0 */
+    uint64_t vmcoreinfo_data;
+    uint64_t vmcoreinfo_size;
+    uint64_t prb;
+    uint64_t head_kaddr;            /* see printk_head() */
+    uint64_t head_size;
+    uint64_t head;                  /* at the last read of the log */
+    char osrelease[65];
+    struct offset_table offsets;
+    struct size_table sizes;
+};
+
+static struct bootcache_entry bootcache;
+static int bootcache_valid = FALSE;
+
+static int get_process_starttime(pid_t pid, uint64_t *starttime)
+{
+    char path[64];
+    char buf[1024];
+    char *p;
+    ssize_t n;
+    int fd, field;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    n = xread(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+
+    /* comm may contain spaces, so count fields after the last ')' */
+    if (!(p = strrchr(buf, ')')))
+        return -1;
+
+    for (field = 2; *p && field < 22; p++) {
+        if (*p == ' ')
+            field++;
+    }
+    if (field != 22)
+        return -1;
+
+    *starttime = strtoull(p, NULL, 10);
+    return 0;
+}
+
+static int bootcache_key(struct bootcache_entry *e, pid_t pid,
+        const char *symmap_file)
+{
+    struct stat sb;
+
+    if (pid <= 0 || (pc->flags & NO_CACHE))
+        return -1;
+
+    if (stat(symmap_file, &sb))
+        return -1;
+
+    memset(e, 0, sizeof(*e));
+    memcpy(e->magic, BOOTCACHE_MAGIC, sizeof(e->magic));
+    e->version = BOOTCACHE_VERSION;
+    e->size = sizeof(*e);
+    e->pid = pid;
+    e->map_dev = sb.st_dev;
+    e->map_ino = sb.st_ino;
+    e->map_size = sb.st_size;
+    e->map_mtime = sb.st_mtime;
+
+    return get_process_starttime(pid, &e->starttime);
+}
+
+static void bootcache_path(char *path, size_t len, struct bootcache_entry *e)
+{
+    snprintf(path, len, BOOTCACHE_DIR "/%lu-%lu.boot",
+            (ulong)e->pid, (ulong)e->starttime);
+}
+
+static const char *const bootcache_pgt_keys[] = {
+    "SYMBOL(init_top_pgt)",
+    "SYMBOL(init_level4_pgt)",
+    "SYMBOL(swapper_pg_dir)",
+};
+
+#define NR_PGT_KEYS (sizeof(bootcache_pgt_keys) / sizeof(bootcache_pgt_keys[0]))
+
+/* the value of a key=value line of the note */
+static int bootcache_note_value(const char *note, const char *key, int base,
+        ulong *value)
+{
+    size_t len = strlen(key);
+    const char *p = note;
+
+    while (p) {
+        if (!strncmp(p, key, len) && p[len] == '=') {
+            *value = strtoul(p + len + 1, NULL, base);
+            return 0;
+        }
+        if ((p = strchr(p, '\n')))
+            p++;
+    }
+    return -1;
+}
+
+/*
+ * Check that the cached VMCOREINFO address still holds the note of the
+ * boot the entry was made for.  The same kernel booted again can have put
+ * its note in the same page, so OSRELEASE is not enough: KERNELOFFSET,
+ * NUMBER(phys_base) and the page table's SYMBOL() must match too.  This
+ * is one guest read of at most two pages.
+ */
+static int bootcache_validate(struct bootcache_entry *e)
+{
+    char expect[80];
+    char *note;
+    size_t len, i;
+    ulong value;
+    int ret = -1;
+
+    len = snprintf(expect, sizeof(expect), "OSRELEASE=%s\n", e->osrelease);
+    if (len >= sizeof(expect) || e->vmcoreinfo_size < len ||
+            e->vmcoreinfo_size >= (1 << 13))
+        return -1;
+
+    note = xmalloc(e->vmcoreinfo_size + 1);
+    if (readmem(e->vmcoreinfo_data, KVADDR, note, e->vmcoreinfo_size) ||
+            memcmp(note, expect, len))
+        goto out;
+    note[e->vmcoreinfo_size] = '\0';
+
+    /* KERNELOFFSET is missing on kernels without KASLR */
+    if (bootcache_note_value(note, "KERNELOFFSET", 16, &value))
+        value = 0;
+    if (value != (ulong)-e->relocate)
+        goto out;
+
+    if (!bootcache_note_value(note, "NUMBER(phys_base)", 10, &value) &&
+            value != e->phys_base)
+        goto out;
+
+    for (i = 0; e->pgt && i < NR_PGT_KEYS; i++) {
+        if (!bootcache_note_value(note, bootcache_pgt_keys[i], 16, &value))
+            break;
+    }
+    if (e->pgt && (i == NR_PGT_KEYS || value != e->pgt))
+        goto out;
+
+    ret = 0;
+out:
+    xfree(note);
+    return ret;
+}
+
+/*
+ * Read the entry for this QEMU process and System.map into e.  Returns 1
+ * when there is none, -1 when it is stale.
+ */
+static int bootcache_read(struct bootcache_entry *e, pid_t pid,
+        const char *symmap_file, char *path, size_t len)
+{
+    struct bootcache_entry key;
+    int fd, n;
+
+    if (bootcache_key(&key, pid, symmap_file))
+        return 1;
+
+    bootcache_path(path, len, &key);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return 1;
+
+    n = xread(fd, e, sizeof(*e));
+    close(fd);
+
+    if (n != sizeof(*e) ||
+            memcmp(e, &key, offsetof(struct bootcache_entry, relocate)))
+        return -1;
+    return 0;
+}
+
+static void bootcache_set_kaslr(struct bootcache_entry *e)
+{
+    kt->relocate = e->relocate;
+    kt->flags = e->kt_flags;
+    machdep->machspec->phys_base = e->phys_base;
+    machdep->machspec->page_offset = e->page_offset;
+    machdep->machspec->kernel_end = e->kernel_end;
+    machdep->machspec->direct_map_end = e->direct_map_end;
+    vt->kernel_pgd[0] = e->kernel_pgd;
+    tlb_flush();
+}
+
+int bootcache_load(pid_t pid, const char *symmap_file)
+{
+    struct bootcache_entry e;
+    char path[128];
+    int ret;
+
+    if ((ret = bootcache_read(&e, pid, symmap_file, path, sizeof(path))) > 0)
+        return -1;
+    if (ret)
+        goto stale;
+
+    bootcache_set_kaslr(&e);
+
+    if (bootcache_validate(&e)) {
+        kt->relocate = 0;
+        kt->flags = 0;
+        machdep->machspec->phys_base = 0;
+        machdep->machspec->page_offset = PAGE_OFFSET_2_6_27;
+        machdep->machspec->kernel_end = __START_KERNEL_map + KERNEL_IMAGE_SIZE;
+        machdep->machspec->direct_map_end = PAGE_OFFSET_2_6_27 + DIRECT_MAP_SIZE;
+        vt->kernel_pgd[0] = 0;
+        tlb_flush();
+        goto stale;
+    }
+
+    kt->vmcoreinfo_data = e.vmcoreinfo_data;
+    kt->vmcoreinfo_size = e.vmcoreinfo_size;
+    kt->prb = e.prb;
+    offset_table = e.offsets;
+    size_table = e.sizes;
+
+    bootcache = e;
+    bootcache_valid = TRUE;
+    if (KDEBUG(1))
+        pr_debug("bootcache: using %s", path);
+    return 0;
+
+stale:
+    if (KDEBUG(1))
+        pr_debug("bootcache: dropping stale %s", path);
+    unlink(path);
+    return -1;
+}
+
+static int bootcache_write(struct bootcache_entry *e)
+{
+    char path[128];
+    char tmp[160];
+    int fd;
+
+    if (mkdir(BOOTCACHE_DIR, 0700) && errno != EEXIST)
+        return -1;
+
+    bootcache_path(path, sizeof(path), e);
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+        return -1;
+
+    if (xwrite(fd, (const char *)e, sizeof(*e)) != sizeof(*e)) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+
+    if (KDEBUG(1))
+        pr_debug("bootcache: saved %s", path);
+    return 0;
+}
+
+int bootcache_save(pid_t pid, const char *symmap_file)
+{
+    struct bootcache_entry e;
+    ulong head_kaddr, head_size, head;
+    const char *release;
+    size_t i;
+    long pgt;
+
+    if (printk_head(&head_kaddr, &head_size, &head))
+        head_kaddr = head_size = head = 0;
+
+    /* a warm entry only needs the new writer position */
+    if (bootcache_valid) {
+        if (bootcache.head_kaddr == head_kaddr && bootcache.head == head)
+            return 0;
+        bootcache.head_kaddr = head_kaddr;
+        bootcache.head_size = head_size;
+        bootcache.head = head;
+        return bootcache_write(&bootcache);
+    }
+
+    if (bootcache_key(&e, pid, symmap_file))
+        return -1;
+
+    if (!kt->vmcoreinfo_data ||
+            !(release = vmcoreinfo_lookup("OSRELEASE")))
+        return -1;
+    xstrlcpy(e.osrelease, release, sizeof(e.osrelease));
+
+    e.relocate = kt->relocate;
+    e.kt_flags = kt->flags;
+    e.phys_base = machdep->machspec->phys_base;
+    e.page_offset = machdep->machspec->page_offset;
+    e.kernel_end = machdep->machspec->kernel_end;
+    e.direct_map_end = machdep->machspec->direct_map_end;
+    e.kernel_pgd = vt->kernel_pgd[0];
+    /* kernel_pgd may be the CR3 of whatever ran, the note names the table */
+    for (i = 0; i < NR_PGT_KEYS; i++) {
+        if (!vmcoreinfo_number(bootcache_pgt_keys[i], &pgt)) {
+            e.pgt = pgt;
+            break;
+        }
+    }
+    e.vmcoreinfo_data = kt->vmcoreinfo_data;
+    e.vmcoreinfo_size = kt->vmcoreinfo_size;
+    e.prb = kt->prb;
+    e.head_kaddr = head_kaddr;
+    e.head_size = head_size;
+    e.head = head;
+    e.offsets = offset_table;
+    e.sizes = size_table;
+
+    return bootcache_write(&e);
+}
+
+/*
+ * Tell whether the log changed since it was last read, from the warm entry
+ * alone: no System.map parsing, no registers, and a single read of the
+ * writer position.  The OSRELEASE check is skipped too; after a reboot
+ * into another kernel the position is garbage, which reads as a change.
+ */
+int bootcache_probe(pid_t pid, const char *symmap_file)
+{
+    struct bootcache_entry e;
+    char path[128];
+    ulong head = 0;
+
+    if (!symmap_file ||
+            bootcache_read(&e, pid, symmap_file, path, sizeof(path)) ||
+            !e.head_size || e.head_size > sizeof(head))
+        return PROBE_CHANGED;
+
+    bootcache_set_kaslr(&e);
+    if (readmem(e.head_kaddr, KVADDR, &head, e.head_size))
+        return PROBE_CHANGED;
+
+    if (KDEBUG(1))
+        pr_debug("bootcache: head %lx, %lx at the last read",
+                head, (ulong)e.head);
+    return head == e.head ? PROBE_UNCHANGED : PROBE_CHANGED;
+}
+
+int bootcache_hit()
+{
+    return bootcache_valid;
+}
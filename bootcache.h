@@ -0,0 +1,32 @@
+/* bootcache.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BOOTCACHE_H__
+#define __BOOTCACHE_H__
+
+#include <sys/types.h>
+
+#define BOOTCACHE_DIR   "/run/kvm-dmesg"
+
+/* bootcache_probe(), with the exit status of --probe */
+#define PROBE_UNCHANGED     (0)
+#define PROBE_CHANGED       (1)
+
+int bootcache_load(pid_t pid, const char *symmap_file);
+int bootcache_save(pid_t pid, const char *symmap_file);
+int bootcache_hit();
+int bootcache_probe(pid_t pid, const char *symmap_file);
+
+#endif
@@ -0,0 +1,309 @@
+/* btf.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "btf.h"
+
+/*
+ * Struct layouts from BTF, either the .BTF section of a vmlinux or a
+ * standalone blob such as a copy of /sys/kernel/btf/vmlinux.  The data is
+ * used in place; loading only records where each type starts, since
+ * types are variable length and referenced by their position, and hashes
+ * the names of the structs, unions and typedefs that lookups go by.
+ */
+static struct {
+    void *map;                      /* set when we mmap'ed a file */
+    size_t map_len;
+    const char *strs;
+    uint32_t str_len;
+    const struct btf_type **types;  /* by type id, 0 is void */
+    uint32_t nr_types;
+    uint32_t *buckets;              /* first type id of each name hash */
+    uint32_t *chain;                /* next type id, by type id, in id order */
+    uint32_t nr_buckets;            /* a power of 2 */
+} btf;
+
+static long btf_type_extra(const struct btf_type *t)
+{
+    uint32_t vlen = BTF_INFO_VLEN(t->info);
+
+    switch (BTF_INFO_KIND(t->info)) {
+    case BTF_KIND_INT:
+    case BTF_KIND_VAR:
+    case BTF_KIND_DECL_TAG:
+        return 4;
+    case BTF_KIND_ARRAY:
+        return 12;
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+    case BTF_KIND_DATASEC:
+    case BTF_KIND_ENUM64:
+        return vlen * 12;
+    case BTF_KIND_ENUM:
+    case BTF_KIND_FUNC_PROTO:
+        return vlen * 8;
+    case BTF_KIND_PTR:
+    case BTF_KIND_FWD:
+    case BTF_KIND_TYPEDEF:
+    case BTF_KIND_VOLATILE:
+    case BTF_KIND_CONST:
+    case BTF_KIND_RESTRICT:
+    case BTF_KIND_FUNC:
+    case BTF_KIND_FLOAT:
+    case BTF_KIND_TYPE_TAG:
+        return 0;
+    }
+    return -1;
+}
+
+static const char *btf_name(uint32_t off)
+{
+    return off < btf.str_len ? btf.strs + off : "";
+}
+
+static uint32_t btf_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+static int btf_named_kind(const struct btf_type *t)
+{
+    switch (BTF_INFO_KIND(t->info)) {
+    case BTF_KIND_STRUCT:
+    case BTF_KIND_UNION:
+    case BTF_KIND_TYPEDEF:
+        return t->name_off != 0;
+    }
+    return FALSE;
+}
+
+/*
+ * Chain the types of each name hash, walking the ids downwards so that
+ * every chain comes out in id order.
+ */
+static void btf_hash_names(void)
+{
+    uint32_t i, h;
+
+    btf.nr_buckets = 1;
+    while (btf.nr_buckets < btf.nr_types / 4)
+        btf.nr_buckets <<= 1;
+    btf.buckets = xcalloc(btf.nr_buckets, sizeof(uint32_t));
+    btf.chain = xcalloc(btf.nr_types, sizeof(uint32_t));
+
+    for (i = btf.nr_types - 1; i > 0; i--) {
+        if (!btf_named_kind(btf.types[i]))
+            continue;
+        h = btf_name_hash(btf_name(btf.types[i]->name_off)) &
+            (btf.nr_buckets - 1);
+        btf.chain[i] = btf.buckets[h];
+        btf.buckets[h] = i;
+    }
+}
+
+int btf_load_data(const void *data, size_t len)
+{
+    const struct btf_header *hdr = data;
+    const char *p, *end;
+    uint32_t max = 0;
+    long extra;
+
+    if (len < sizeof(*hdr) || hdr->magic != BTF_MAGIC ||
+            hdr->hdr_len > len ||
+            (size_t)hdr->hdr_len + hdr->type_off + hdr->type_len > len ||
+            (size_t)hdr->hdr_len + hdr->str_off + hdr->str_len > len) {
+        pr_err("Invalid BTF data");
+        return -1;
+    }
+
+    btf.strs = (const char *)data + hdr->hdr_len + hdr->str_off;
+    btf.str_len = hdr->str_len;
+
+    p = (const char *)data + hdr->hdr_len + hdr->type_off;
+    end = p + hdr->type_len;
+
+    btf.nr_types = 1;
+    while (p + sizeof(struct btf_type) <= end) {
+        if (btf.nr_types >= max) {
+            max = max ? max * 2 : 65536;
+            btf.types = xrealloc(btf.types, max * sizeof(*btf.types));
+        }
+        btf.types[btf.nr_types++] = (const struct btf_type *)p;
+
+        if ((extra = btf_type_extra((const struct btf_type *)p)) < 0) {
+            pr_err("Unknown BTF kind %u",
+                    BTF_INFO_KIND(((const struct btf_type *)p)->info));
+            btf_release();
+            return -1;
+        }
+        p += sizeof(struct btf_type) + extra;
+    }
+
+    btf_hash_names();
+
+    if (KDEBUG(1))
+        pr_debug("btf: %u types", btf.nr_types - 1);
+    return 0;
+}
+
+int btf_load_file(const char *path)
+{
+    struct stat sb;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        pr_err("Error opening file: %s", path);
+        return -1;
+    }
+    if (fstat(fd, &sb) || sb.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        pr_err("Failed to mmap %s", path);
+        return -1;
+    }
+
+    if (btf_load_data(map, sb.st_size)) {
+        munmap(map, sb.st_size);
+        return -1;
+    }
+    btf.map = map;
+    btf.map_len = sb.st_size;
+    return 0;
+}
+
+int btf_loaded(void)
+{
+    return btf.nr_types > 1;
+}
+
+void btf_release(void)
+{
+    xfree(btf.types);
+    xfree(btf.buckets);
+    xfree(btf.chain);
+    if (btf.map)
+        munmap(btf.map, btf.map_len);
+    memset(&btf, 0, sizeof(btf));
+}
+
+static const struct btf_type *btf_type_by_id(uint32_t id)
+{
+    return id && id < btf.nr_types ? btf.types[id] : NULL;
+}
+
+/* Skip typedefs and qualifiers */
+static const struct btf_type *btf_resolve(const struct btf_type *t)
+{
+    while (t) {
+        switch (BTF_INFO_KIND(t->info)) {
+        case BTF_KIND_TYPEDEF:
+        case BTF_KIND_VOLATILE:
+        case BTF_KIND_CONST:
+        case BTF_KIND_RESTRICT:
+        case BTF_KIND_TYPE_TAG:
+            t = btf_type_by_id(t->size_type);
+            break;
+        default:
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static int is_composite(const struct btf_type *t)
+{
+    return t && (BTF_INFO_KIND(t->info) == BTF_KIND_STRUCT ||
+            BTF_INFO_KIND(t->info) == BTF_KIND_UNION);
+}
+
+/*
+ * A struct, union or typedef of one by name.  Forward declarations and
+ * empty definitions are skipped.
+ */
+static const struct btf_type *btf_find_composite(const char *name)
+{
+    const struct btf_type *t, *r;
+    uint32_t i;
+
+    for (i = btf.buckets[btf_name_hash(name) & (btf.nr_buckets - 1)]; i;
+            i = btf.chain[i]) {
+        t = btf.types[i];
+        if (strcmp(btf_name(t->name_off), name))
+            continue;
+        r = btf_resolve(t);
+        if (is_composite(r) && r->size_type)
+            return r;
+    }
+    return NULL;
+}
+
+long btf_struct_size(const char *name)
+{
+    const struct btf_type *t;
+
+    if (!btf_loaded() || !(t = btf_find_composite(name)))
+        return -1;
+    return t->size_type;
+}
+
+/* Byte offset of member, looking into anonymous structs and unions */
+static long btf_find_member(const struct btf_type *t, const char *member)
+{
+    const struct btf_member *m = (const struct btf_member *)(t + 1);
+    uint32_t i, vlen = BTF_INFO_VLEN(t->info);
+    const struct btf_type *mt;
+    long bits, off;
+
+    for (i = 0; i < vlen; i++, m++) {
+        bits = BTF_INFO_KFLAG(t->info) ? (m->offset & 0xffffff) : m->offset;
+        if (m->name_off) {
+            if (!strcmp(btf_name(m->name_off), member))
+                return bits / 8;
+            continue;
+        }
+        mt = btf_resolve(btf_type_by_id(m->type));
+        if (is_composite(mt) && (off = btf_find_member(mt, member)) >= 0)
+            return bits / 8 + off;
+    }
+    return -1;
+}
+
+long btf_member_offset(const char *name, const char *member)
+{
+    const struct btf_type *t;
+
+    if (!btf_loaded() || !(t = btf_find_composite(name)))
+        return -1;
+    return btf_find_member(t, member);
+}
@@ -0,0 +1,85 @@
+/* btf.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BTF_H__
+#define __BTF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * The parts of the BPF Type Format (include/uapi/linux/btf.h) needed to
+ * look up struct sizes and member offsets.
+ */
+#define BTF_MAGIC           (0xeB9F)
+
+struct btf_header {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t hdr_len;
+    uint32_t type_off;      /* relative to the end of the header */
+    uint32_t type_len;
+    uint32_t str_off;
+    uint32_t str_len;
+};
+
+struct btf_type {
+    uint32_t name_off;
+    uint32_t info;          /* vlen: 0-15, kind: 24-28, kind_flag: 31 */
+    uint32_t size_type;     /* size or referenced type, depending on kind */
+};
+
+#define BTF_INFO_KIND(info)     (((info) >> 24) & 0x1f)
+#define BTF_INFO_VLEN(info)     ((info) & 0xffff)
+#define BTF_INFO_KFLAG(info)    ((info) >> 31)
+
+enum {
+    BTF_KIND_UNKN,
+    BTF_KIND_INT,
+    BTF_KIND_PTR,
+    BTF_KIND_ARRAY,
+    BTF_KIND_STRUCT,
+    BTF_KIND_UNION,
+    BTF_KIND_ENUM,
+    BTF_KIND_FWD,
+    BTF_KIND_TYPEDEF,
+    BTF_KIND_VOLATILE,
+    BTF_KIND_CONST,
+    BTF_KIND_RESTRICT,
+    BTF_KIND_FUNC,
+    BTF_KIND_FUNC_PROTO,
+    BTF_KIND_VAR,
+    BTF_KIND_DATASEC,
+    BTF_KIND_FLOAT,
+    BTF_KIND_DECL_TAG,
+    BTF_KIND_TYPE_TAG,
+    BTF_KIND_ENUM64,
+};
+
+struct btf_member {
+    uint32_t name_off;
+    uint32_t type;
+    uint32_t offset;        /* bits; with kind_flag, bitfield size in 24-31 */
+};
+
+int btf_load_file(const char *path);
+int btf_load_data(const void *data, size_t len);
+int btf_loaded(void);
+long btf_struct_size(const char *name);
+long btf_member_offset(const char *name, const char *member);
+void btf_release(void);
+
+#endif
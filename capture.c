@@ -0,0 +1,497 @@
+/* capture.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "tlb.h"
+#include "vmcoreinfo.h"
+#include "capture.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX     (1024)
+#endif
+
+/*
+ * A capture is the guest memory one decode of the log actually read, and
+ * the state needed to read it again.  --capture swaps the backend read
+ * function for a recording one once startup is done, flushes the TLB so
+ * that the page-table pages are read (and recorded) again, and decodes
+ * the log as usual.  The recorded reads are merged into ranges of
+ * guest-physical memory and written together with the KASLR values, the
+ * layout tables and the needed symbols in one writev():
+ *
+ *   struct capture_header
+ *   struct capture_symbol      [nr_symbols]
+ *   long                       [nr_offsets]    offset_table
+ *   long                       [nr_sizes]      size_table
+ *   struct capture_range       [nr_ranges]
+ *   range data, in the order of the range table
+ *
+ * --from-capture serves the ranges as a guest backend, so the decoders
+ * issue the same reads and get the same bytes without a guest.
+ */
+struct capture_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;           /* of everything before the range data */
+    uint32_t nr_symbols;
+    uint32_t nr_offsets;
+    uint32_t nr_sizes;
+    uint32_t nr_ranges;
+    uint64_t time;                  /* host CLOCK_REALTIME, ns */
+
+    uint64_t relocate;
+    uint64_t kt_flags;
+    uint64_t phys_base;
+    uint64_t page_offset;
+    uint64_t kernel_end;
+    uint64_t direct_map_end;
+    uint64_t kernel_pgd;
+    uint64_t vmcoreinfo_data;
+    uint64_t vmcoreinfo_size;
+    uint64_t prb;
+};
+
+struct capture_symbol {
+    char name[32];
+    uint64_t value;                 /* link-time */
+};
+
+struct capture_range {
+    uint64_t paddr;
+    uint64_t size;
+};
+
+struct capture_record {
+    uint64_t paddr;
+    size_t size;
+    char *data;
+};
+
+/* --capture */
+static struct {
+    int (*readmem)(uint64_t, void *, size_t);
+    struct capture_record *recs;
+    size_t nr, alloc;
+    struct capture_symbol *syms;
+    uint32_t nr_syms;
+} rec;
+
+/* --from-capture */
+static struct {
+    char *base;
+    size_t len;
+    const struct capture_header *h;
+    const struct capture_range *ranges;
+    const char **data;
+} cap;
+
+static int capture_record_readmem(uint64_t addr, void *buffer, size_t size)
+{
+    struct capture_record *r;
+    int ret;
+
+    if ((ret = rec.readmem(addr, buffer, size)))
+        return ret;
+
+    if (rec.nr == rec.alloc) {
+        rec.alloc = rec.alloc ? rec.alloc * 2 : 256;
+        rec.recs = xrealloc(rec.recs, rec.alloc * sizeof(*rec.recs));
+    }
+    r = &rec.recs[rec.nr++];
+    r->paddr = addr;
+    r->size = size;
+    r->data = xmalloc(size);
+    memcpy(r->data, buffer, size);
+    return 0;
+}
+
+void capture_start(void)
+{
+    char *buf;
+
+    rec.readmem = guest_client->readmem;
+    guest_client->readmem = capture_record_readmem;
+    tlb_flush();
+
+    /* vmcoreinfo_init() reads it again on replay */
+    if (kt->vmcoreinfo_data && kt->vmcoreinfo_size) {
+        buf = xmalloc(kt->vmcoreinfo_size);
+        readmem(kt->vmcoreinfo_data, KVADDR, buf, kt->vmcoreinfo_size);
+        xfree(buf);
+    }
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+    const struct capture_record *x = a, *y = b;
+
+    return x->paddr < y->paddr ? -1 : x->paddr > y->paddr;
+}
+
+static void capture_symbol_add(const char *name, ulong value, void *arg)
+{
+    struct capture_symbol *s;
+
+    (void)arg;
+    rec.syms = xrealloc(rec.syms, (rec.nr_syms + 1) * sizeof(*s));
+    s = &rec.syms[rec.nr_syms++];
+    memset(s, 0, sizeof(*s));
+    xstrlcpy(s->name, name, sizeof(s->name));
+    s->value = value;
+}
+
+/*
+ * Merge the recorded reads into disjoint ranges.  Reads are copied in the
+ * order they were made, so where two overlap the later one wins.
+ */
+static size_t capture_merge(struct capture_range **rangesp, char ***datap)
+{
+    struct capture_record *sorted;
+    struct capture_range *ranges;
+    char **data;
+    size_t i, j, n = 0, lo, hi;
+    uint64_t end;
+
+    sorted = xmalloc(rec.nr * sizeof(*sorted));
+    memcpy(sorted, rec.recs, rec.nr * sizeof(*sorted));
+    qsort(sorted, rec.nr, sizeof(*sorted), record_cmp);
+
+    ranges = xcalloc(rec.nr, sizeof(*ranges));
+    for (i = 0; i < rec.nr; i++) {
+        end = sorted[i].paddr + sorted[i].size;
+        if (n && sorted[i].paddr <= ranges[n - 1].paddr +
+                ranges[n - 1].size) {
+            if (end > ranges[n - 1].paddr + ranges[n - 1].size)
+                ranges[n - 1].size = end - ranges[n - 1].paddr;
+            continue;
+        }
+        ranges[n].paddr = sorted[i].paddr;
+        ranges[n].size = sorted[i].size;
+        n++;
+    }
+    xfree(sorted);
+
+    data = xcalloc(n, sizeof(char *));
+    for (i = 0; i < n; i++)
+        data[i] = xmalloc(ranges[i].size);
+
+    for (i = 0; i < rec.nr; i++) {
+        for (lo = 0, hi = n; hi - lo > 1; ) {
+            j = lo + (hi - lo) / 2;
+            if (ranges[j].paddr <= rec.recs[i].paddr)
+                lo = j;
+            else
+                hi = j;
+        }
+        memcpy(data[lo] + (rec.recs[i].paddr - ranges[lo].paddr),
+                rec.recs[i].data, rec.recs[i].size);
+    }
+
+    *rangesp = ranges;
+    *datap = data;
+    return n;
+}
+
+/* writev() all of iov, in IOV_MAX pieces and across short writes */
+static int capture_writev(int fd, struct iovec *iov, size_t cnt)
+{
+    ssize_t n;
+
+    while (cnt) {
+        n = writev(fd, iov, MIN(cnt, (size_t)IOV_MAX));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int capture_write(const char *path)
+{
+    struct capture_header *h;
+    struct capture_range *ranges;
+    struct timespec now;
+    struct iovec *iov;
+    char **data, *hdr, *p;
+    size_t i, n, hdr_len, total;
+    int fd, ret = -1;
+
+    guest_client->readmem = rec.readmem;
+
+    symbol_foreach(capture_symbol_add, NULL);
+    n = capture_merge(&ranges, &data);
+
+    hdr_len = sizeof(*h) + rec.nr_syms * sizeof(struct capture_symbol) +
+        sizeof(offset_table) + sizeof(size_table) +
+        n * sizeof(struct capture_range);
+    hdr = xcalloc(1, hdr_len);
+
+    h = (struct capture_header *)hdr;
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof(h->magic));
+    h->version = CAPTURE_VERSION;
+    h->header_size = hdr_len;
+    h->nr_symbols = rec.nr_syms;
+    h->nr_offsets = sizeof(offset_table) / sizeof(long);
+    h->nr_sizes = sizeof(size_table) / sizeof(long);
+    h->nr_ranges = n;
+    clock_gettime(CLOCK_REALTIME, &now);
+    h->time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    h->relocate = kt->relocate;
+    h->kt_flags = kt->flags;
+    h->phys_base = machdep->machspec->phys_base;
+    h->page_offset = machdep->machspec->page_offset;
+    h->kernel_end = machdep->machspec->kernel_end;
+    h->direct_map_end = machdep->machspec->direct_map_end;
+    h->kernel_pgd = vt->kernel_pgd[0];
+    h->vmcoreinfo_data = kt->vmcoreinfo_data;
+    h->vmcoreinfo_size = kt->vmcoreinfo_size;
+    h->prb = kt->prb;
+
+    p = hdr + sizeof(*h);
+    memcpy(p, rec.syms, rec.nr_syms * sizeof(struct capture_symbol));
+    p += rec.nr_syms * sizeof(struct capture_symbol);
+    memcpy(p, &offset_table, sizeof(offset_table));
+    p += sizeof(offset_table);
+    memcpy(p, &size_table, sizeof(size_table));
+    p += sizeof(size_table);
+    memcpy(p, ranges, n * sizeof(struct capture_range));
+
+    iov = xmalloc((n + 1) * sizeof(*iov));
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = hdr_len;
+    for (i = 0, total = hdr_len; i < n; i++) {
+        iov[i + 1].iov_base = data[i];
+        iov[i + 1].iov_len = ranges[i].size;
+        total += ranges[i].size;
+    }
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        pr_err("Cannot create %s: %s", path, strerror(errno));
+        goto out;
+    }
+    if (capture_writev(fd, iov, n + 1) || close(fd)) {
+        pr_err("Cannot write %s: %s", path, strerror(errno));
+        unlink(path);
+        goto out;
+    }
+    ret = 0;
+
+    if (KDEBUG(1))
+        pr_debug("capture: %zu reads in %zu ranges, %zu bytes to %s",
+                rec.nr, n, total, path);
+out:
+    xfree(iov);
+    xfree(hdr);
+    for (i = 0; i < n; i++)
+        xfree(data[i]);
+    xfree(data);
+    xfree(ranges);
+    for (i = 0; i < rec.nr; i++)
+        xfree(rec.recs[i].data);
+    xfree(rec.recs);
+    xfree(rec.syms);
+    memset(&rec, 0, sizeof(rec));
+    return ret;
+}
+
+int capture_client_init(char *path)
+{
+    const struct capture_header *h;
+    struct stat sb;
+    uint64_t off;
+    uint32_t i;
+    int fd;
+
+    if (cap.base)
+        return 0;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        pr_err("Error opening file: %s", path);
+        return -1;
+    }
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(*h)) {
+        pr_err("%s: not a kvm-dmesg capture", path);
+        close(fd);
+        return -1;
+    }
+    cap.base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cap.base == MAP_FAILED) {
+        cap.base = NULL;
+        pr_err("Failed to mmap %s", path);
+        return -1;
+    }
+    cap.len = sb.st_size;
+
+    h = cap.h = (const struct capture_header *)cap.base;
+    if (memcmp(h->magic, CAPTURE_MAGIC, sizeof(h->magic)) ||
+            h->version != CAPTURE_VERSION ||
+            h->nr_offsets != sizeof(offset_table) / sizeof(long) ||
+            h->nr_sizes != sizeof(size_table) / sizeof(long) ||
+            h->header_size > cap.len ||
+            h->header_size != sizeof(*h) +
+                h->nr_symbols * sizeof(struct capture_symbol) +
+                sizeof(offset_table) + sizeof(size_table) +
+                (uint64_t)h->nr_ranges * sizeof(struct capture_range)) {
+        pr_err("%s: not a capture of this kvm-dmesg version", path);
+        goto fail;
+    }
+
+    cap.ranges = (const struct capture_range *)(cap.base + h->header_size -
+            h->nr_ranges * sizeof(struct capture_range));
+    cap.data = xcalloc(h->nr_ranges ? h->nr_ranges : 1, sizeof(char *));
+    for (i = 0, off = h->header_size; i < h->nr_ranges; i++) {
+        if (cap.ranges[i].size > cap.len - off) {
+            pr_err("%s: truncated capture", path);
+            goto fail;
+        }
+        cap.data[i] = cap.base + off;
+        off += cap.ranges[i].size;
+    }
+    return 0;
+
+fail:
+    capture_client_uninit();
+    return -1;
+}
+
+int capture_client_uninit(void)
+{
+    if (cap.base)
+        munmap(cap.base, cap.len);
+    xfree(cap.data);
+    memset(&cap, 0, sizeof(cap));
+    return 0;
+}
+
+int capture_readmem(uint64_t addr, void *buffer, size_t size)
+{
+    const struct capture_range *r;
+    uint32_t lo = 0, hi = cap.h->nr_ranges, mid;
+
+    /* the last range starting at or below addr */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (cap.ranges[mid].paddr <= addr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (!cap.h->nr_ranges)
+        return -1;
+
+    r = &cap.ranges[lo];
+    if (addr < r->paddr || addr - r->paddr >= r->size ||
+            size > r->size - (addr - r->paddr))
+        return -1;
+
+    memcpy(buffer, cap.data[lo] + (addr - r->paddr), size);
+    return 0;
+}
+
+int capture_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4)
+{
+    (void)idtr;
+    (void)cr3;
+    (void)cr4;
+    return -1;
+}
+
+/*
+ * Set up everything startup would have, from the capture alone.  A
+ * System.map is only needed for --symbolize.
+ */
+int capture_load(char *path, const char *symmap_file)
+{
+    const struct capture_header *h;
+    const struct capture_symbol *s;
+    const char *p;
+    char name[sizeof(s->name) + 1];
+    uint32_t i;
+
+    if (guest_client_new(path, GUEST_CAPTURE))
+        return -1;
+    h = cap.h;
+
+    x86_64_init();
+    kt->relocate = h->relocate;
+    kt->flags = h->kt_flags;
+    machdep->machspec->phys_base = h->phys_base;
+    machdep->machspec->page_offset = h->page_offset;
+    machdep->machspec->kernel_end = h->kernel_end;
+    machdep->machspec->direct_map_end = h->direct_map_end;
+    vt->kernel_pgd[0] = h->kernel_pgd;
+    kt->vmcoreinfo_data = h->vmcoreinfo_data;
+    kt->vmcoreinfo_size = h->vmcoreinfo_size;
+    kt->prb = h->prb;
+    tlb_flush();
+
+    p = cap.base + sizeof(*h);
+    for (i = 0; i < h->nr_symbols; i++, p += sizeof(*s)) {
+        s = (const struct capture_symbol *)p;
+        memcpy(name, s->name, sizeof(s->name));
+        name[sizeof(s->name)] = '\0';
+        symbol_install(name, s->value);
+    }
+    memcpy(&offset_table, p, sizeof(offset_table));
+    p += sizeof(offset_table);
+    memcpy(&size_table, p, sizeof(size_table));
+
+    if (pc->flags & SYMBOLIZE) {
+        if (symmap_file) {
+            symtab_init(symmap_file);
+            symtab_full_init();
+        } else {
+            pr_warning("--symbolize needs the System.map with --from-capture");
+            pc->flags &= ~SYMBOLIZE;
+        }
+    }
+
+    vmcoreinfo_init();
+    kernel_init();
+
+    if (KDEBUG(1))
+        pr_debug("capture: %u ranges, taken %lu.%09lu", h->nr_ranges,
+                (ulong)(h->time / 1000000000), (ulong)(h->time % 1000000000));
+    return 0;
+}
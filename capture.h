@@ -0,0 +1,37 @@
+/* capture.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAPTURE_MAGIC       "KDMCAPT"
+#define CAPTURE_VERSION     (2)
+
+/* --capture */
+void capture_start(void);
+int capture_write(const char *path);
+
+/* --from-capture */
+int capture_load(char *path, const char *symmap_file);
+
+int capture_client_init(char *path);
+int capture_client_uninit(void);
+int capture_readmem(uint64_t addr, void *buffer, size_t size);
+int capture_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4);
+
+#endif
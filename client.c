@@ -1,14 +1,66 @@
+#include <sys/stat.h>
+
 #include "defs.h"
 #include "xutil.h"
+#include "log.h"
 #include "mem.h"
 #include "client.h"
+#include "tlb.h"
+#include "capture.h"
 
 guest_client_t *guest_client = NULL;
 
 int get_cr3_idtr(uint64_t *cr3, uint64_t *idtr)
 {
     uint64_t cr4;
-    guest_client->get_registers(idtr, cr3, &cr4);
+
+    return guest_client->get_registers(idtr, cr3, &cr4);
+}
+
+/*
+ * Read through the page tables, one backend read per run of pages that
+ * is contiguous in guest-physical memory.
+ */
+static int readmem_pgtable(uint64_t addr, char *buffer, long size)
+{
+    physaddr_t paddr, run_paddr = 0;
+    char *run_buf = buffer;
+    ulong len, run_len = 0;
+    uint64_t start = addr;
+    int reads = 0;
+
+    while (size > 0) {
+        if (x86_64_kvtop_range(addr, &paddr, &len))
+            return -1;
+        if (len > (ulong)size)
+            len = size;
+
+        if (run_len && run_paddr + run_len == paddr) {
+            run_len += len;
+        } else {
+            if (run_len) {
+                if (guest_client->readmem(run_paddr, run_buf, run_len))
+                    return -1;
+                reads++;
+            }
+            run_buf = buffer;
+            run_paddr = paddr;
+            run_len = len;
+        }
+
+        addr += len;
+        buffer += len;
+        size -= len;
+    }
+
+    if (run_len) {
+        if (guest_client->readmem(run_paddr, run_buf, run_len))
+            return -1;
+        reads++;
+    }
+
+    if (KDEBUG(3))
+        pr_debug("readmem: %lx: %d physical runs", start, reads);
     return 0;
 }
 
@@ -18,10 +70,14 @@ int readmem(uint64_t addr, int memtype, void *buffer, long size)
 
     switch (memtype) {
         case KVADDR:
-            if (addr >= __START_KERNEL_map) {
+            if (addr >= __START_KERNEL_map &&
+                    addr + size <= machdep->machspec->kernel_end) {
                 paddr = ((addr) - (ulong)__START_KERNEL_map + machdep->machspec->phys_base);
-            } else {
+            } else if (addr >= PAGE_OFFSET &&
+                    addr + size <= machdep->machspec->direct_map_end) {
                 paddr = ((addr) - PAGE_OFFSET);
+            } else {
+                return readmem_pgtable(addr, buffer, size);
             }
             break;
         case PHYSADDR:
@@ -32,6 +88,30 @@ int readmem(uint64_t addr, int memtype, void *buffer, long size)
     return guest_client->readmem(paddr, buffer, size);
 }
 
+/*
+ * How to reach a guest named on the command line: a regular file is a
+ * memory image, a socket a QMP monitor, anything else a libvirt domain.
+ */
+int guest_access_type(const char *ac, guest_access_t *ty)
+{
+    struct stat sb;
+
+    if (stat(ac, &sb)) {
+        *ty = GUEST_NAME;
+        return 0;
+    }
+
+    if (S_ISREG(sb.st_mode)) {
+        *ty = GUEST_MEMORY;
+    } else if (S_ISSOCK(sb.st_mode)) {
+        *ty = QMP_SOCKET;
+    } else {
+        pr_err("Unknown file type: %s", ac);
+        return -1;
+    }
+    return 0;
+}
+
 int guest_client_new(char *ac, guest_access_t ty)
 {
     if (guest_client)
@@ -50,12 +130,18 @@ int guest_client_new(char *ac, guest_access_t ty)
                 c->readmem = libvirt_readmem;
             }
             c->get_registers = libvirt_get_registers;
+            c->wait_event = libvirt_wait_event;
             break;
         case GUEST_MEMORY:
             if (file_client_init(ac))
                 return -1;
             c->get_registers = file_get_registers;
             c->readmem = file_readmem;
+            c->mem_size = file_client_size();
+            file_client_vmcoreinfo(&c->vmcoreinfo, &c->vmcoreinfo_size);
+            /* without saved vCPU state, find KASLR from VMCOREINFO */
+            if (!file_has_registers())
+                pc->flags |= SCAN_VMCOREINFO;
             break;
         case QMP_SOCKET:
             if (qmp_client_init(ac))
@@ -67,6 +153,13 @@ int guest_client_new(char *ac, guest_access_t ty)
                 c->readmem = qmp_readmem;
             }
             c->get_registers = qmp_get_registers;
+            c->wait_event = qmp_wait_event;
+            break;
+        case GUEST_CAPTURE:
+            if (capture_client_init(ac))
+                return -1;
+            c->get_registers = capture_get_registers;
+            c->readmem = capture_readmem;
             break;
     }
     guest_client = c;
@@ -91,7 +184,11 @@ int guest_client_release()
             qmp_client_uninit();
             mem_uninit();
             break;
+        case GUEST_CAPTURE:
+            capture_client_uninit();
+            break;
     }
+    tlb_release();
     xfree(c);
     guest_client = NULL;
 
@@ -23,6 +23,7 @@ typedef enum {
     GUEST_NAME,
     GUEST_MEMORY,
     QMP_SOCKET,
+    GUEST_CAPTURE,
 } guest_access_t;
 
 typedef struct {
@@ -30,11 +31,19 @@ typedef struct {
     pid_t pid;
     int (*get_registers)(uint64_t*, uint64_t*, uint64_t*);
     int (*readmem)(uint64_t, void*, size_t);
+    uint64_t mem_size;      /* guest RAM size if the backend knows it */
+    const char *vmcoreinfo; /* VMCOREINFO saved in a dump file */
+    size_t vmcoreinfo_size;
+    /* block for a monitor event, NULL if the backend has none */
+    int (*wait_event)(int timeout_ms, char *event, size_t len);
 } guest_client_t;
 
+extern guest_client_t *guest_client;
+
 int get_cr3_idtr(uint64_t *cr3, uint64_t *idtr);
 int readmem(uint64_t addr, int memtype, void *buffer, long size);
 
+int guest_access_type(const char *ac, guest_access_t *ty);
 int guest_client_new(char *ac, guest_access_t ty);
 int guest_client_release();
 
@@ -44,6 +53,7 @@ int qmp_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4);
 int qmp_readmem(uint64_t addr, void *buffer, size_t size);
 pid_t qmp_get_pid(char *sock_path);
 int qmp_gpa2hva(uint64_t gpa, uint64_t *hva);
+int qmp_wait_event(int timeout_ms, char *event, size_t len);
 
 int libvirt_client_init(char *guest_name);
 int libvirt_client_uninit();
@@ -51,10 +61,14 @@ int libvirt_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4);
 int libvirt_readmem(uint64_t addr, void *buffer, size_t size);
 pid_t libvirt_get_pid(char *guest_name);
 int libvirt_gpa2hva(uint64_t gpa, uint64_t *hva);
+int libvirt_wait_event(int timeout_ms, char *event, size_t len);
 
 int file_client_init(char *sock_path);
 int file_client_uninit();
 int file_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4);
 int file_readmem(uint64_t addr, void *buffer, size_t size);
+uint64_t file_client_size();
+int file_has_registers();
+int file_client_vmcoreinfo(const char **data, size_t *size);
 
 #endif
@@ -48,27 +48,40 @@ typedef unsigned long long int ulonglong;
 
 struct program_context {
     ulong debug;                    /* level of debug */
+    ulong flags;
+    char *btf_file;                 /* --btf */
 };
 
+#define NO_CACHE         (0x1)
+#define SYMBOLIZE        (0x2)
+#define SCAN_VMCOREINFO  (0x4)
+#define NO_MAP           (0x8)
+#define CAPTURE          (0x10)
+#define WATCH_CRASH      (0x20)
+#define WATCH_EVENTS     (0x40)
+#define OOPS_REPORT      (0x80)
+#define STATS_ONLY       (0x100)
+#define STATS_TEXT       (0x200)   /* --stats-top needs the message text */
+#define MERGE            (0x400)
+
 #define RELOC_SET            (0x2000000)
 
+#define LINUX(x,y,z) (((uint)(x) << 24) + ((uint)(y) << 16) + (uint)(z))
+
+#define THIS_KERNEL_VERSION ((kt->kernel_version[0] << 24) + \
+                             (kt->kernel_version[1] << 16) + \
+                             (kt->kernel_version[2]))
+
 struct kernel_table {
     ulong flags;
     ulong relocate;
 	uint kernel_version[3];
+    ulong vmcoreinfo_data;          /* runtime address of the VMCOREINFO note */
+    ulong vmcoreinfo_size;
+    ulong prb;                      /* runtime address of the printk_ringbuffer */
 };
 
 struct machdep_table {
-	char *pgd;
-	char *pud;
-	char *pmd;
-	char *ptbl;
-
-	ulong last_pgd_read;
-	ulong last_pud_read;
-	ulong last_pmd_read;
-	ulong last_ptbl_read;
-
 	struct machine_specific *machspec;
 	unsigned int pagesize;
 	unsigned long pageoffset;
@@ -79,36 +92,6 @@ extern struct machdep_table *machdep;
 
 #define NULLCHAR ('\0')
 
-#define IS_LAST_PGD_READ(pgd)     ((ulong)(pgd) == machdep->last_pgd_read)
-#define IS_LAST_PMD_READ(pmd)     ((ulong)(pmd) == machdep->last_pmd_read)
-#define IS_LAST_PTBL_READ(ptbl)   ((ulong)(ptbl) == machdep->last_ptbl_read)
-#define IS_LAST_PUD_READ(pud)     ((ulong)(pud) == machdep->last_pud_read)
-
-
-#define FILL_PGD(PGD, SIZE)                       \
-    if (!IS_LAST_PGD_READ(PGD)) {                                             \
-            readmem((ulonglong)((ulong)(PGD)), PHYSADDR, machdep->pgd, SIZE); \
-            machdep->last_pgd_read = (ulong)(PGD);                            \
-    }
-
-#define FILL_PUD(PUD, SIZE)                       \
-    if (!IS_LAST_PUD_READ(PUD)) {                                             \
-            readmem((ulonglong)((ulong)(PUD)), PHYSADDR, machdep->pud, SIZE); \
-            machdep->last_pud_read = (ulong)(PUD);                            \
-    }
-
-#define FILL_PMD(PMD, SIZE)                               \
-    if (!IS_LAST_PMD_READ(PMD)) {                                             \
-            readmem((ulonglong)(PMD), PHYSADDR, machdep->pmd, SIZE);          \
-            machdep->last_pmd_read = (ulong)(PMD);                            \
-    }
-
-#define FILL_PTBL(PTBL, SIZE)                         \
-    if (!IS_LAST_PTBL_READ(PTBL)) {                                           \
-            readmem((ulonglong)(PTBL), PHYSADDR, machdep->ptbl, SIZE);        \
-            machdep->last_ptbl_read = (ulong)(PTBL);                          \
-    }
-
 struct offset_table {
     // struct printk_ringbuffer
     long prb_desc_ring;
@@ -124,6 +107,33 @@ struct offset_table {
     // struct prb_data_ring
     long prb_data_ring_size_bits;
     long prb_data_ring_data;
+
+    // struct prb_desc
+    long prb_desc_state_var;
+    long prb_desc_text_blk_lpos;
+
+    // struct prb_data_blk_lpos
+    long prb_data_blk_lpos_begin;
+    long prb_data_blk_lpos_next;
+
+    // struct printk_info
+    long printk_info_seq;
+    long printk_info_ts_nsec;
+    long printk_info_text_len;
+    long printk_info_caller_id;
+    long printk_info_dev_info;
+
+    // struct dev_printk_info
+    long dev_printk_info_subsystem;
+    long dev_printk_info_device;
+
+    // atomic_long_t
+    long atomic_long_t_counter;
+
+    // struct printk_log (struct log before 3.11)
+    long printk_log_ts_nsec;
+    long printk_log_len;
+    long printk_log_text_len;
 };
 
 struct size_table {
@@ -133,6 +143,8 @@ struct size_table {
     long printk_ringbuffer;
     long prb_desc_ring;
     long prb_data_ring;
+
+    long printk_log;
 };
 
 #define MEMBER_OFFSET_REQUEST (0)
@@ -141,6 +153,11 @@ struct size_table {
 #define STRUCT_SIZE(X)      datatype_info((X), NULL, STRUCT_SIZE_REQUEST)
 #define MEMBER_OFFSET(X,Y)  datatype_info((X), (Y), MEMBER_OFFSET_REQUEST)
 
+#define INVALID_OFFSET     (-1)
+#define INVALID_SIZE       (-1)
+#define VALID_MEMBER(X)    (offset_table.X >= 0)
+#define VALID_SIZE(X)      (size_table.X > 0)
+
 #define OFFSET(X)          (offset_table.X)
 #define SIZE(X)            (size_table.X)
 #define ASSIGN_SIZE(X)     (size_table.X)
@@ -152,6 +169,7 @@ struct size_table {
 #define ULONG(ADDR)     *((ulong *)((char *)(ADDR)))
 #define UINT(ADDR)      *((uint *)((char *)(ADDR)))
 #define USHORT(ADDR)    *((ushort *)((char *)(ADDR)))
+#define UCHAR(ADDR)     *((unsigned char *)((char *)(ADDR)))
 #define ULONGLONG(ADDR) *((ulonglong *)((char *)(ADDR)))
 
 struct vm_table {
@@ -161,16 +179,9 @@ struct vm_table {
 struct syment {
     ulong value;
     char *name;
-    struct syment *name_hash_next;
-    unsigned char cnt;
 };
 
-#define SYMNAME_HASH (512)
-#define SYMNAME_HASH_INDEX(name) \
-     ((name[0] ^ (name[strlen(name)-1] * name[strlen(name)/2])) % SYMNAME_HASH)
-
 struct symbol_table_data {
-    struct syment *symname_hash[SYMNAME_HASH];
     ulong divide_error_vmlinux;
     ulong idt_table_vmlinux;
 };
@@ -186,11 +197,17 @@ struct symbol_table_data {
 #define PAGEBASE(X)     (((ulong)(X)) & (ulong)machdep->pagemask)
 
 struct machine_specific {
+    ulong cr3;
+    ulong idtr;
+    ulong idtr_paddr;
+    ulong idt_vec0;
     ulong page_offset;
     ulong phys_base;
     ulong pgdir_shift;
     ulong ptrs_per_pgd;
     ulong physical_mask_shift;
+    ulong kernel_end;               /* linear kernel image, see readmem() */
+    ulong direct_map_end;
 };
 
 #define PAGE_OFFSET     (machdep->machspec->page_offset)
@@ -231,6 +248,18 @@ struct machine_specific {
 #define PAGE_SIZE              (1UL << PAGE_SHIFT)
 #define PHYSICAL_PAGE_MASK    (~(PAGE_SIZE-1) & __PHYSICAL_MASK )
 
+#define _PAGE_PRESENT          0x001
+#define _PAGE_PSE              0x080    /* 2MB or 1GB leaf */
+
+/*
+ * The kernel image and the direct map are linear; anything else needs the
+ * page tables.  Until x86_64_post_reloc() bounds them by _end and
+ * vmalloc_base, the layout without KASLR is assumed: a 512MB image and a
+ * 64TB direct map.
+ */
+#define KERNEL_IMAGE_SIZE      (1UL << 29)
+#define DIRECT_MAP_SIZE        (1UL << 46)
+
 /*
  *  Global data (global_data.c)
  */
@@ -243,12 +272,33 @@ extern struct vm_table vm_table, *vt;
 extern struct symbol_table_data symbol_table_data, *st;
 
 
+/*
+ * main.c
+ */
+void x86_64_init();
+int x86_64_get_registers();
+int x86_64_kvtop(ulong, physaddr_t *);
+int x86_64_kvtop_range(ulong, physaddr_t *, ulong *);
+int x86_64_idt_probe(ulong *, ulong *);
+int derive_kaslr_offset();
+void x86_64_post_reloc();
+void dump_kernel_log(void);
+
 /*
  * symbols.c
  */
 void symtab_init(const char*);
+void symtab_release(void);
 ulong symbol_value(char *);
 int kernel_symbol_exists(char *s);
+int symbol_install(const char *name, ulong value);
+ulong relocate(ulong);
+void symbol_foreach(void (*)(const char *, ulong, void *), void *);
+#define KSYM_NAME_LEN       (512)
+#define SYMBOLIZE_ADDR_LEN  (20)        /* [<ffffffff81000000>] */
+int symtab_full_init(void);
+const char *symbol_lookup(ulong, ulong *, ulong *);
+size_t symbolize_address(const char *, size_t, char *, size_t);
 
 
 /*
@@ -259,7 +309,5 @@ void get_symbol_data(char *symbol, long size, void *local);
 void kernel_init(void);
 long datatype_info(char *name, char *member, int datatype);
 void parse_kernel_version(char *);
-void vmcoreinfo_init();
 void die(const char *err, ...);
-char *vmcoreinfo_read_string(const char *key);
 #endif
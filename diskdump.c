@@ -0,0 +1,390 @@
+/* diskdump.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <sys/param.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "diskdump.h"
+
+/*
+ * The kdump-compressed format written by makedumpfile and by QEMU's
+ * dump-guest-memory -z/-l/-s.  Only zlib and zstd pages are decoded;
+ * lzo and snappy dumps are refused at open:
+ *
+ *   block 0                    disk_dump_header
+ *   block 1                    kdump_sub_header (sub_hdr_size blocks)
+ *   then                       two bitmaps (bitmap_blocks blocks): pfns
+ *                              that are RAM, and pfns that were dumped
+ *   then                       one page_desc per dumped pfn, in pfn order
+ *   then                       the page data, each page compressed alone
+ *
+ * The file is already mapped by file_client.c.  Only the bitmaps are
+ * looked at up front, to count the dumped pages before each bitmap word;
+ * a page is then found and decompressed when it is read.  Compressed
+ * pages go through a small LRU cache, raw pages are copied straight from
+ * the mapping.  RAM pages that makedumpfile filtered out read as zeros.
+ */
+#define KDUMP_SIGNATURE         "KDUMP   "
+#define KDUMP_SIG_LEN           (8)
+
+#define DUMP_DH_COMPRESSED_ZLIB     (0x1)
+#define DUMP_DH_COMPRESSED_LZO      (0x2)
+#define DUMP_DH_COMPRESSED_SNAPPY   (0x4)
+#define DUMP_DH_COMPRESSED_INCOMPLETE (0x8)
+#define DUMP_DH_COMPRESSED_ZSTD     (0x20)
+
+struct disk_dump_header {
+    char signature[KDUMP_SIG_LEN];
+    int32_t header_version;
+    char utsname[6][65];
+    struct {
+        int64_t tv_sec;
+        int64_t tv_usec;
+    } timestamp;
+    uint32_t status;
+    int32_t block_size;
+    int32_t sub_hdr_size;           /* in blocks */
+    uint32_t bitmap_blocks;
+    uint32_t max_mapnr;             /* 32-bit, see max_mapnr_64 */
+    uint32_t total_ram_blocks;
+    uint32_t device_blocks;
+    uint32_t written_blocks;
+    uint32_t current_cpu;
+    int32_t nr_cpus;
+};
+
+struct kdump_sub_header {
+    uint64_t phys_base;
+    int32_t dump_level;             /* header_version 1 and later */
+    int32_t split;                  /* 2 and later */
+    uint64_t start_pfn;
+    uint64_t end_pfn;
+    uint64_t offset_vmcoreinfo;     /* 3 and later */
+    uint64_t size_vmcoreinfo;
+    uint64_t offset_note;           /* 4 and later */
+    uint64_t size_note;
+    uint64_t offset_eraseinfo;      /* 5 and later */
+    uint64_t size_eraseinfo;
+    uint64_t start_pfn_64;          /* 6 and later */
+    uint64_t end_pfn_64;
+    uint64_t max_mapnr_64;
+};
+
+struct page_desc {
+    uint64_t offset;                /* of the page data in the file */
+    uint32_t size;
+    uint32_t flags;                 /* DUMP_DH_COMPRESSED_* */
+    uint64_t page_flags;
+};
+
+struct page_cache_entry {
+    uint64_t pfn;                   /* pfn + 1, 0 is empty */
+    ulong used;                     /* last use, for LRU replacement */
+    char *data;
+};
+
+struct decompressor {
+    uint32_t flag;
+    const char *lib;
+    const char *func;
+    void *handle;
+    void *fn;
+    int tried;
+};
+
+static struct decompressor decompressors[] = {
+    { .flag = DUMP_DH_COMPRESSED_ZLIB,
+      .lib = "libz.so.1",      .func = "uncompress" },
+    { .flag = DUMP_DH_COMPRESSED_ZSTD,
+      .lib = "libzstd.so.1",   .func = "ZSTD_decompress" },
+};
+
+#define NR_DECOMPRESSORS    (sizeof(decompressors) / sizeof(decompressors[0]))
+
+static struct {
+    const char *base;
+    size_t len;
+    size_t block_size;
+    uint64_t max_mapnr;
+    const unsigned char *bitmap1;   /* RAM */
+    const unsigned char *bitmap2;   /* dumped */
+    uint64_t *rank;                 /* dumped pages before each 64-bit word */
+    uint64_t nr_dumped;
+    uint64_t descs;                 /* file offset of the page_desc array */
+    struct page_cache_entry cache[DISKDUMP_CACHE_PAGES];
+    ulong clock;
+    char *zero_page;
+    ulong hits, decompressed;
+} dd;
+
+int is_diskdump(const char *base, size_t len)
+{
+    return len >= sizeof(struct disk_dump_header) &&
+        !memcmp(base, KDUMP_SIGNATURE, KDUMP_SIG_LEN);
+}
+
+static inline uint64_t bitmap_word(const unsigned char *bitmap, uint64_t w)
+{
+    uint64_t v;
+
+    memcpy(&v, bitmap + w * 8, sizeof(v));
+    return v;
+}
+
+static inline int bitmap_test(const unsigned char *bitmap, uint64_t pfn)
+{
+    return bitmap[pfn >> 3] & (1 << (pfn & 7));
+}
+
+int diskdump_init(const char *path, const char *base, size_t len,
+        struct dump_notes *notes)
+{
+    struct disk_dump_header h;
+    struct kdump_sub_header sub;
+    uint64_t bitmap_len, sub_off, nr_words, w, v;
+
+    memcpy(&h, base, sizeof(h));
+    memset(notes, 0, sizeof(*notes));
+
+    if (h.block_size != (int32_t)PAGE_SIZE || h.sub_hdr_size < 0) {
+        pr_err("%s: unsupported block size %d", path, h.block_size);
+        return -1;
+    }
+    /* not decoded until there is a test dump for each of them */
+    if (h.status & (DUMP_DH_COMPRESSED_LZO | DUMP_DH_COMPRESSED_SNAPPY)) {
+        pr_err("%s: lzo and snappy compressed dumps are not supported, "
+                "dump with -z or as an ELF core", path);
+        return -1;
+    }
+    if (h.status & DUMP_DH_COMPRESSED_INCOMPLETE)
+        pr_warning("%s: the dump is incomplete", path);
+
+    dd.base = base;
+    dd.len = len;
+    dd.block_size = h.block_size;
+
+    sub_off = dd.block_size;
+    bitmap_len = (uint64_t)h.bitmap_blocks * dd.block_size;
+    dd.descs = (1 + (uint64_t)h.sub_hdr_size + h.bitmap_blocks) *
+        dd.block_size;
+    if (dd.descs > len || sub_off + sizeof(sub) > len) {
+        pr_err("%s: truncated kdump header", path);
+        return -1;
+    }
+
+    memcpy(&sub, base + sub_off, sizeof(sub));
+    dd.max_mapnr = h.header_version >= 6 ? sub.max_mapnr_64 : h.max_mapnr;
+    if (dd.max_mapnr > bitmap_len / 2 * 8) {
+        pr_err("%s: bitmap too small for %lu pages", path,
+                (ulong)dd.max_mapnr);
+        return -1;
+    }
+
+    dd.bitmap1 = (const unsigned char *)base +
+        (1 + (uint64_t)h.sub_hdr_size) * dd.block_size;
+    dd.bitmap2 = dd.bitmap1 + bitmap_len / 2;
+
+    nr_words = (dd.max_mapnr + 63) / 64;
+    dd.rank = xmalloc((nr_words + 1) * sizeof(uint64_t));
+    for (w = 0, v = 0; w < nr_words; w++) {
+        dd.rank[w] = v;
+        v += __builtin_popcountll(bitmap_word(dd.bitmap2, w));
+    }
+    dd.rank[nr_words] = v;
+    dd.nr_dumped = v;
+
+    if (dd.nr_dumped * sizeof(struct page_desc) > len - dd.descs) {
+        pr_err("%s: truncated page descriptor table", path);
+        diskdump_uninit();
+        return -1;
+    }
+
+    if (h.header_version >= 3 && sub.offset_vmcoreinfo &&
+            sub.offset_vmcoreinfo < len &&
+            sub.size_vmcoreinfo <= len - sub.offset_vmcoreinfo) {
+        notes->vmcoreinfo_offset = sub.offset_vmcoreinfo;
+        notes->vmcoreinfo_size = sub.size_vmcoreinfo;
+    }
+    if (h.header_version >= 4 && sub.offset_note &&
+            sub.offset_note < len && sub.size_note <= len - sub.offset_note) {
+        notes->note_offset = sub.offset_note;
+        notes->note_size = sub.size_note;
+    }
+
+    dd.zero_page = xcalloc(1, dd.block_size);
+
+    if (KDEBUG(1))
+        pr_debug("%s: kdump-compressed v%d, %lu of %lu pages dumped", path,
+                h.header_version, (ulong)dd.nr_dumped, (ulong)dd.max_mapnr);
+    return 0;
+}
+
+void diskdump_uninit(void)
+{
+    int i;
+
+    if (KDEBUG(1) && (dd.hits || dd.decompressed))
+        pr_debug("diskdump: %lu pages decompressed, %lu cache hits",
+                dd.decompressed, dd.hits);
+
+    for (i = 0; i < DISKDUMP_CACHE_PAGES; i++)
+        xfree(dd.cache[i].data);
+    xfree(dd.rank);
+    xfree(dd.zero_page);
+    memset(&dd, 0, sizeof(dd));
+}
+
+uint64_t diskdump_size(void)
+{
+    return dd.max_mapnr * dd.block_size;
+}
+
+static void *decompressor_get(uint32_t flags)
+{
+    struct decompressor *d;
+    size_t i;
+
+    for (i = 0; i < NR_DECOMPRESSORS; i++) {
+        d = &decompressors[i];
+        if (!(flags & d->flag))
+            continue;
+        if (d->tried)
+            return d->fn;
+        d->tried = TRUE;
+
+        if (!(d->handle = dlopen(d->lib, RTLD_LAZY)) ||
+                !(d->fn = dlsym(d->handle, d->func))) {
+            pr_err("Cannot load %s to decompress the dump: %s", d->lib,
+                    dlerror());
+            return NULL;
+        }
+        return d->fn;
+    }
+    return NULL;
+}
+
+static int diskdump_decompress(const struct page_desc *pd, char *out)
+{
+    const char *src = dd.base + pd->offset;
+    void *fn = decompressor_get(pd->flags);
+    unsigned long zlen = dd.block_size;
+    size_t len = dd.block_size;
+
+    if (!fn)
+        return -1;
+
+    if (pd->flags & DUMP_DH_COMPRESSED_ZLIB) {
+        int (*uncompress)(unsigned char *, unsigned long *,
+                const unsigned char *, unsigned long) = fn;
+
+        if (uncompress((unsigned char *)out, &zlen,
+                    (const unsigned char *)src, pd->size))
+            return -1;
+        len = zlen;
+    } else if (pd->flags & DUMP_DH_COMPRESSED_ZSTD) {
+        size_t (*zstd_decompress)(void *, size_t, const void *, size_t) = fn;
+
+        /* an error code is never a valid page size */
+        len = zstd_decompress(out, dd.block_size, src, pd->size);
+    }
+
+    return len == dd.block_size ? 0 : -1;
+}
+
+static char *page_cache_get(uint64_t pfn, const struct page_desc *pd)
+{
+    struct page_cache_entry *e, *victim = NULL;
+    int i;
+
+    dd.clock++;
+    for (i = 0; i < DISKDUMP_CACHE_PAGES; i++) {
+        e = &dd.cache[i];
+        if (e->pfn == pfn + 1) {
+            e->used = dd.clock;
+            dd.hits++;
+            return e->data;
+        }
+        if (!victim || e->used < victim->used)
+            victim = e;
+    }
+
+    if (!victim->data)
+        victim->data = xmalloc(dd.block_size);
+
+    if (diskdump_decompress(pd, victim->data)) {
+        victim->pfn = 0;
+        victim->used = 0;
+        if (KDEBUG(1))
+            pr_debug("diskdump: cannot decompress pfn %lx", (ulong)pfn);
+        return NULL;
+    }
+    dd.decompressed++;
+    victim->pfn = pfn + 1;
+    victim->used = dd.clock;
+    return victim->data;
+}
+
+/* the contents of page pfn, or NULL when it is not in the dump */
+static const char *diskdump_page(uint64_t pfn)
+{
+    struct page_desc pd;
+    uint64_t idx, w = pfn / 64;
+
+    if (pfn >= dd.max_mapnr || !bitmap_test(dd.bitmap1, pfn))
+        return NULL;
+    if (!bitmap_test(dd.bitmap2, pfn))
+        return dd.zero_page;
+
+    idx = dd.rank[w] + __builtin_popcountll(bitmap_word(dd.bitmap2, w) &
+            ((1ULL << (pfn % 64)) - 1));
+    memcpy(&pd, dd.base + dd.descs + idx * sizeof(pd), sizeof(pd));
+
+    if (pd.offset > dd.len || pd.size > dd.len - pd.offset ||
+            pd.size > dd.block_size)
+        return NULL;
+
+    if (!(pd.flags & (DUMP_DH_COMPRESSED_ZLIB | DUMP_DH_COMPRESSED_LZO |
+                    DUMP_DH_COMPRESSED_SNAPPY | DUMP_DH_COMPRESSED_ZSTD)))
+        return pd.size == dd.block_size ? dd.base + pd.offset : NULL;
+
+    return page_cache_get(pfn, &pd);
+}
+
+int diskdump_readmem(uint64_t addr, void *buffer, size_t size)
+{
+    char *buf = buffer;
+    const char *page;
+    size_t off, len;
+
+    while (size) {
+        off = addr & (dd.block_size - 1);
+        len = MIN(size, dd.block_size - off);
+
+        if (!(page = diskdump_page(addr / dd.block_size)))
+            return -1;
+        memcpy(buf, page + off, len);
+
+        addr += len;
+        buf += len;
+        size -= len;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* diskdump.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __DISKDUMP_H__
+#define __DISKDUMP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DISKDUMP_CACHE_PAGES    (64)
+
+/* file offsets of what a dump saved besides memory, 0 when absent */
+struct dump_notes {
+    uint64_t note_offset;
+    uint64_t note_size;
+    uint64_t vmcoreinfo_offset;
+    uint64_t vmcoreinfo_size;
+};
+
+int is_diskdump(const char *base, size_t len);
+int diskdump_init(const char *path, const char *base, size_t len,
+        struct dump_notes *notes);
+void diskdump_uninit(void);
+uint64_t diskdump_size(void);
+int diskdump_readmem(uint64_t addr, void *buffer, size_t size);
+
+#endif
@@ -0,0 +1,373 @@
+/* file_client.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "diskdump.h"
+
+/*
+ * Guest memory saved to a file: a flat image of guest-physical memory,
+ * the ELF core written by QEMU's dump-guest-memory, or a kdump-compressed
+ * dump (diskdump.c).  The file is mapped once and every read is a
+ * memcpy() out of the mapping.
+ *
+ * An ELF core describes guest RAM with PT_LOAD segments, whose p_paddr is
+ * the guest-physical address, and carries one "QEMU" note per vCPU with
+ * its register state.  CR3 and the IDT base come from the first one.  A
+ * kdump-compressed dump keeps the same notes in its sub header.  Either
+ * may also hold a copy of the guest's VMCOREINFO.
+ */
+struct load_segment {
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;             /* past filesz reads as zero */
+    uint64_t offset;
+};
+
+/* target/i386/arch_dump.c in QEMU */
+struct qemu_cpu_segment {
+    uint32_t selector;
+    uint32_t limit;
+    uint32_t flags;
+    uint32_t pad;
+    uint64_t base;
+};
+
+struct qemu_cpu_state {
+    uint32_t version;
+    uint32_t size;
+    uint64_t rax, rbx, rcx, rdx, rsi, rdi, rsp, rbp;
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    uint64_t rip, rflags;
+    struct qemu_cpu_segment cs, ds, es, fs, gs, ss;
+    struct qemu_cpu_segment ldt, tr, gdt, idt;
+    uint64_t cr[5];
+};
+
+enum dump_kind {
+    DUMP_FLAT,
+    DUMP_ELF,
+    DUMP_KDUMP,
+};
+
+static struct {
+    char *base;
+    size_t len;
+    enum dump_kind kind;
+    struct load_segment *segs;      /* sorted by paddr */
+    int nr_segs;
+    int last;                       /* segment of the previous read */
+    uint64_t mem_size;
+    int has_cpu_state;
+    uint64_t cr3, idtr, cr4;
+    const char *vmcoreinfo;
+    size_t vmcoreinfo_size;
+} dump;
+
+static int segment_cmp(const void *a, const void *b)
+{
+    const struct load_segment *x = a, *y = b;
+
+    return x->paddr < y->paddr ? -1 : x->paddr > y->paddr;
+}
+
+static void elf_note_cpu_state(const char *desc, size_t descsz)
+{
+    struct qemu_cpu_state cpu;
+
+    if (dump.has_cpu_state || descsz < sizeof(cpu))
+        return;
+
+    memcpy(&cpu, desc, sizeof(cpu));
+    if (cpu.size < sizeof(cpu))
+        return;
+
+    dump.cr3 = cpu.cr[3];
+    dump.cr4 = cpu.cr[4];
+    dump.idtr = cpu.idt.base;
+    dump.has_cpu_state = TRUE;
+}
+
+static void elf_parse_notes(uint64_t offset, uint64_t size)
+{
+    const char *p, *end, *name, *desc;
+    Elf64_Nhdr nhdr;
+
+    if (offset > dump.len || size > dump.len - offset)
+        return;
+
+    p = dump.base + offset;
+    end = p + size;
+    while ((size_t)(end - p) >= sizeof(nhdr)) {
+        memcpy(&nhdr, p, sizeof(nhdr));
+        name = p + sizeof(nhdr);
+        desc = name + roundup(nhdr.n_namesz, 4);
+        if (desc > end || nhdr.n_descsz > (size_t)(end - desc))
+            break;
+
+        if (nhdr.n_namesz == 5 && !memcmp(name, "QEMU", 5) &&
+                nhdr.n_type == 0)
+            elf_note_cpu_state(desc, nhdr.n_descsz);
+        else if (nhdr.n_namesz == 11 && !memcmp(name, "VMCOREINFO", 11) &&
+                !dump.vmcoreinfo) {
+            dump.vmcoreinfo = desc;
+            dump.vmcoreinfo_size = nhdr.n_descsz;
+        }
+
+        p = desc + roundup(nhdr.n_descsz, 4);
+    }
+}
+
+static int elf_parse(const char *path)
+{
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)dump.base;
+    Elf64_Phdr phdr;
+    uint64_t end;
+    int i;
+
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+            ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+            ehdr->e_type != ET_CORE || ehdr->e_machine != EM_X86_64 ||
+            ehdr->e_phentsize != sizeof(Elf64_Phdr) ||
+            ehdr->e_phoff > dump.len ||
+            (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) >
+                dump.len - ehdr->e_phoff) {
+        pr_err("%s: not an x86_64 ELF core", path);
+        return -1;
+    }
+
+    dump.segs = xcalloc(ehdr->e_phnum, sizeof(struct load_segment));
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        memcpy(&phdr, dump.base + ehdr->e_phoff + i * sizeof(phdr),
+                sizeof(phdr));
+
+        if (phdr.p_type == PT_NOTE) {
+            elf_parse_notes(phdr.p_offset, phdr.p_filesz);
+            continue;
+        }
+        if (phdr.p_type != PT_LOAD || !phdr.p_memsz)
+            continue;
+
+        if (phdr.p_offset > dump.len ||
+                phdr.p_filesz > dump.len - phdr.p_offset ||
+                phdr.p_filesz > phdr.p_memsz) {
+            pr_err("%s: PT_LOAD at %lx is truncated", path,
+                    (ulong)phdr.p_paddr);
+            return -1;
+        }
+
+        dump.segs[dump.nr_segs].paddr = phdr.p_paddr;
+        dump.segs[dump.nr_segs].filesz = phdr.p_filesz;
+        dump.segs[dump.nr_segs].memsz = phdr.p_memsz;
+        dump.segs[dump.nr_segs].offset = phdr.p_offset;
+        dump.nr_segs++;
+
+        end = phdr.p_paddr + phdr.p_memsz;
+        if (end > dump.mem_size)
+            dump.mem_size = end;
+    }
+
+    if (!dump.nr_segs) {
+        pr_err("%s: no PT_LOAD segments", path);
+        return -1;
+    }
+    qsort(dump.segs, dump.nr_segs, sizeof(struct load_segment), segment_cmp);
+
+    if (KDEBUG(1))
+        pr_debug("%s: ELF core, %d PT_LOAD segments, %s", path,
+                dump.nr_segs, dump.has_cpu_state ?
+                "QEMU CPU state" : "no CPU state");
+    return 0;
+}
+
+int file_client_init(char *path)
+{
+    struct dump_notes notes;
+    struct stat sb;
+    int fd;
+
+    if (dump.base)
+        return 0;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        pr_err("Error opening file: %s", path);
+        return -1;
+    }
+    if (fstat(fd, &sb) || !sb.st_size) {
+        pr_err("Error reading file: %s", path);
+        close(fd);
+        return -1;
+    }
+
+    dump.base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (dump.base == MAP_FAILED) {
+        dump.base = NULL;
+        pr_err("Failed to mmap %s", path);
+        return -1;
+    }
+    dump.len = sb.st_size;
+
+    if (dump.len >= sizeof(Elf64_Ehdr) &&
+            !memcmp(dump.base, ELFMAG, SELFMAG)) {
+        dump.kind = DUMP_ELF;
+        if (elf_parse(path)) {
+            file_client_uninit();
+            return -1;
+        }
+    } else if (is_diskdump(dump.base, dump.len)) {
+        dump.kind = DUMP_KDUMP;
+        if (diskdump_init(path, dump.base, dump.len, &notes)) {
+            file_client_uninit();
+            return -1;
+        }
+        dump.mem_size = diskdump_size();
+        if (notes.note_size)
+            elf_parse_notes(notes.note_offset, notes.note_size);
+        if (notes.vmcoreinfo_size) {
+            dump.vmcoreinfo = dump.base + notes.vmcoreinfo_offset;
+            dump.vmcoreinfo_size = notes.vmcoreinfo_size;
+        }
+    } else {
+        /* holes in a sparse image read as zeros without touching disk */
+        dump.mem_size = dump.len;
+    }
+
+    return 0;
+}
+
+int file_client_uninit()
+{
+    if (dump.kind == DUMP_KDUMP)
+        diskdump_uninit();
+    if (dump.base)
+        munmap(dump.base, dump.len);
+    xfree(dump.segs);
+    memset(&dump, 0, sizeof(dump));
+    return 0;
+}
+
+uint64_t file_client_size()
+{
+    return dump.mem_size;
+}
+
+int file_has_registers()
+{
+    return dump.has_cpu_state;
+}
+
+int file_client_vmcoreinfo(const char **data, size_t *size)
+{
+    if (!dump.vmcoreinfo || !dump.vmcoreinfo_size)
+        return -1;
+
+    *data = dump.vmcoreinfo;
+    *size = dump.vmcoreinfo_size;
+    return 0;
+}
+
+/*
+ * Index of the segment holding addr, or -1.  Reads mostly follow each
+ * other, so try the previous segment before the binary search.
+ */
+static int segment_find(uint64_t addr)
+{
+    struct load_segment *s = &dump.segs[dump.last];
+    int lo = 0, hi = dump.nr_segs - 1, mid;
+
+    if (addr >= s->paddr && addr - s->paddr < s->memsz)
+        return dump.last;
+
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+        s = &dump.segs[mid];
+        if (addr < s->paddr)
+            hi = mid - 1;
+        else if (addr - s->paddr >= s->memsz)
+            lo = mid + 1;
+        else
+            return dump.last = mid;
+    }
+    return -1;
+}
+
+int file_readmem(uint64_t addr, void *buffer, size_t size)
+{
+    struct load_segment *s;
+    char *buf = buffer;
+    uint64_t off, len;
+    int i;
+
+    switch (dump.kind) {
+        case DUMP_FLAT:
+            if (addr > dump.len || size > dump.len - addr)
+                return -1;
+            memcpy(buffer, dump.base + addr, size);
+            return 0;
+        case DUMP_KDUMP:
+            return diskdump_readmem(addr, buffer, size);
+        case DUMP_ELF:
+            break;
+    }
+
+    /* a read may run across adjacent segments, but not into a hole */
+    while (size) {
+        if ((i = segment_find(addr)) < 0)
+            return -1;
+        s = &dump.segs[i];
+        off = addr - s->paddr;
+        len = MIN(size, s->memsz - off);
+
+        if (off >= s->filesz) {
+            memset(buf, 0, len);
+        } else if (len > s->filesz - off) {
+            memcpy(buf, dump.base + s->offset + off, s->filesz - off);
+            memset(buf + s->filesz - off, 0, len - (s->filesz - off));
+        } else {
+            memcpy(buf, dump.base + s->offset + off, len);
+        }
+
+        addr += len;
+        buf += len;
+        size -= len;
+    }
+    return 0;
+}
+
+int file_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4)
+{
+    if (!dump.has_cpu_state) {
+        pr_err("The memory image has no vCPU state");
+        return -1;
+    }
+
+    *cr3 = dump.cr3;
+    *idtr = dump.idtr;
+    *cr4 = dump.cr4;
+    return 0;
+}
@@ -0,0 +1,727 @@
+/* kallsyms.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "bootcache.h"
+#include "sysmap.h"
+#include "vmcoreinfo.h"
+#include "kallsyms.h"
+
+/*
+ * --no-map: rebuild the System.map from the kernel's own compressed symbol
+ * table.  scripts/kallsyms lays it out as
+ *
+ *   kallsyms_offsets, kallsyms_relative_base   (6.4+: after token_index)
+ *   kallsyms_num_syms
+ *   kallsyms_names          per symbol a length and token codes
+ *   kallsyms_markers        offset in names of every 256th symbol
+ *   kallsyms_seqs_of_names  (6.2+)
+ *   kallsyms_token_table    256 NUL terminated tokens
+ *   kallsyms_token_index    u16 offset of each token
+ *
+ * Kernels that list the tables in VMCOREINFO are read directly.  For the
+ * others the token table is found by the run of single digit tokens it
+ * always holds, and the other tables are located relative to it.
+ *
+ * The decoded symbols are written out as a System.map under BOOTCACHE_DIR,
+ * keyed by the build ID, so that they go through symtab_init() and the map
+ * index like any other map, and the next run skips the decoding.
+ */
+#define KALLSYMS_TEXT_OFFSET    (0x1000000UL)   /* _text - __START_KERNEL_map */
+#define KALLSYMS_SEARCH_SIZE    (128UL << 20)
+#define KALLSYMS_CHUNK          (2UL << 20)
+#define KALLSYMS_BEFORE         (16UL << 20)    /* offsets, names, markers */
+#define KALLSYMS_AFTER          (4UL << 20)     /* 6.4+ offsets */
+#define KALLSYMS_MARKERS_WINDOW (4UL << 20)     /* markers and seqs_of_names */
+#define KALLSYMS_MAX_SYMS       (1U << 22)
+#define KALLSYMS_ENTRY_MAX      (2 + KSYM_NAME_LEN)
+
+/* tokens 0x2f, '0', ..., '9' */
+static const char digit_tokens[] = "\0" "0\0" "1\0" "2\0" "3\0" "4\0" "5\0"
+    "6\0" "7\0" "8\0" "9";
+
+struct kallsyms {
+    ulong kaslr;
+    ulong phys_base;
+
+    /* the tables, read from the kernel image as one region */
+    ulong vaddr;
+    char *buf;
+    size_t len;
+
+    uint32_t num_syms;
+    size_t names;                   /* offsets into buf */
+    size_t names_end;
+    size_t token_table;
+    size_t offsets;                 /* kallsyms_offsets or kallsyms_addresses */
+    uint64_t relative_base;         /* 0 for absolute addresses */
+    int absolute_percpu;
+    uint16_t token_off[256];
+    uint8_t token_len[256];
+
+    const char *source;
+    char *map;
+    size_t map_len;
+};
+
+static struct {
+    char map_file[PATH_MAX];
+    int temporary;
+} kallsyms_map;
+
+static int kimg_read(struct kallsyms *ks, ulong vaddr, void *buf, size_t len)
+{
+    return readmem(vaddr - __START_KERNEL_map + ks->phys_base, PHYSADDR,
+            buf, len);
+}
+
+static int kallsyms_read_region(struct kallsyms *ks, ulong vaddr, size_t len)
+{
+    xfree(ks->buf);
+    ks->buf = xmalloc(len);
+    ks->vaddr = vaddr;
+    ks->len = len;
+    return kimg_read(ks, vaddr, ks->buf, len);
+}
+
+static inline uint64_t get_elem(const char *p, int size)
+{
+    uint32_t v32;
+    uint64_t v64;
+
+    if (size == 4) {
+        memcpy(&v32, p, 4);
+        return v32;
+    }
+    memcpy(&v64, p, 8);
+    return v64;
+}
+
+/*
+ * Split the token table at off into its tokens.  Returns the offset just
+ * past the last one, -1 when it is not a token table.
+ */
+static long kallsyms_tokens(struct kallsyms *ks, size_t off)
+{
+    const char *p, *nul;
+    size_t left;
+    int i;
+
+    for (p = ks->buf + off, i = 0; i < 256; i++) {
+        left = ks->buf + ks->len - p;
+        if (!(nul = memchr(p, '\0', left)) || nul == p ||
+                nul - p > 255 || p - (ks->buf + off) > 0xffff)
+            return -1;
+        ks->token_off[i] = p - (ks->buf + off);
+        ks->token_len[i] = nul - p;
+        p = nul + 1;
+    }
+    ks->token_table = off;
+    return p - ks->buf;
+}
+
+static int kallsyms_index_matches(struct kallsyms *ks, size_t index)
+{
+    uint16_t idx[256];
+
+    if (index + sizeof(idx) > ks->len)
+        return FALSE;
+    memcpy(idx, ks->buf + index, sizeof(idx));
+    return !memcmp(idx, ks->token_off, sizeof(idx));
+}
+
+/* next kallsyms_names entry; lengths over 127 take a second byte (6.1+) */
+static inline const unsigned char *name_next(const unsigned char *p,
+        const unsigned char *end)
+{
+    size_t len;
+
+    if (p >= end)
+        return NULL;
+    len = *p++;
+    if (len & 0x80) {
+        if (p >= end)
+            return NULL;
+        len = (len & 0x7f) | (*p++ << 7);
+    }
+    if (!len || len > (size_t)(end - p))
+        return NULL;
+    return p + len;
+}
+
+static inline uint64_t kallsyms_address(struct kallsyms *ks, uint32_t i)
+{
+    int32_t off;
+
+    if (!ks->relative_base)
+        return get_elem(ks->buf + ks->offsets + 8 * i, 8);
+
+    memcpy(&off, ks->buf + ks->offsets + 4 * i, 4);
+    if (!ks->absolute_percpu)
+        return ks->relative_base + (uint32_t)off;
+    /* CONFIG_KALLSYMS_ABSOLUTE_PERCPU: per-cpu symbols are absolute */
+    return off >= 0 ? (uint64_t)off : ks->relative_base - 1 - off;
+}
+
+/*
+ * scripts/kallsyms sorts the table by address, so only the right reading
+ * of kallsyms_offsets gives a sorted sequence ending in the kernel image.
+ */
+static int kallsyms_check_addresses(struct kallsyms *ks)
+{
+    size_t size = ks->relative_base ? 4 : 8;
+    uint64_t addr, prev;
+    int32_t off;
+    uint32_t i;
+    int mode, negative = FALSE;
+
+    if (ks->offsets + size * ks->num_syms > ks->len)
+        return -1;
+
+    if (ks->relative_base) {
+        for (i = 0; i < ks->num_syms && !negative; i++) {
+            memcpy(&off, ks->buf + ks->offsets + 4 * i, 4);
+            negative = off < 0;
+        }
+    }
+
+    for (mode = 0; mode < (ks->relative_base ? 2 : 1); mode++) {
+        ks->absolute_percpu = mode ? !negative : negative;
+        for (prev = 0, i = 0; i < ks->num_syms; i++) {
+            addr = kallsyms_address(ks, i);
+            if (addr < prev)
+                break;
+            prev = addr;
+        }
+        if (i == ks->num_syms && prev >= __START_KERNEL_map)
+            return 0;
+    }
+    return -1;
+}
+
+static int kallsyms_try_offsets(struct kallsyms *ks, size_t offsets,
+        size_t base)
+{
+    if (base + 8 > ks->len)
+        return -1;
+    ks->relative_base = get_elem(ks->buf + base, 8);
+    if (ks->relative_base < __START_KERNEL_map)
+        return -1;
+    ks->offsets = offsets;
+    return kallsyms_check_addresses(ks);
+}
+
+/*
+ * kallsyms_offsets and kallsyms_relative_base sit before kallsyms_num_syms
+ * (at numsyms) up to 6.3 and after the token index (at index_end) since;
+ * kernels without CONFIG_KALLSYMS_BASE_RELATIVE have kallsyms_addresses.
+ */
+static int kallsyms_find_addresses(struct kallsyms *ks, size_t numsyms,
+        size_t index_end)
+{
+    size_t n4 = 4 * (size_t)ks->num_syms, n8 = 8 * (size_t)ks->num_syms;
+    size_t off;
+
+    if (numsyms >= 8 + n4) {
+        off = numsyms - 8 - n4;
+        if (!kallsyms_try_offsets(ks, off, numsyms - 8) ||
+                !kallsyms_try_offsets(ks, off & ~7UL, numsyms - 8))
+            return 0;
+    }
+
+    off = roundup(index_end, 4);
+    if (!kallsyms_try_offsets(ks, off, roundup(off + n4, 8)) ||
+            !kallsyms_try_offsets(ks, off, off + n4))
+        return 0;
+    off = roundup(index_end, 8);
+    if (!kallsyms_try_offsets(ks, off, roundup(off + n4, 8)))
+        return 0;
+
+    ks->relative_base = 0;
+    if (numsyms >= n8) {
+        ks->offsets = (numsyms - n8) & ~7UL;
+        if (!kallsyms_check_addresses(ks))
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * kallsyms_names ends right before k markers of size es at m.  Find its
+ * start from kallsyms_num_syms, which precedes it, and check it against
+ * the first and the last marker.
+ */
+static int kallsyms_find_names_at(struct kallsyms *ks, size_t m, int es,
+        uint32_t k, size_t index_end)
+{
+    const unsigned char *base = (const unsigned char *)ks->buf;
+    const unsigned char *p, *end = base + m;
+    uint64_t first = get_elem(ks->buf + m + es, es);
+    uint64_t last = get_elem(ks->buf + m + (k - 1) * es, es);
+    size_t n, lo, pad;
+    uint32_t nr, i;
+
+    if (last >= m)
+        return -1;
+    lo = m - last > 256 * KALLSYMS_ENTRY_MAX ?
+        m - last - 256 * KALLSYMS_ENTRY_MAX : 8;
+
+    for (n = m - last; n >= lo; n--) {
+        for (pad = 4; pad <= 8; pad += 4) {
+            nr = get_elem(ks->buf + n - pad, 4);
+            if (nr <= 256 * (k - 1) || nr > 256 * k)
+                continue;
+
+            for (p = base + n + last, i = 256 * (k - 1); i < nr && p; i++)
+                p = name_next(p, end);
+            if (!p || end - p >= 8)
+                continue;
+
+            for (p = base + n, i = 0; i < 256 && p; i++)
+                p = name_next(p, end);
+            if (!p || (size_t)(p - base) != n + first)
+                continue;
+
+            ks->num_syms = nr;
+            ks->names = n;
+            ks->names_end = m;
+            if (!kallsyms_find_addresses(ks, n - pad, index_end))
+                return 0;
+        }
+    }
+    return -1;
+}
+
+static int kallsyms_find_names(struct kallsyms *ks, size_t index_end)
+{
+    size_t t = ks->token_table, m, lo;
+    uint64_t v, prev;
+    uint32_t k;
+    int es;
+
+    lo = t > KALLSYMS_MARKERS_WINDOW ? t - KALLSYMS_MARKERS_WINDOW : 16;
+
+    for (m = t & ~3UL; m >= lo; m -= 4) {
+        for (es = 4; es <= 8; es += 4) {
+            if ((m % es) || m + 2 * es > t || get_elem(ks->buf + m, es))
+                continue;
+
+            /* markers grow by at least one byte of length and code each */
+            for (k = 1, prev = 0; m + (k + 1) * es <= t; k++) {
+                v = get_elem(ks->buf + m + k * es, es);
+                if (v < prev + 512 || v > prev + 256 * KALLSYMS_ENTRY_MAX)
+                    break;
+                prev = v;
+            }
+            if (k < 2)
+                continue;
+
+            /* the token table may follow closely enough to look like one */
+            if (!kallsyms_find_names_at(ks, m, es, k, index_end) ||
+                    (k > 2 &&
+                     !kallsyms_find_names_at(ks, m, es, k - 1, index_end)))
+                return 0;
+        }
+    }
+    return -1;
+}
+
+/* a run of digit tokens at hit: is it the token table? */
+static int kallsyms_try(struct kallsyms *ks, ulong hit, ulong start)
+{
+    ulong lo = hit - start > KALLSYMS_BEFORE ? hit - KALLSYMS_BEFORE : start;
+
+    /* keep offsets in the region aligned like the addresses */
+    lo &= ~(PAGE_SIZE - 1);
+    size_t p, index;
+    long end;
+    int i;
+
+    if (kallsyms_read_region(ks, lo, hit - lo + KALLSYMS_AFTER))
+        return -1;
+
+    /* back from token '0' to token 0 */
+    for (p = hit - lo + 1, i = 0; i < '0'; i++) {
+        if (p < 2 || !ks->buf[p - 2])
+            return -1;
+        for (p--; p > 0 && ks->buf[p - 1]; p--)
+            ;
+    }
+
+    if ((end = kallsyms_tokens(ks, p)) < 0)
+        return -1;
+    for (index = end; index < (size_t)end + 8; index++) {
+        if (kallsyms_index_matches(ks, index))
+            break;
+    }
+    if (index == (size_t)end + 8)
+        return -1;
+
+    return kallsyms_find_names(ks, index + 512);
+}
+
+static int kallsyms_search(struct kallsyms *ks)
+{
+    ulong start = __START_KERNEL_map + KALLSYMS_TEXT_OFFSET + ks->kaslr;
+    size_t len = KALLSYMS_CHUNK + sizeof(digit_tokens) - 1;
+    char *chunk, *p, *hit;
+    ulong off;
+    int ret = -1;
+
+    chunk = xmalloc(len);
+    for (off = 0; off < KALLSYMS_SEARCH_SIZE && ret; off += KALLSYMS_CHUNK) {
+        if (kimg_read(ks, start + off, chunk, len))
+            break;
+        for (p = chunk; (hit = memmem(p, chunk + len - p, digit_tokens,
+                        sizeof(digit_tokens))); p = hit + 1) {
+            if (hit - chunk >= (long)KALLSYMS_CHUNK)
+                break;
+            if (!kallsyms_try(ks, start + off + (hit - chunk), start)) {
+                ret = 0;
+                break;
+            }
+        }
+    }
+    xfree(chunk);
+
+    if (!ret)
+        ks->source = "search";
+    return ret;
+}
+
+static int kallsyms_from_vmcoreinfo(struct kallsyms *ks)
+{
+    long names, num_syms, token_table, token_index;
+    long offsets = 0, base = 0, addresses = 0;
+    ulong lo, hi;
+    uint32_t nr;
+
+    if (vmcoreinfo_number("SYMBOL(kallsyms_names)", &names) ||
+            vmcoreinfo_number("SYMBOL(kallsyms_num_syms)", &num_syms) ||
+            vmcoreinfo_number("SYMBOL(kallsyms_token_table)", &token_table) ||
+            vmcoreinfo_number("SYMBOL(kallsyms_token_index)", &token_index))
+        return -1;
+    if (vmcoreinfo_number("SYMBOL(kallsyms_offsets)", &offsets) ||
+            vmcoreinfo_number("SYMBOL(kallsyms_relative_base)", &base)) {
+        offsets = base = 0;
+        if (vmcoreinfo_number("SYMBOL(kallsyms_addresses)", &addresses))
+            return -1;
+    }
+
+    if (kimg_read(ks, num_syms, &nr, sizeof(nr)) || !nr ||
+            nr > KALLSYMS_MAX_SYMS || names >= token_table)
+        return -1;
+
+    lo = MIN(MIN(names, num_syms), offsets ? MIN(offsets, base) : addresses);
+    hi = MAX(token_index + 512, offsets ?
+            MAX(offsets + 4 * nr, base + 8) : addresses + 8 * nr);
+    lo &= ~(PAGE_SIZE - 1);
+    if (hi - lo > KALLSYMS_BEFORE + KALLSYMS_AFTER ||
+            kallsyms_read_region(ks, lo, hi - lo))
+        return -1;
+
+    ks->num_syms = nr;
+    ks->names = names - lo;
+    ks->names_end = token_table - lo;
+    if (kallsyms_tokens(ks, token_table - lo) < 0 ||
+            !kallsyms_index_matches(ks, token_index - lo))
+        return -1;
+
+    if (offsets) {
+        if (kallsyms_try_offsets(ks, offsets - lo, base - lo))
+            return -1;
+    } else {
+        ks->offsets = addresses - lo;
+        if (kallsyms_check_addresses(ks))
+            return -1;
+    }
+
+    ks->source = "VMCOREINFO";
+    return 0;
+}
+
+static char *put_hex16(char *p, uint64_t v)
+{
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for (i = 15; i >= 0; i--, v >>= 4)
+        p[i] = hex[v & 0xf];
+    return p + 16;
+}
+
+/* expand every name and format the map in memory */
+static int kallsyms_decode(struct kallsyms *ks)
+{
+    const unsigned char *p = (const unsigned char *)ks->buf + ks->names;
+    const unsigned char *end = (const unsigned char *)ks->buf + ks->names_end;
+    const unsigned char *next;
+    const char *tokens = ks->buf + ks->token_table;
+    size_t room = (size_t)ks->num_syms * 48, used = 0;
+    char name[KSYM_NAME_LEN + 256];
+    uint64_t addr;
+    size_t n;
+    uint32_t i;
+    char *out;
+
+    ks->map = xmalloc(room);
+
+    for (i = 0; i < ks->num_syms; i++) {
+        if (!(next = name_next(p, end)))
+            return -1;
+        p += (*p & 0x80) ? 2 : 1;
+
+        for (n = 0; p < next && n < KSYM_NAME_LEN; p++) {
+            memcpy(name + n, tokens + ks->token_off[*p], ks->token_len[*p]);
+            n += ks->token_len[*p];
+        }
+        p = next;
+        if (n < 2)
+            return -1;
+        n = MIN(n, KSYM_NAME_LEN);
+
+        addr = kallsyms_address(ks, i);
+        if (addr >= __START_KERNEL_map)
+            addr -= ks->kaslr;
+
+        /* "ffffffff81000000 T _text\n" */
+        if (used + n + 20 > room) {
+            room *= 2;
+            ks->map = xrealloc(ks->map, room);
+        }
+        out = put_hex16(ks->map + used, addr);
+        *out++ = ' ';
+        *out++ = name[0];
+        *out++ = ' ';
+        memcpy(out, name + 1, n - 1);
+        out += n - 1;
+        *out++ = '\n';
+        used = out - ks->map;
+    }
+
+    ks->map_len = used;
+    return 0;
+}
+
+static void kallsyms_free(struct kallsyms *ks)
+{
+    xfree(ks->buf);
+    xfree(ks->map);
+    ks->buf = NULL;
+    ks->map = NULL;
+}
+
+/* maps are keyed by the build ID, or by the release on older kernels */
+static void kallsyms_cache_path(char *path, size_t len)
+{
+    const char *key;
+    char name[80];
+    size_t i;
+
+    if (!(key = vmcoreinfo_lookup("BUILD-ID")) || !*key)
+        key = vmcoreinfo_lookup("OSRELEASE");
+
+    for (i = 0; key[i] && i < sizeof(name) - 1; i++)
+        name[i] = isalnum((unsigned char)key[i]) ||
+            strchr(".-_+", key[i]) ? key[i] : '_';
+    name[i] = '\0';
+
+    snprintf(path, len, BOOTCACHE_DIR "/kallsyms-%s.map", name);
+}
+
+static int map_lookup(const struct sysmap *m, const char *symbol,
+        ulong *value)
+{
+    size_t len = strlen(symbol);
+    struct sysmap_line l;
+    const char *p;
+
+    for (p = m->base; (p = sysmap_next(m, p, &l)); ) {
+        if (l.name_len == len && !memcmp(l.name, symbol, len)) {
+            *value = l.addr;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * A stale note from an earlier boot can lead to the right tables through
+ * a wrong KASLR offset; its SYMBOL() entries then disagree with them.
+ */
+static int map_fits_note(const struct sysmap *m, ulong kaslr,
+        ulong phys_base, const char *release)
+{
+    static char *const checked[] = {
+        "init_top_pgt", "swapper_pg_dir", "_stext", "prb", "log_buf",
+    };
+    char key[64];
+    ulong banner, addr;
+    long value;
+    size_t i;
+
+    if (map_lookup(m, "linux_banner", &banner))
+        return FALSE;
+
+    for (i = 0; i < sizeof(checked) / sizeof(checked[0]); i++) {
+        snprintf(key, sizeof(key), "SYMBOL(%s)", checked[i]);
+        if (!vmcoreinfo_number(key, &value) &&
+                !map_lookup(m, checked[i], &addr) &&
+                addr + kaslr != (ulong)value)
+            return FALSE;
+    }
+
+    return vmcoreinfo_banner_matches(banner, kaslr, phys_base, release);
+}
+
+static int kallsyms_write_map(struct kallsyms *ks, const char *path)
+{
+    char tmp[PATH_MAX + 16];
+    int fd;
+
+    if (pc->flags & NO_CACHE) {
+        /* only startup needs it, see kallsyms_release() */
+        xstrlcpy(tmp, "/tmp/kvm-dmesg-kallsyms-XXXXXX", sizeof(tmp));
+        if ((fd = mkstemp(tmp)) == -1)
+            return -1;
+        path = tmp;
+        kallsyms_map.temporary = TRUE;
+    } else {
+        if (mkdir(BOOTCACHE_DIR, 0700) && errno != EEXIST)
+            return -1;
+        snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+        if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+            return -1;
+    }
+
+    if (xwrite(fd, ks->map, ks->map_len) != ks->map_len) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    if (!(pc->flags & NO_CACHE) && rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+
+    xstrlcpy(kallsyms_map.map_file, path, sizeof(kallsyms_map.map_file));
+    return 0;
+}
+
+/*
+ * vmcoreinfo_scan() callback: the note is the live one when the kallsyms
+ * it leads to agree with it and put linux_banner where the guest has its
+ * banner.
+ */
+static int kallsyms_validate(ulong kaslr, ulong phys_base,
+        const char *release)
+{
+    struct timespec t0, t1;
+    char path[PATH_MAX];
+    struct kallsyms ks;
+    struct sysmap m;
+    ulong banner;
+    int fits, ret = -1;
+
+    kallsyms_cache_path(path, sizeof(path));
+
+    if (!(pc->flags & NO_CACHE) && !access(path, R_OK) &&
+            !sysmap_open(path, &m)) {
+        fits = map_fits_note(&m, kaslr, phys_base, release);
+        sysmap_close(&m);
+        if (fits) {
+            xstrlcpy(kallsyms_map.map_file, path,
+                    sizeof(kallsyms_map.map_file));
+            if (KDEBUG(1))
+                pr_debug("kallsyms: using %s", path);
+            return 0;
+        }
+        if (KDEBUG(1))
+            pr_debug("kallsyms: dropping stale %s", path);
+        unlink(path);
+    }
+
+    memset(&ks, 0, sizeof(ks));
+    ks.kaslr = kaslr;
+    ks.phys_base = phys_base;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (kallsyms_from_vmcoreinfo(&ks) && kallsyms_search(&ks))
+        goto out;
+    if (kallsyms_decode(&ks))
+        goto out;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (KDEBUG(1))
+        pr_debug("kallsyms: %u symbols from %s at %lx, decoded in %.3fms",
+                ks.num_syms, ks.source, ks.vaddr + ks.token_table,
+                (t1.tv_sec - t0.tv_sec) * 1e3 +
+                (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+    memset(&m, 0, sizeof(m));
+    m.base = ks.map;
+    m.len = ks.map_len;
+    if (map_lookup(&m, "linux_banner", &banner)) {
+        pr_err("kallsyms has no linux_banner, is CONFIG_KALLSYMS_ALL off?");
+        goto out;
+    }
+    if (!map_fits_note(&m, kaslr, phys_base, release))
+        goto out;
+
+    if (kallsyms_write_map(&ks, path)) {
+        pr_err("Cannot write %s: %s", path, strerror(errno));
+        goto out;
+    }
+    ret = 0;
+out:
+    kallsyms_free(&ks);
+    return ret;
+}
+
+int kallsyms_select(char *map_file, size_t len)
+{
+    if (vmcoreinfo_scan(kallsyms_validate)) {
+        pr_err("No kernel symbol table found in guest memory");
+        return -1;
+    }
+
+    xstrlcpy(map_file, kallsyms_map.map_file, len);
+    return 0;
+}
+
+void kallsyms_release(void)
+{
+    if (kallsyms_map.temporary)
+        unlink(kallsyms_map.map_file);
+    kallsyms_map.temporary = FALSE;
+}
@@ -0,0 +1,24 @@
+/* kallsyms.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __KALLSYMS_H__
+#define __KALLSYMS_H__
+
+#include <stddef.h>
+
+int kallsyms_select(char *map_file, size_t len);
+void kallsyms_release(void);
+
+#endif
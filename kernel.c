@@ -1,10 +1,19 @@
 #include "defs.h"
+#include "xutil.h"
+#include "vmcoreinfo.h"
 
 void kernel_init() {
+  const char *release;
+  char buf[65];
+
   // We cannot use VMCOREINFO_OFFSET to get 'name'
   // from struct uts_namespace. Fortunately, 'release' has already
   // been recorded in VMCOREINFO_OSRELEASE, so let's simply search
   // it from vmcoreinfo_data.
 
-  parse_kernel_version(vmcoreinfo_read_string("OSRELEASE"));
+  if (!(release = vmcoreinfo_lookup("OSRELEASE")))
+    return;
+  // parse_kernel_version() writes to the string
+  xstrlcpy(buf, release, sizeof(buf));
+  parse_kernel_version(buf);
 }
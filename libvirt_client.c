@@ -42,18 +42,53 @@ typedef enum {
 typedef void* virDomainPtr;
 typedef void* virConnectPtr;
 
+/* the subset of libvirt-domain.h the event watch needs */
+enum {
+    VIR_DOMAIN_EVENT_ID_LIFECYCLE = 0,
+    VIR_DOMAIN_EVENT_ID_REBOOT    = 1,
+};
+
+enum {
+    VIR_DOMAIN_EVENT_SUSPENDED    = 3,
+    VIR_DOMAIN_EVENT_STOPPED      = 5,
+    VIR_DOMAIN_EVENT_SHUTDOWN     = 6,
+    VIR_DOMAIN_EVENT_CRASHED      = 8,
+};
+
+typedef void (*virConnectDomainEventGenericCallback)(virConnectPtr conn,
+        virDomainPtr dom, void *opaque);
+typedef void (*virConnectCloseFunc)(virConnectPtr conn, int reason,
+        void *opaque);
+typedef void (*virEventTimeoutCallback)(int timer, void *opaque);
+typedef void (*virFreeCallback)(void *opaque);
+
+#define VIR_DOMAIN_EVENT_CALLBACK(cb) \
+    ((virConnectDomainEventGenericCallback)(void (*)(void))(cb))
+
 virConnectPtr (*virConnectOpen)(const char *name);
 int (*virConnectClose)(virConnectPtr conn);
 virDomainPtr (*virDomainLookupByName)(virConnectPtr conn, const char *name);
 int (*virDomainFree)(virDomainPtr domain);
 int (*virDomainQemuMonitorCommand)(virDomainPtr domain, const char *cmd, char **result, unsigned int flags);
+int (*virEventRegisterDefaultImpl)(void);
+int (*virEventRunDefaultImpl)(void);
+int (*virEventAddTimeout)(int timeout, virEventTimeoutCallback cb, void *opaque, virFreeCallback ff);
+int (*virEventRemoveTimeout)(int timer);
+int (*virConnectDomainEventRegisterAny)(virConnectPtr conn, virDomainPtr dom, int eventID, virConnectDomainEventGenericCallback cb, void *opaque, virFreeCallback freecb);
+int (*virConnectDomainEventDeregisterAny)(virConnectPtr conn, int callbackID);
+int (*virConnectRegisterCloseCallback)(virConnectPtr conn, virConnectCloseFunc cb, void *opaque, virFreeCallback freecb);
 
 void *libvirt_handle = NULL;
 void *libvirt_qemu_handle = NULL;
 virDomainPtr domain = NULL;
 virConnectPtr domain_conn = NULL;
 
-FILE *mem_file = NULL;
+/* --events: lifecycle callbacks, and what they saw */
+static int lifecycle_cb = -1;
+static int reboot_cb = -1;
+static const char *libvirt_event;
+static int libvirt_event_timer = -1;
+static int libvirt_gone;
 
 #define CHECK_FUNC(f) if (!f) { pr_err("Error loading function: %s\n", dlerror()); return -1; }
 
@@ -93,6 +128,131 @@ static int libvirt_dlsym()
     return 0;
 }
 
+static int libvirt_dlsym_events()
+{
+    virEventRegisterDefaultImpl = dlsym(libvirt_handle, "virEventRegisterDefaultImpl");
+    virEventRunDefaultImpl = dlsym(libvirt_handle, "virEventRunDefaultImpl");
+    virEventAddTimeout = dlsym(libvirt_handle, "virEventAddTimeout");
+    virEventRemoveTimeout = dlsym(libvirt_handle, "virEventRemoveTimeout");
+    virConnectDomainEventRegisterAny = dlsym(libvirt_handle, "virConnectDomainEventRegisterAny");
+    virConnectDomainEventDeregisterAny = dlsym(libvirt_handle, "virConnectDomainEventDeregisterAny");
+    virConnectRegisterCloseCallback = dlsym(libvirt_handle, "virConnectRegisterCloseCallback");
+
+    CHECK_FUNC(virEventRegisterDefaultImpl);
+    CHECK_FUNC(virEventRunDefaultImpl);
+    CHECK_FUNC(virEventAddTimeout);
+    CHECK_FUNC(virEventRemoveTimeout);
+    CHECK_FUNC(virConnectDomainEventRegisterAny);
+    CHECK_FUNC(virConnectDomainEventDeregisterAny);
+    CHECK_FUNC(virConnectRegisterCloseCallback);
+
+    return 0;
+}
+
+/*
+ * Lifecycle events are named after the QMP events they come from, so
+ * that the watch does not need to know which backend it talks to.
+ */
+static void libvirt_lifecycle_event(virConnectPtr conn, virDomainPtr dom,
+        int event, int detail, void *opaque)
+{
+    (void)conn; (void)dom; (void)detail; (void)opaque;
+
+    switch (event) {
+        case VIR_DOMAIN_EVENT_CRASHED:
+            libvirt_event = "GUEST_PANICKED";
+            break;
+        case VIR_DOMAIN_EVENT_SUSPENDED:
+            libvirt_event = "STOP";
+            break;
+        case VIR_DOMAIN_EVENT_SHUTDOWN:
+            libvirt_event = "SHUTDOWN";
+            break;
+        case VIR_DOMAIN_EVENT_STOPPED:
+            /* qemu is gone, and the guest memory with it */
+            libvirt_gone = TRUE;
+            break;
+    }
+
+    if (KDEBUG(1))
+        pr_debug("libvirt lifecycle event %d/%d", event, detail);
+}
+
+static void libvirt_reboot_event(virConnectPtr conn, virDomainPtr dom,
+        void *opaque)
+{
+    (void)conn; (void)dom; (void)opaque;
+
+    libvirt_event = "RESET";
+}
+
+static void libvirt_close_event(virConnectPtr conn, int reason, void *opaque)
+{
+    (void)conn; (void)opaque;
+
+    pr_warning("libvirt connection closed (reason %d)", reason);
+    libvirt_gone = TRUE;
+}
+
+static void libvirt_timeout_event(int timer, void *opaque)
+{
+    (void)timer; (void)opaque;
+
+    virEventRemoveTimeout(libvirt_event_timer);
+    libvirt_event_timer = -1;
+}
+
+static int libvirt_events_register()
+{
+    lifecycle_cb = virConnectDomainEventRegisterAny(domain_conn, domain,
+            VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+            VIR_DOMAIN_EVENT_CALLBACK(libvirt_lifecycle_event),
+            NULL, NULL);
+    reboot_cb = virConnectDomainEventRegisterAny(domain_conn, domain,
+            VIR_DOMAIN_EVENT_ID_REBOOT, libvirt_reboot_event, NULL, NULL);
+
+    if (lifecycle_cb < 0 || reboot_cb < 0) {
+        pr_err("Failed to register for domain lifecycle events");
+        return -1;
+    }
+
+    virConnectRegisterCloseCallback(domain_conn, libvirt_close_event,
+            NULL, NULL);
+    return 0;
+}
+
+/*
+ * Run the libvirt event loop for up to timeout_ms (forever if negative).
+ * Returns 1 with the event name, 0 on timeout, -1 once the domain is gone.
+ */
+int libvirt_wait_event(int timeout_ms, char *event, size_t len)
+{
+    if (!libvirt_event && timeout_ms >= 0)
+        libvirt_event_timer = virEventAddTimeout(timeout_ms,
+                libvirt_timeout_event, NULL, NULL);
+
+    while (!libvirt_event && !libvirt_gone) {
+        if (timeout_ms >= 0 && libvirt_event_timer < 0)
+            return 0;
+        if (virEventRunDefaultImpl() < 0) {
+            pr_err("Failed to run the libvirt event loop");
+            libvirt_gone = TRUE;
+        }
+    }
+
+    if (libvirt_event_timer >= 0) {
+        virEventRemoveTimeout(libvirt_event_timer);
+        libvirt_event_timer = -1;
+    }
+
+    if (!libvirt_event)
+        return -1;
+
+    xstrlcpy(event, libvirt_event, len);
+    libvirt_event = NULL;
+    return 1;
+}
+
 pid_t libvirt_get_pid(char *guest_name)
 {
     char pid_file[128];
@@ -125,6 +285,11 @@ int libvirt_client_init(char *guest_name)
         return -1;
     }
 
+    /* the event loop has to exist before the connection is opened */
+    if (pc->flags & WATCH_EVENTS) {
+        if (libvirt_dlsym_events() || virEventRegisterDefaultImpl() < 0)
+            return -1;
+    }
 
     if (!domain_conn)
         domain_conn = virConnectOpen("qemu:///system");
@@ -144,11 +309,25 @@ int libvirt_client_init(char *guest_name)
         return -1;
     }
 
+    if ((pc->flags & WATCH_EVENTS) && lifecycle_cb < 0 &&
+            libvirt_events_register())
+        return -1;
+
     return 0;
 }
 
 int libvirt_client_uninit()
 {
+    if (lifecycle_cb >= 0) {
+        virConnectDomainEventDeregisterAny(domain_conn, lifecycle_cb);
+        lifecycle_cb = -1;
+    }
+
+    if (reboot_cb >= 0) {
+        virConnectDomainEventDeregisterAny(domain_conn, reboot_cb);
+        reboot_cb = -1;
+    }
+
     if (domain) {
         virDomainFree(domain);
         domain = NULL;
@@ -298,55 +477,3 @@ int libvirt_gpa2hva(uint64_t gpa, uint64_t *hva)
 
     return 0;
 }
-
-int file_client_init(char *path)
-{
-    if (mem_file)
-        return 0;
-
-    mem_file = fopen(path, "rb");
-    if (!mem_file) {
-        pr_err("fopen error");
-        return -1;
-    }
-    return 0;
-}
-
-int file_client_uninit( )
-{
-    if (mem_file) {
-        fclose(mem_file);
-    }
-    mem_file = NULL;
-    return 0;
-}
-
-int file_readmem(uint64_t addr, void *buffer, size_t size)
-{
-    if (fseek(mem_file, addr, SEEK_SET) != 0) {
-        pr_err("fseek error");
-        return -1;
-    }
-
-    size_t bytesRead = fread(buffer, 1, size, mem_file);
-
-    if (bytesRead != size) {
-        if (feof(mem_file)) {
-            printf("eof to read: %zu\n", bytesRead);
-            return bytesRead;
-        } else {
-            pr_err("read bytes error");
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-int file_get_registers(uint64_t *idtr, uint64_t *cr3, uint64_t *cr4)
-{
-    *cr3 = 0x0000000019872000;
-    *idtr = 0xffffffffff528000;
-    *cr4 = 0;
-    return 0;
-}
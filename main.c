@@ -33,75 +33,85 @@
 #include "client.h"
 #include "version.h"
 #include "printk.h"
+#include "startup.h"
+#include "bootcache.h"
+#include "symindex.h"
+#include "vmlinux.h"
+#include "tlb.h"
+#include "capture.h"
+#include "watch.h"
+#include "merge.h"
+#include "oops.h"
+#include "stats.h"
 
 struct machine_specific x86_64_machine_specific = { 0 };
 
-static ulong * x86_64_kpgd_offset(ulong kvaddr)
+/*
+ * Read entry idx of the page-table page at table_paddr.  Returns -1 when
+ * the page cannot be read or the entry is not present.
+ */
+static int x86_64_pt_entry(ulong table_paddr, ulong idx, ulong *entry)
 {
-    ulong *pgd;
-    pgd = ((ulong *)machdep->pgd) + pgd_index(kvaddr);
-    return pgd;
-}
+    char *table;
 
-ulong x86_64_pud_offset(ulong pgd_pte, ulong vaddr)
-{
-    ulong *pud;
-    ulong pud_paddr;
-    ulong pud_pte;
-
-    pud_paddr = pgd_pte & PHYSICAL_PAGE_MASK;
-
-    FILL_PUD(pud_paddr, PAGESIZE());
-    pud = ((ulong *)pud_paddr) + pud_index(vaddr);
-    pud_pte = ULONG(machdep->pud + PAGEOFFSET(pud));
+    if (!(table = ptcache_read(table_paddr & PHYSICAL_PAGE_MASK)))
+        return -1;
 
-    return pud_pte;
+    *entry = ULONG(table + idx * sizeof(ulong));
+    return (*entry & _PAGE_PRESENT) ? 0 : -1;
 }
 
-ulong x86_64_pmd_offset(ulong pud_pte, ulong vaddr)
+/*
+ * Translate kvaddr through the kernel page tables.  *len is set to the
+ * number of bytes from kvaddr to the end of the page, 4K or a 2M/1G leaf,
+ * that maps it, which are physically contiguous.
+ */
+int x86_64_kvtop_range(ulong kvaddr, physaddr_t *paddr, ulong *len)
 {
-    ulong *pmd;
-    ulong pmd_paddr;
+    ulong pgd_pte;
+    ulong pud_pte;
     ulong pmd_pte;
+    ulong pte;
+    ulong mask;
 
-    pmd_paddr = pud_pte & PHYSICAL_PAGE_MASK;
-
-    FILL_PMD(pmd_paddr, PAGESIZE());
+    if (!tlb_lookup(kvaddr, paddr)) {
+        *len = PAGE_SIZE - PAGEOFFSET(kvaddr);
+        return 0;
+    }
 
-    pmd = ((ulong *)pmd_paddr) + pmd_index(vaddr);
-    pmd_pte = ULONG(machdep->pmd + PAGEOFFSET(pmd));
-    return pmd_pte;
-}
+    if (x86_64_pt_entry(vt->kernel_pgd[0], pgd_index(kvaddr), &pgd_pte) ||
+            x86_64_pt_entry(pgd_pte, pud_index(kvaddr), &pud_pte))
+        return -1;
 
-ulong x86_64_pte_offset(ulong pmd_pte, ulong vaddr)
-{
-    ulong *ptep;
-    ulong pte_paddr;
-    ulong pte;
+    if (pud_pte & _PAGE_PSE) {
+        mask = (1UL << PUD_SHIFT) - 1;
+        pte = pud_pte;
+    } else {
+        if (x86_64_pt_entry(pud_pte, pmd_index(kvaddr), &pmd_pte))
+            return -1;
 
-    pte_paddr = pmd_pte & PHYSICAL_PAGE_MASK;
+        if (pmd_pte & _PAGE_PSE) {
+            mask = (1UL << PMD_SHIFT) - 1;
+            pte = pmd_pte;
+        } else {
+            if (x86_64_pt_entry(pmd_pte, pte_index(kvaddr), &pte))
+                return -1;
+            mask = PAGE_SIZE - 1;
+        }
+    }
 
-    FILL_PTBL(pte_paddr, PAGESIZE());
-    ptep = ((ulong *)pte_paddr) + pte_index(vaddr);
-    pte = ULONG(machdep->ptbl + PAGEOFFSET(ptep));
+    *paddr = (pte & PHYSICAL_PAGE_MASK & ~mask) + (kvaddr & mask);
+    *len = mask + 1 - (kvaddr & mask);
+    tlb_insert(kvaddr, *paddr);
 
-    return pte;
+    return 0;
 }
 
 int x86_64_kvtop(ulong kvaddr, physaddr_t *paddr)
 {
-    ulong *pgd;
-    ulong pud_pte;
-    ulong pmd_pte;
-    ulong pte;
-
-    pgd = x86_64_kpgd_offset(kvaddr);
-    pud_pte = x86_64_pud_offset(*pgd, kvaddr);
-    pmd_pte = x86_64_pmd_offset(pud_pte, kvaddr);
-    pte = x86_64_pte_offset(pmd_pte, kvaddr);
-    *paddr = (PAGEBASE(pte) & PHYSICAL_PAGE_MASK) + PAGEOFFSET(kvaddr);
+    ulong len;
 
-    return 0;
+    return x86_64_kvtop_range(kvaddr, paddr, &len);
 }
 
 ulong get_vec0_addr(ulong idtr)
@@ -140,25 +150,50 @@ void write_data_to_file(const char *filename, void *data, size_t size) {
 #define PTI_USER_PGTABLE_BIT    PAGE_SHIFT
 #define PTI_USER_PGTABLE_MASK   (1 << PTI_USER_PGTABLE_BIT)
 #define CR3_PCID_MASK           0xFFFull
-int calc_kaslr_offset(ulong *kaslr_offset, ulong *phys_base)
+/*
+ * Find the IDT through CR3 and read the handler of vector 0.  Neither step
+ * needs a System.map, so --map-dir can use it to pick one.  The result is
+ * kept in machspec for calc_kaslr_offset().
+ */
+int x86_64_idt_probe(ulong *vec0, ulong *idtr_paddr)
 {
-    uint64_t cr3 = 0, idtr = 0, pgd = 0, idtr_paddr;
-    ulong divide_error_vmcore;
+    struct machine_specific *ms = machdep->machspec;
+    uint64_t pgd, paddr;
 
-    get_cr3_idtr(&cr3, &idtr);
+    if (!ms->idt_vec0) {
+        if (!ms->idtr)
+            return -1;
 
-    pgd = cr3 & ~(CR3_PCID_MASK|PTI_USER_PGTABLE_MASK);
+        pgd = ms->cr3 & ~(CR3_PCID_MASK|PTI_USER_PGTABLE_MASK);
 
-    vt->kernel_pgd[0] = pgd;
-    machdep->last_pgd_read = vt->kernel_pgd[0];
-    machdep->machspec->physical_mask_shift = __PHYSICAL_MASK_SHIFT_2_6;
-    machdep->machspec->pgdir_shift = PGDIR_SHIFT;
-    machdep->machspec->ptrs_per_pgd = PTRS_PER_PGD;
+        if (vt->kernel_pgd[0] != pgd)
+            tlb_flush();
+        vt->kernel_pgd[0] = pgd;
+
+        if (x86_64_kvtop(ms->idtr, &paddr))
+            return -1;
+
+        ms->idtr_paddr = paddr;
+        ms->idt_vec0 = get_vec0_addr(paddr);
+    }
+
+    *vec0 = ms->idt_vec0;
+    *idtr_paddr = ms->idtr_paddr;
+    return 0;
+}
 
-    readmem(pgd, PHYSADDR, machdep->pgd, PAGESIZE());
-    x86_64_kvtop(idtr, &idtr_paddr);
+int calc_kaslr_offset(ulong *kaslr_offset, ulong *phys_base)
+{
+    ulong idtr, pgd, idtr_paddr;
+    ulong divide_error_vmcore;
+
+    idtr = machdep->machspec->idtr;
+    if (x86_64_idt_probe(&divide_error_vmcore, &idtr_paddr)) {
+        pr_err("Cannot read the IDT at %lx through the page tables", idtr);
+        return -1;
+    }
+    pgd = vt->kernel_pgd[0];
 
-    divide_error_vmcore = get_vec0_addr(idtr_paddr);
     *kaslr_offset = divide_error_vmcore - st->divide_error_vmlinux;
     *phys_base = idtr_paddr -
         (st->idt_table_vmlinux + *kaslr_offset - __START_KERNEL_map);
@@ -175,6 +210,21 @@ int calc_kaslr_offset(ulong *kaslr_offset, ulong *phys_base)
     return 0;
 }
 
+int x86_64_get_registers()
+{
+    uint64_t cr3 = 0, idtr = 0;
+
+    if (get_cr3_idtr(&cr3, &idtr)) {
+        pr_err("Failed to get CR3/IDTR");
+        return -1;
+    }
+
+    machdep->machspec->cr3 = cr3;
+    machdep->machspec->idtr = idtr;
+
+    return 0;
+}
+
 void x86_64_init()
 {
     machdep->machspec = &x86_64_machine_specific;
@@ -183,28 +233,55 @@ void x86_64_init()
     machdep->pageoffset = machdep->pagesize - 1;
     machdep->pagemask = ~((ulonglong)machdep->pageoffset);
 
-    machdep->pgd = malloc(PAGESIZE());
-    machdep->pud = malloc(PAGESIZE());
-    machdep->pmd = malloc(PAGESIZE());
-    machdep->ptbl = malloc(PAGESIZE());
-
     machdep->machspec->page_offset = PAGE_OFFSET_2_6_27;
+    machdep->machspec->physical_mask_shift = __PHYSICAL_MASK_SHIFT_2_6;
+    machdep->machspec->pgdir_shift = PGDIR_SHIFT;
+    machdep->machspec->ptrs_per_pgd = PTRS_PER_PGD;
+    machdep->machspec->kernel_end = __START_KERNEL_map + KERNEL_IMAGE_SIZE;
+    machdep->machspec->direct_map_end = PAGE_OFFSET_2_6_27 + DIRECT_MAP_SIZE;
 }
 
+/*
+ * Bound the linear maps by the guest's own layout.  Modules follow the
+ * image, at 512MB without KASLR, so the image ends at _end.  With
+ * CONFIG_RANDOMIZE_MEMORY vmalloc space sits a random gap above the end of
+ * RAM, well inside the fixed 64TB, so the direct map ends at vmalloc_base,
+ * or at the end of guest-physical memory when only the backend knows that.
+ */
 void x86_64_post_reloc()
 {
+    struct machine_specific *ms = machdep->machspec;
+    ulong vmalloc_start;
+
+    if (kernel_symbol_exists("_end"))
+        ms->kernel_end = relocate(symbol_value("_end"));
+
     if (kernel_symbol_exists("page_offset_base")) {
-        get_symbol_data("page_offset_base", sizeof(ulong),
-            &machdep->machspec->page_offset);
+        get_symbol_data("page_offset_base", sizeof(ulong), &ms->page_offset);
+        ms->direct_map_end = ms->page_offset + guest_client->mem_size;
+        if (kernel_symbol_exists("vmalloc_base") &&
+                !readmem(relocate(symbol_value("vmalloc_base")), KVADDR,
+                    &vmalloc_start, sizeof(ulong)) &&
+                vmalloc_start > ms->page_offset)
+            ms->direct_map_end = vmalloc_start;
     }
+
+    if (KDEBUG(1))
+        pr_debug("linear maps: image < %lx, direct map %lx - %lx",
+            ms->kernel_end, ms->page_offset, ms->direct_map_end);
 }
 
-void derive_kaslr_offset()
+int derive_kaslr_offset()
 {
     ulong kaslr_offset = 0;
     ulong phys_base = 0;
 
-    calc_kaslr_offset(&kaslr_offset, &phys_base);
+    if (calc_kaslr_offset(&kaslr_offset, &phys_base))
+        return -1;
+
+    if ((ulong)-kt->relocate != kaslr_offset ||
+            machdep->machspec->phys_base != phys_base)
+        tlb_flush();
 
     if (kaslr_offset) {
         kt->relocate = kaslr_offset * -1;
@@ -212,6 +289,7 @@ void derive_kaslr_offset()
     }
 
     machdep->machspec->phys_base = phys_base;
+    return 0;
 }
 
 int ascii(int c)
@@ -219,101 +297,72 @@ int ascii(int c)
     return ((c >= 0) && ( c <= 0x7f));
 }
 
-static char* log_from_idx(uint32_t idx, char *logbuf)
-{
-    char *logptr;
-    uint16_t msglen;
-
-    logptr = logbuf + idx;
-
-    msglen = USHORT(logptr + offsetof(struct log, len));
-    if (!msglen)
-        logptr = logbuf;
-
-    return logptr;
-}
-
-static uint32_t log_next(uint32_t idx, char *logbuf)
+/*
+ * Print the log with the decoder for the kernel's log buffer format.
+ */
+void dump_kernel_log(void)
 {
-    char *logptr;
-    uint16_t msglen;
-
-    logptr = logbuf + idx;
-
-    msglen = USHORT(logptr + offsetof(struct log, len));
-    if (!msglen) {
-        msglen = USHORT(logbuf + offsetof(struct log, len));
-        return msglen;
+    if (kernel_symbol_exists("prb")) {
+        dump_lockless_record_log();
+        return;
+    } else if (kernel_symbol_exists("log_first_idx") &&
+            kernel_symbol_exists("log_next_idx")) {
+        dump_variable_length_record_log();
+        return;
     }
 
-    return idx + msglen;
-}
-
-static void dump_log_entry(char *logptr)
-{
-    char *msg, *p;
-    uint16_t i, text_len;
-    uint64_t ts_nsec;
-    ulonglong nanos;
-    ulong rem;
-    char buf[64];
-
-    text_len = USHORT(logptr + offsetof(struct log, text_len));
-
-    ts_nsec = ULONGLONG(logptr);
-    msg = logptr + sizeof(struct log);
-
-    nanos = (ulonglong)ts_nsec / (ulonglong)1000000000;
-    rem = (ulonglong)ts_nsec % (ulonglong)1000000000;
-    sprintf(buf, "[%5lld.%06ld] ", nanos, rem/1000);
-    fprintf(fp, "%s", buf);
-
-    for (i = 0, p = msg; i < text_len; i++, p++) {
-        if (*p == '\n')
-            fprintf(fp, "\n");
-        else if (isprint(*p) || isspace(*p))
-            fputc(*p, fp);
-        else
-            fputc('.', fp);
+    if (pc->flags & STATS_ONLY) {
+        pr_err("--stats-only needs the record log of 3.5+ kernels");
+        return;
     }
 
-    fprintf(fp, "\n");
-}
-
-static void dump_variable_length_record_log(void)
-{
-    uint32_t idx, log_first_idx, log_next_idx, log_buf_len;
-    ulong log_buf;
-    char *logptr, *logbuf;
-
-    get_symbol_data("log_first_idx", sizeof(uint32_t), &log_first_idx);
-    get_symbol_data("log_next_idx", sizeof(uint32_t), &log_next_idx);
-    get_symbol_data("log_buf_len", sizeof(uint32_t), &log_buf_len);
+    ulong log_buf_len = 0;
+    ulong log_buf = 0;
     get_symbol_data("log_buf", sizeof(char *), &log_buf);
-
-    if (KDEBUG(1)) {
-        pr_debug("log_buf: %lx", (ulong)log_buf);
-        pr_debug("log_buf_len: %d", log_buf_len);
-        pr_debug("log_first_idx: %d", log_first_idx);
-        pr_debug("log_next_idx: %d", log_next_idx);
-    }
+    get_symbol_data("log_buf_len", sizeof(uint32_t), &log_buf_len);
 
     log_buf_len &= ((1<<20) | ((1<<20) - 1));
-    logbuf = (char *)malloc(log_buf_len);
-
-    readmem(log_buf, KVADDR, logbuf, log_buf_len);
-
-    idx = log_first_idx;
-    while (idx != log_next_idx) {
-        logptr = log_from_idx(idx, logbuf);
-        dump_log_entry(logptr);
+    char *logbuf_arry = malloc(log_buf_len);
 
-        idx = log_next(idx, logbuf);
+    if (KDEBUG(1)) {
+        pr_debug("log_buf len: %ld (0x%lx)", log_buf_len, log_buf_len);
+        pr_debug("log_buf addr: 0x%lx", log_buf);
+    }
+    readmem(log_buf, KVADDR, logbuf_arry, log_buf_len);
 
-        if (idx >= log_buf_len) {
-            break;
+    char sym[KSYM_NAME_LEN + 64];
+    int next_line = FALSE;
+    ulong line = 0;
+    for (ulong i = 0; i < log_buf_len; i++) {
+        if ((pc->flags & OOPS_REPORT) &&
+                (logbuf_arry[i] == '\n' || !logbuf_arry[i])) {
+            if (i > line)
+                oops_raw_line(logbuf_arry + line, i - line);
+            line = i + 1;
+        }
+        if (logbuf_arry[i] == '[' && (pc->flags & SYMBOLIZE) &&
+                symbolize_address(logbuf_arry + i, log_buf_len - i,
+                    sym, sizeof(sym))) {
+            next_line = TRUE;
+            fputs(sym, fp);
+            i += SYMBOLIZE_ADDR_LEN - 1;
+            continue;
+        }
+        if (logbuf_arry[i]) {
+            if (ascii(logbuf_arry[i])) {
+                next_line = TRUE;
+                fputc(logbuf_arry[i], fp);
+            }
+        } else {
+            if (next_line)
+                fputc('\n', fp);
+            next_line = FALSE;
         }
     }
+    fprintf(fp, "\n");
+    if (!(pc->flags & (CAPTURE | WATCH_CRASH | MERGE)))
+        write_data_to_file("dmesg.data", logbuf_arry, log_buf_len);
+    free(logbuf_arry);
 }
 
 static int is_text_file(const char *path)
@@ -339,16 +388,108 @@ static int is_text_file(const char *path)
     return 1;
 }
 
+enum {
+    OPT_NO_CACHE = 0x100,
+    OPT_INDEX,
+    OPT_MAP_DIR,
+    OPT_SYMBOLIZE,
+    OPT_BTF,
+    OPT_SCAN,
+    OPT_NO_MAP,
+    OPT_CAPTURE,
+    OPT_FROM_CAPTURE,
+    OPT_PROBE,
+    OPT_WATCH_CRASH,
+    OPT_INTERVAL,
+    OPT_EVENTS,
+    OPT_STORM,
+    OPT_OOPS,
+    OPT_STATS_ONLY,
+    OPT_STATS_BUCKET,
+    OPT_STATS_TOP,
+    OPT_MERGE,
+};
+
+static char *map_dir;
+static char *capture_file;
+static int from_capture;
+static int probe;
+static ulong watch_interval;
+static ulong storm_rate;
+static char *oops_file;
+static ulong stats_bucket = STATS_BUCKET_SEC;
+static ulong stats_top;
+
 static void usage(void)
 {
     fprintf(fp, "kvm-dmesg version %s \n", get_version_text());
     fprintf(fp, "Print the kernel messages from a virtual machine running under KVM\n");
     fprintf(fp, "\n");
-    fprintf(fp, "Usage: kvm-dmesg <domain_name/socket_path> <system.map> [options]\n");
+    fprintf(fp, "Usage: kvm-dmesg <domain_name/socket_path> <system.map/vmlinux> [options]\n");
+    fprintf(fp, "       kvm-dmesg <domain_name/socket_path> --map-dir <dir> [options]\n");
+    fprintf(fp, "       kvm-dmesg <domain_name/socket_path> --no-map [options]\n");
+    fprintf(fp, "       kvm-dmesg --from-capture <file> [system.map/vmlinux] [options]\n");
+    fprintf(fp, "       kvm-dmesg --watch-crash <domain_name/socket_path>... <system.map/vmlinux>\n");
+    fprintf(fp, "       kvm-dmesg --merge <domain_name/socket_path>... <system.map/vmlinux>\n");
     fprintf(fp, "\n");
     fprintf(fp, "  -h, --help       display this help and exit\n");
     fprintf(fp, "  -v, --version    output version information and exit\n");
     fprintf(fp, "  -d, --debug      specify debug level\n");
+    fprintf(fp, "      --no-cache   do not use or create cache files (bootstrap cache in\n");
+    fprintf(fp, "                   %s, System.map index)\n", BOOTCACHE_DIR);
+    fprintf(fp, "      --index <system.map>\n");
+    fprintf(fp, "                   compile an index of the System.map and exit\n");
+    fprintf(fp, "      --map-dir <dir>\n");
+    fprintf(fp, "                   pick the System.map of the running kernel from a\n");
+    fprintf(fp, "                   directory of maps (System.map-<release>, *.map)\n");
+    fprintf(fp, "      --symbolize  print raw [<address>] kernel text addresses in the\n");
+    fprintf(fp, "                   log as func+0xoff/0xsize\n");
+    fprintf(fp, "      --btf <file> take struct layouts from a BTF blob (e.g. a copy of\n");
+    fprintf(fp, "                   /sys/kernel/btf/vmlinux) instead of VMCOREINFO\n");
+    fprintf(fp, "      --scan       find KASLR and phys_base by searching guest memory\n");
+    fprintf(fp, "                   for VMCOREINFO instead of reading CPU registers\n");
+    fprintf(fp, "                   (the default for memory image files)\n");
+    fprintf(fp, "      --no-map     rebuild the symbol table from the guest's kallsyms\n");
+    fprintf(fp, "                   instead of reading a System.map (implies --scan)\n");
+    fprintf(fp, "      --capture <file>\n");
+    fprintf(fp, "                   save the guest memory the log is decoded from, and\n");
+    fprintf(fp, "                   what is needed to decode it, to <file> instead of\n");
+    fprintf(fp, "                   printing the log\n");
+    fprintf(fp, "      --from-capture\n");
+    fprintf(fp, "                   print the log saved by --capture; the System.map is\n");
+    fprintf(fp, "                   only needed for --symbolize\n");
+    fprintf(fp, "      --probe      only tell whether the log changed since the last run,\n");
+    fprintf(fp, "                   from the bootstrap cache and one read of the guest;\n");
+    fprintf(fp, "                   exits 0 if unchanged, 1 if changed or unknown\n");
+    fprintf(fp, "      --watch-crash\n");
+    fprintf(fp, "                   poll panic_cpu, oops_in_progress, tainted_mask and\n");
+    fprintf(fp, "                   friends of every guest given and save its log to\n");
+    fprintf(fp, "                   <guest>-crash-<time>.log when one of them changes\n");
+    fprintf(fp, "      --events     with --watch-crash, wait for qemu to report a panic,\n");
+    fprintf(fp, "                   stop, reset or shutdown (QMP events, libvirt\n");
+    fprintf(fp, "                   lifecycle events) instead of polling\n");
+    fprintf(fp, "      --interval <ms>\n");
+    fprintf(fp, "                   poll interval of --watch-crash (default %d, none\n",
+            WATCH_INTERVAL_MS);
+    fprintf(fp, "                   with --events)\n");
+    fprintf(fp, "      --storm <n>  with --watch-crash, also save the log to\n");
+    fprintf(fp, "                   <guest>-storm-<time>.log when a guest logs more\n");
+    fprintf(fp, "                   than <n> records per second\n");
+    fprintf(fp, "      --oops <file>\n");
+    fprintf(fp, "                   write the BUG, Oops, WARNING, panic, hung task and\n");
+    fprintf(fp, "                   RCU stall reports found in the log to <file>, one\n");
+    fprintf(fp, "                   JSON object per line; \"-\" prints them instead of\n");
+    fprintf(fp, "                   the log\n");
+    fprintf(fp, "      --stats-only print record counts per level, facility, subsystem,\n");
+    fprintf(fp, "                   device and time bucket instead of the log\n");
+    fprintf(fp, "      --stats-bucket <sec>\n");
+    fprintf(fp, "                   time bucket of --stats-only (default %d)\n",
+            STATS_BUCKET_SEC);
+    fprintf(fp, "      --stats-top <n>\n");
+    fprintf(fp, "                   also print the <n> most frequent message prefixes\n");
+    fprintf(fp, "                   (reads the message text)\n");
+    fprintf(fp, "      --merge      print the logs of every guest given as one, in\n");
+    fprintf(fp, "                   host time order\n");
     fprintf(fp, "\n");
 }
 
@@ -366,6 +507,25 @@ static int parse_options(int argc, char **argv)
         {"help",      no_argument,       NULL, 'h'},
         {"version",   no_argument,       NULL, 'v'},
         {"debug",     required_argument, NULL, 'd'},
+        {"no-cache",  no_argument,       NULL, OPT_NO_CACHE},
+        {"index",     required_argument, NULL, OPT_INDEX},
+        {"map-dir",   required_argument, NULL, OPT_MAP_DIR},
+        {"symbolize", no_argument,       NULL, OPT_SYMBOLIZE},
+        {"btf",       required_argument, NULL, OPT_BTF},
+        {"scan",      no_argument,       NULL, OPT_SCAN},
+        {"no-map",    no_argument,       NULL, OPT_NO_MAP},
+        {"capture",   required_argument, NULL, OPT_CAPTURE},
+        {"from-capture", no_argument,    NULL, OPT_FROM_CAPTURE},
+        {"probe",     no_argument,       NULL, OPT_PROBE},
+        {"watch-crash", no_argument,     NULL, OPT_WATCH_CRASH},
+        {"interval",  required_argument, NULL, OPT_INTERVAL},
+        {"events",    no_argument,       NULL, OPT_EVENTS},
+        {"storm",     required_argument, NULL, OPT_STORM},
+        {"oops",      required_argument, NULL, OPT_OOPS},
+        {"stats-only", no_argument,      NULL, OPT_STATS_ONLY},
+        {"stats-bucket", required_argument, NULL, OPT_STATS_BUCKET},
+        {"stats-top", required_argument, NULL, OPT_STATS_TOP},
+        {"merge",     no_argument,       NULL, OPT_MERGE},
         {NULL,        0,                 NULL, 0  }
     };
 
@@ -383,6 +543,65 @@ static int parse_options(int argc, char **argv)
                     log_init(LOGLEVEL_DEBUG);
                 }
                 break;
+            case OPT_NO_CACHE:
+                pc->flags |= NO_CACHE;
+                break;
+            case OPT_INDEX:
+                exit(symindex_create(optarg) ? 1 : 0);
+            case OPT_MAP_DIR:
+                map_dir = optarg;
+                break;
+            case OPT_SYMBOLIZE:
+                pc->flags |= SYMBOLIZE;
+                break;
+            case OPT_BTF:
+                pc->btf_file = optarg;
+                break;
+            case OPT_SCAN:
+                pc->flags |= SCAN_VMCOREINFO;
+                break;
+            case OPT_NO_MAP:
+                pc->flags |= NO_MAP | SCAN_VMCOREINFO;
+                break;
+            case OPT_CAPTURE:
+                capture_file = optarg;
+                pc->flags |= CAPTURE;
+                break;
+            case OPT_FROM_CAPTURE:
+                from_capture = TRUE;
+                break;
+            case OPT_PROBE:
+                probe = TRUE;
+                break;
+            case OPT_WATCH_CRASH:
+                pc->flags |= WATCH_CRASH;
+                break;
+            case OPT_INTERVAL:
+                watch_interval = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_EVENTS:
+                pc->flags |= WATCH_CRASH | WATCH_EVENTS;
+                break;
+            case OPT_STORM:
+                storm_rate = strtoul(optarg, NULL, 10);
+                pc->flags |= WATCH_CRASH;
+                break;
+            case OPT_OOPS:
+                oops_file = optarg;
+                break;
+            case OPT_STATS_ONLY:
+                pc->flags |= STATS_ONLY;
+                break;
+            case OPT_STATS_BUCKET:
+                stats_bucket = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_STATS_TOP:
+                stats_top = strtoul(optarg, NULL, 10);
+                pc->flags |= STATS_ONLY | STATS_TEXT;
+                break;
+            case OPT_MERGE:
+                pc->flags |= MERGE;
+                break;
             case '?':
                 fprintf(fp, "Try `%s --help' for more information.\n", argv[0]);
                 exit(0);
@@ -401,12 +620,31 @@ int main(int argc, char *argv[])
     char *symmap_file = NULL;
     char *guest_ac = NULL;
     guest_access_t ac_type;
-    int ind;
+    int ind, ret = 0;
 
     pc->debug = 0;
     fp = stdout;
 
     ind = parse_options(argc, argv);
+
+    if (pc->flags & (WATCH_CRASH | MERGE)) {
+        /* every argument is a guest, but for a trailing System.map */
+        if (!map_dir && !(pc->flags & NO_MAP) && argc - ind >= 2)
+            symmap_file = argv[--argc];
+        if (ind >= argc || (!map_dir && !(pc->flags & NO_MAP) &&
+                    !symmap_file)) {
+            usage();
+            return -1;
+        }
+        if (pc->flags & MERGE)
+            return merge_logs(argv + ind, argc - ind, symmap_file,
+                    map_dir) ? 1 : 0;
+        /* a storm is only seen by polling */
+        if (!watch_interval && (!(pc->flags & WATCH_EVENTS) || storm_rate))
+            watch_interval = WATCH_INTERVAL_MS;
+        return watch_crash(argv + ind, argc - ind, symmap_file, map_dir,
+                watch_interval, storm_rate) ? 1 : 0;
+    }
     if (ind < argc) {
         arg1 = argv[ind];
         ind++;
@@ -416,15 +654,46 @@ int main(int argc, char *argv[])
         ind++;
     }
 
+    if (!arg1) {
+        usage();
+        return -1;
+    }
+
+    /* --oops -: the reports take the place of the log */
+    if (oops_file && !strcmp(oops_file, "-") &&
+            !(fp = fopen("/dev/null", "w"))) {
+        fp = stdout;
+        pr_err("Cannot open /dev/null");
+        return -1;
+    }
+
+    if (from_capture) {
+        if (pc->flags & CAPTURE) {
+            pr_err("--capture and --from-capture cannot be combined");
+            return -1;
+        }
+        if (capture_load(arg1, arg2)) {
+            guest_client_release();
+            symtab_release();
+            return -1;
+        }
+        goto decode;
+    }
+
+    if (map_dir || (pc->flags & NO_MAP)) {
+        guest_ac = arg1;
+        goto access_type;
+    }
+
     if (!stat(arg1, &path_stat) && S_ISREG(path_stat.st_mode)) {
-        if (is_text_file(arg1) == 1) {
+        if (is_text_file(arg1) == 1 || is_vmlinux_file(arg1)) {
             symmap_file = arg1;
             guest_ac = arg2;
         }
     }
     if (!symmap_file) {
         if (!stat(arg2, &path_stat) && S_ISREG(path_stat.st_mode)) {
-            if (is_text_file(arg2) == 1) {
+            if (is_text_file(arg2) == 1 || is_vmlinux_file(arg2)) {
                 symmap_file = arg2;
                 guest_ac = arg1;
             }
@@ -434,74 +703,71 @@ int main(int argc, char *argv[])
         pr_err("System.map file not found");
         return -1;
     }
-    if (stat(guest_ac, &path_stat) == 0) {
-        if (S_ISREG(path_stat.st_mode)) {
-            ac_type = GUEST_MEMORY;
-        } else if (S_ISSOCK(path_stat.st_mode)) {
-            ac_type = QMP_SOCKET;
-        } else {
-            pr_err("Unknown file type: %s", guest_ac);
-            return -1;
-        }
-    } else {
-        ac_type = GUEST_NAME;
-    }
+access_type:
+    if (guest_access_type(guest_ac, &ac_type))
+        return -1;
 
     if (KDEBUG(1)) {
         pr_debug("Guest     : %s", guest_ac);
-        pr_debug("System.map: %s", symmap_file);
+        if (map_dir)
+            pr_debug("Map dir   : %s", map_dir);
+        else if (pc->flags & NO_MAP)
+            pr_debug("System.map: from guest kallsyms");
+        else
+            pr_debug("System.map: %s", symmap_file);
+    }
+
+    if (probe) {
+        ret = startup_probe(guest_ac, ac_type, symmap_file);
+        guest_client_release();
+        if (ret < 0)
+            return 2;
+        fprintf(fp, "%s\n", ret == PROBE_UNCHANGED ? "unchanged" : "changed");
+        return ret;
     }
 
-    if (guest_client_new(guest_ac, ac_type))
+    if (startup_run(guest_ac, ac_type, symmap_file, map_dir)) {
+        symtab_release();
         return -1;
-    symtab_init(symmap_file);
-    x86_64_init();
-    derive_kaslr_offset();
-    x86_64_post_reloc();
+    }
 
-    vmcoreinfo_init();
-    kernel_init();
+    if (pc->flags & CAPTURE) {
+        /* decode as usual, keeping the reads instead of the output */
+        if (fp == stdout && !(fp = fopen("/dev/null", "w"))) {
+            pr_err("Cannot open /dev/null");
+            return -1;
+        }
+        capture_start();
+    }
 
-    if (kernel_symbol_exists("prb")) {
-        dump_lockless_record_log();
-        goto exit;
-    } else if (kernel_symbol_exists("log_first_idx") &&
-            kernel_symbol_exists("log_next_idx")) {
-        dump_variable_length_record_log();
-        goto exit;
+decode:
+    if (oops_file) {
+        if (oops_open(oops_file)) {
+            ret = -1;
+            goto out;
+        }
+        pc->flags |= OOPS_REPORT;
     }
 
-    ulong log_buf_len = 0;
-    ulong log_buf = 0;
-    get_symbol_data("log_buf", sizeof(char *), &log_buf);
-    get_symbol_data("log_buf_len", sizeof(uint32_t), &log_buf_len);
+    if (pc->flags & STATS_ONLY)
+        stats_init(stats_bucket, stats_top);
 
-    log_buf_len &= ((1<<20) | ((1<<20) - 1));
-    char *logbuf_arry = malloc(log_buf_len);
+    dump_kernel_log();
 
-    if (KDEBUG(1)) {
-        pr_debug("log_buf len: %ld (0x%lx)", log_buf_len, log_buf_len);
-        pr_debug("log_buf addr: 0x%lx", log_buf);
-    }
-    readmem(log_buf, KVADDR, logbuf_arry, log_buf_len);
+    if (oops_file)
+        oops_close();
 
-    int next_line = FALSE;
-    for (ulong i = 0; i < log_buf_len; i++) {
-        if (logbuf_arry[i]) {
-            if (ascii(logbuf_arry[i])) {
-                next_line = TRUE;
-                fputc(logbuf_arry[i], fp);
-            }
-        } else {
-            if (next_line)
-                fputc('\n', fp);
-            next_line = FALSE;
-        }
-    }
-    fprintf(fp, "\n");
-    write_data_to_file("dmesg.data", logbuf_arry, log_buf_len);
+    if (pc->flags & STATS_ONLY)
+        stats_print();
 
-exit:
+    if (pc->flags & CAPTURE)
+        ret = capture_write(capture_file);
+out:
+    if (fp != stdout) {
+        fclose(fp);
+        fp = stdout;
+    }
     guest_client_release();
-    return 0;
+    symtab_release();
+    return ret;
 }
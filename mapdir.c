@@ -0,0 +1,606 @@
+/* mapdir.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <elf.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "bootcache.h"
+#include "symindex.h"
+#include "sysmap.h"
+#include "mapdir.h"
+
+/*
+ * --map-dir: pick the System.map of the running guest kernel out of a
+ * directory of maps.
+ *
+ * The directory is summarized in an index (MAPDIR_INDEX_NAME inside the
+ * directory, or BOOTCACHE_DIR when that is not writable) holding a few
+ * symbol addresses per map.  Entries are reused as long as the map keeps
+ * its size and mtime, so only new or changed maps are scanned.
+ *
+ * Selection needs no symbols from the guest: the IDT handler of vector 0
+ * and the physical address of the IDT give the KASLR offset and phys_base
+ * for every candidate, and only maps for which both come out aligned are
+ * kept.  The guest's linux_banner, read where the candidate says it is,
+ * then confirms the pick and its release.
+ */
+#define MAPDIR_MAGIC        "KDMMAPDR"
+#define MAPDIR_VERSION      (1)
+
+/* CONFIG_PHYSICAL_ALIGN is at least 2MB on x86_64 */
+#define KERNEL_ALIGN        (0x200000UL)
+
+#define BANNER_PREFIX       "Linux version "
+#define BANNER_LEN          (256)
+
+#define MAPDIR_MAX_THREADS  (16)
+
+struct mapdir {
+    struct mapdir_entry *entries;
+    uint32_t nr_entries;
+    uint32_t max_entries;
+};
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return strcmp(((const struct mapdir_entry *)a)->name,
+            ((const struct mapdir_entry *)b)->name);
+}
+
+static void mapdir_paths(const char *dir, struct stat *sb,
+        char *primary, char *fallback, size_t len)
+{
+    snprintf(primary, len, "%s/" MAPDIR_INDEX_NAME, dir);
+    snprintf(fallback, len, BOOTCACHE_DIR "/mapdir-%lx-%lx",
+            (ulong)sb->st_dev, (ulong)sb->st_ino);
+}
+
+static struct mapdir_entry *mapdir_add(struct mapdir *md)
+{
+    if (md->nr_entries == md->max_entries) {
+        md->max_entries = md->max_entries ? md->max_entries * 2 : 64;
+        md->entries = xrealloc(md->entries,
+                md->max_entries * sizeof(struct mapdir_entry));
+    }
+    memset(&md->entries[md->nr_entries], 0, sizeof(struct mapdir_entry));
+    return &md->entries[md->nr_entries++];
+}
+
+/* names are compared as strings, and the index may come from anyone */
+static int mapdir_names_ok(const struct mapdir_entry *e, uint32_t nr)
+{
+    uint32_t i;
+
+    for (i = 0; i < nr; i++) {
+        if (e[i].name[MAPDIR_NAME_LEN - 1])
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static int mapdir_read_index(const char *path, struct mapdir *md)
+{
+    struct mapdir_header hdr;
+    struct stat sb;
+    size_t len;
+    int fd, ret = -1;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(hdr) ||
+            xread(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+            memcmp(hdr.magic, MAPDIR_MAGIC, sizeof(hdr.magic)) ||
+            hdr.version != MAPDIR_VERSION)
+        goto out;
+
+    /* the count comes from the file, the file must hold that many */
+    if (hdr.nr_entries > (sb.st_size - sizeof(hdr)) /
+            sizeof(struct mapdir_entry))
+        goto out;
+
+    len = (size_t)hdr.nr_entries * sizeof(struct mapdir_entry);
+    md->entries = xmalloc(len ? len : 1);
+    if (xread(fd, md->entries, len) != len ||
+            !mapdir_names_ok(md->entries, hdr.nr_entries)) {
+        xfree(md->entries);
+        md->entries = NULL;
+        goto out;
+    }
+    md->nr_entries = md->max_entries = hdr.nr_entries;
+    ret = 0;
+out:
+    close(fd);
+    return ret;
+}
+
+static int mapdir_write_file(const char *path, struct mapdir *md)
+{
+    struct mapdir_header hdr;
+    char tmp[PATH_MAX + 16];
+    size_t len;
+    int fd;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MAPDIR_MAGIC, sizeof(hdr.magic));
+    hdr.version = MAPDIR_VERSION;
+    hdr.nr_entries = md->nr_entries;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        return -1;
+
+    len = (size_t)md->nr_entries * sizeof(struct mapdir_entry);
+    if (xwrite(fd, (char *)&hdr, sizeof(hdr)) != sizeof(hdr) ||
+            xwrite(fd, (char *)md->entries, len) != len) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void mapdir_write_index(const char *dir, struct stat *sb,
+        struct mapdir *md)
+{
+    char primary[PATH_MAX], fallback[PATH_MAX];
+    int ret;
+
+    mapdir_paths(dir, sb, primary, fallback, sizeof(primary));
+    ret = mapdir_write_file(primary, md);
+    if (ret && (!mkdir(BOOTCACHE_DIR, 0700) || errno == EEXIST))
+        ret = mapdir_write_file(fallback, md);
+
+    if (KDEBUG(1))
+        pr_debug("mapdir: %s index of %u maps", ret ? "failed to write" :
+                "wrote", md->nr_entries);
+}
+
+static int is_map_name(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len >= MAPDIR_NAME_LEN)
+        return FALSE;
+    if (!strncmp(name, "System.map", 10))
+        return !(len > strlen(SYMINDEX_SUFFIX) &&
+                !strcmp(name + len - strlen(SYMINDEX_SUFFIX), SYMINDEX_SUFFIX));
+    return len > 4 && !strcmp(name + len - 4, ".map");
+}
+
+/* System.map-5.15.0-91-generic */
+static void release_from_name(const char *name, char *release)
+{
+    const char *p = "System.map-";
+
+    release[0] = '\0';
+    if (!strncmp(name, p, strlen(p)))
+        xstrlcpy(release, name + strlen(p), MAPDIR_RELEASE_LEN);
+}
+
+/*
+ * The build ID of the kernel, when its vmlinux sits next to the map.  It
+ * is only needed to tell apart maps that have the same release.
+ */
+static void read_build_id(const char *dir, const char *release, char *build_id)
+{
+    char path[PATH_MAX], *notes = NULL, *p, *end;
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr phdr;
+    Elf64_Nhdr *nhdr;
+    uint8_t *desc;
+    uint32_t j;
+    int fd, i;
+
+    build_id[0] = '\0';
+    if (!release[0])
+        return;
+
+    snprintf(path, sizeof(path), "%s/vmlinux-%s", dir, release);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return;
+
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+            memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+            ehdr.e_ident[EI_CLASS] != ELFCLASS64)
+        goto out;
+
+    for (i = 0; i < ehdr.e_phnum; i++) {
+        if (pread(fd, &phdr, sizeof(phdr),
+                    ehdr.e_phoff + i * ehdr.e_phentsize) != sizeof(phdr))
+            goto out;
+        if (phdr.p_type != PT_NOTE || phdr.p_filesz > 0x10000)
+            continue;
+
+        notes = xmalloc(phdr.p_filesz);
+        if (pread(fd, notes, phdr.p_filesz, phdr.p_offset) !=
+                (ssize_t)phdr.p_filesz)
+            goto out;
+
+        end = notes + phdr.p_filesz;
+        for (p = notes; p + sizeof(*nhdr) <= end; ) {
+            nhdr = (Elf64_Nhdr *)p;
+            p += sizeof(*nhdr);
+            desc = (uint8_t *)p + roundup(nhdr->n_namesz, 4);
+            if ((char *)desc + nhdr->n_descsz > end)
+                break;
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                    !memcmp(p, "GNU", 4) &&
+                    nhdr->n_descsz * 2 < MAPDIR_BUILD_ID_LEN) {
+                for (j = 0; j < nhdr->n_descsz; j++)
+                    sprintf(build_id + j * 2, "%02x", desc[j]);
+                goto out;
+            }
+            p = (char *)desc + roundup(nhdr->n_descsz, 4);
+        }
+        xfree(notes);
+        notes = NULL;
+    }
+out:
+    xfree(notes);
+    close(fd);
+}
+
+#define NAME_IS(l, s) \
+    ((l)->name_len == sizeof(s) - 1 && !memcmp((l)->name, s, sizeof(s) - 1))
+
+/* Returns -1 for files that are not usable as a System.map */
+static int scan_map(const char *dir, struct mapdir_entry *e)
+{
+    char path[PATH_MAX];
+    struct sysmap_line l;
+    struct sysmap m;
+    const char *p;
+    int missing = 5;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, e->name);
+    if (sysmap_open(path, &m))
+        return -1;
+
+    for (p = m.base; missing && (p = sysmap_next(&m, p, &l)); ) {
+        if (NAME_IS(&l, "_text") && !e->text) {
+            e->text = l.addr;
+            missing--;
+        } else if (NAME_IS(&l, "idt_table") && !e->idt_table) {
+            e->idt_table = l.addr;
+            missing--;
+        } else if ((NAME_IS(&l, "divide_error") ||
+                    NAME_IS(&l, "asm_exc_divide_error")) && !e->divide_error) {
+            e->divide_error = l.addr;
+            missing--;
+        } else if (NAME_IS(&l, "linux_banner") && !e->linux_banner) {
+            e->linux_banner = l.addr;
+            missing--;
+        } else if (NAME_IS(&l, "vmcoreinfo_data") && !e->vmcoreinfo_data) {
+            e->vmcoreinfo_data = l.addr;
+            missing--;
+        }
+    }
+    sysmap_close(&m);
+
+    release_from_name(e->name, e->release);
+    read_build_id(dir, e->release, e->build_id);
+
+    return e->idt_table && e->divide_error && e->linux_banner ? 0 : -1;
+}
+
+struct scan_work {
+    const char *dir;
+    struct mapdir_entry *entries;
+    int *valid;
+    uint32_t nr;
+    uint32_t next;
+};
+
+static void *scan_thread(void *arg)
+{
+    struct scan_work *w = arg;
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED)) < w->nr)
+        w->valid[i] = !scan_map(w->dir, &w->entries[i]);
+    return NULL;
+}
+
+static void scan_maps(const char *dir, struct mapdir_entry *entries,
+        int *valid, uint32_t nr)
+{
+    pthread_t threads[MAPDIR_MAX_THREADS];
+    struct scan_work w = { dir, entries, valid, nr, 0 };
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, started = 0;
+
+    if (n > MAPDIR_MAX_THREADS)
+        n = MAPDIR_MAX_THREADS;
+    if (n > nr)
+        n = nr;
+
+    for (i = 1; i < n; i++) {
+        if (pthread_create(&threads[started], NULL, scan_thread, &w))
+            break;
+        started++;
+    }
+    scan_thread(&w);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+/*
+ * Bring the index of the directory up to date.  Maps whose size and mtime
+ * did not change keep their entry; the others are scanned in parallel.
+ */
+static int mapdir_load(const char *dir, struct mapdir *md)
+{
+    char primary[PATH_MAX], fallback[PATH_MAX], path[PATH_MAX];
+    struct mapdir cached = { 0 }, todo = { 0 };
+    struct mapdir_entry key, *old, *e;
+    struct stat dir_sb, sb;
+    struct dirent *de;
+    int *valid, changed;
+    char *reused;
+    uint32_t i;
+    DIR *d;
+
+    if (stat(dir, &dir_sb) || !S_ISDIR(dir_sb.st_mode)) {
+        pr_err("Not a directory: %s", dir);
+        return -1;
+    }
+
+    if (!(pc->flags & NO_CACHE)) {
+        mapdir_paths(dir, &dir_sb, primary, fallback, sizeof(primary));
+        if (mapdir_read_index(primary, &cached))
+            mapdir_read_index(fallback, &cached);
+    }
+    /* written sorted, but do not trust the file */
+    if (cached.nr_entries)
+        qsort(cached.entries, cached.nr_entries, sizeof(*cached.entries),
+                cmp_entry);
+
+    if (!(d = opendir(dir))) {
+        pr_err("Failed to open %s", dir);
+        xfree(cached.entries);
+        return -1;
+    }
+    reused = xcalloc(cached.nr_entries + 1, sizeof(char));
+
+    memset(md, 0, sizeof(*md));
+    changed = FALSE;
+    while ((de = readdir(d))) {
+        if (!is_map_name(de->d_name))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &sb) || !S_ISREG(sb.st_mode))
+            continue;
+
+        xstrlcpy(key.name, de->d_name, sizeof(key.name));
+        old = cached.nr_entries ? bsearch(&key, cached.entries,
+                cached.nr_entries, sizeof(key), cmp_entry) : NULL;
+        if (old && old->size == (uint64_t)sb.st_size &&
+                old->mtime == (uint64_t)sb.st_mtime) {
+            *mapdir_add(md) = *old;
+            reused[old - cached.entries] = TRUE;
+            continue;
+        }
+
+        e = mapdir_add(&todo);
+        xstrlcpy(e->name, de->d_name, sizeof(e->name));
+        e->size = sb.st_size;
+        e->mtime = sb.st_mtime;
+    }
+    closedir(d);
+
+    /* entries left in the old index belong to maps that went away */
+    for (i = 0; i < cached.nr_entries; i++) {
+        if (!reused[i])
+            changed = TRUE;
+    }
+    xfree(reused);
+    xfree(cached.entries);
+
+    if (todo.nr_entries) {
+        valid = xcalloc(todo.nr_entries, sizeof(int));
+        scan_maps(dir, todo.entries, valid, todo.nr_entries);
+        for (i = 0; i < todo.nr_entries; i++) {
+            if (valid[i])
+                *mapdir_add(md) = todo.entries[i];
+        }
+        if (KDEBUG(1))
+            pr_debug("mapdir: scanned %u new or changed maps in %s",
+                    todo.nr_entries, dir);
+        xfree(valid);
+        xfree(todo.entries);
+        changed = TRUE;
+    }
+
+    if (md->nr_entries)
+        qsort(md->entries, md->nr_entries, sizeof(*md->entries), cmp_entry);
+
+    if (changed && !(pc->flags & NO_CACHE))
+        mapdir_write_index(dir, &dir_sb, md);
+
+    return 0;
+}
+
+/*
+ * The guest's BUILD-ID from VMCOREINFO, located through the candidate's
+ * vmcoreinfo_data.  Returns -1 when it cannot be read.
+ */
+static int read_guest_build_id(struct mapdir_entry *e, ulong kaslr,
+        ulong phys_base, char *build_id)
+{
+    physaddr_t paddr;
+    char *buf, *p, *q;
+    ulong data;
+    int ret = -1;
+
+    if (!e->vmcoreinfo_data)
+        return -1;
+
+    paddr = e->vmcoreinfo_data + kaslr - __START_KERNEL_map + phys_base;
+    if (readmem(paddr, PHYSADDR, &data, sizeof(data)) || !data ||
+            x86_64_kvtop(data, &paddr))
+        return -1;
+
+    /* VMCOREINFO is at most a page */
+    buf = xcalloc(1, PAGESIZE() + 1);
+    if (readmem(paddr, PHYSADDR, buf, PAGESIZE()))
+        goto out;
+
+    if (!(p = strstr(buf, "BUILD-ID=")))
+        goto out;
+    p += strlen("BUILD-ID=");
+    for (q = p; *q && *q != '\n' && q - p < MAPDIR_BUILD_ID_LEN - 1; q++)
+        ;
+    memcpy(build_id, p, q - p);
+    build_id[q - p] = '\0';
+    ret = 0;
+out:
+    xfree(buf);
+    return ret;
+}
+
+static int same_build(struct mapdir_entry *a, struct mapdir_entry *b)
+{
+    return a->text == b->text && a->idt_table == b->idt_table &&
+        a->divide_error == b->divide_error &&
+        a->linux_banner == b->linux_banner &&
+        a->vmcoreinfo_data == b->vmcoreinfo_data;
+}
+
+int mapdir_select(const char *dir, char *map_file, size_t len)
+{
+    char banner[BANNER_LEN], release[MAPDIR_RELEASE_LEN];
+    char guest_build_id[MAPDIR_BUILD_ID_LEN];
+    ulong vec0, idt_paddr, kaslr, phys_base;
+    ulong banner_paddr, last_paddr = ~0UL;
+    uint32_t *match, nr_match = 0, nr_plausible = 0, i, j, k;
+    struct mapdir_entry *e, *chosen;
+    struct mapdir md;
+    char *p;
+    int ret = -1;
+
+    if (mapdir_load(dir, &md))
+        return -1;
+
+    if (!md.nr_entries) {
+        pr_err("No System.map found in %s", dir);
+        goto out;
+    }
+
+    if (x86_64_idt_probe(&vec0, &idt_paddr)) {
+        pr_err("Failed to locate the guest IDT");
+        goto out;
+    }
+
+    release[0] = '\0';
+    match = xcalloc(md.nr_entries, sizeof(*match));
+    for (i = 0; i < md.nr_entries; i++) {
+        e = &md.entries[i];
+
+        kaslr = vec0 - e->divide_error;
+        phys_base = idt_paddr - (e->idt_table + kaslr - __START_KERNEL_map);
+        if ((kaslr | phys_base) & (KERNEL_ALIGN - 1))
+            continue;
+        nr_plausible++;
+
+        banner_paddr = e->linux_banner + kaslr - __START_KERNEL_map + phys_base;
+        if (banner_paddr != last_paddr) {
+            last_paddr = banner_paddr;
+            memset(banner, 0, sizeof(banner));
+            if (readmem(banner_paddr, PHYSADDR, banner, sizeof(banner) - 1))
+                banner[0] = '\0';
+        }
+        if (strncmp(banner, BANNER_PREFIX, strlen(BANNER_PREFIX)))
+            continue;
+
+        p = banner + strlen(BANNER_PREFIX);
+        for (j = 0; j < sizeof(release) - 1 && p[j] && p[j] != ' '; j++)
+            release[j] = p[j];
+        release[j] = '\0';
+
+        if (e->release[0] && strcmp(e->release, release))
+            continue;
+        match[nr_match++] = i;
+    }
+
+    if (KDEBUG(1))
+        pr_debug("mapdir: %u maps, %u fit the IDT, %u match the banner",
+                md.nr_entries, nr_plausible, nr_match);
+
+    if (!nr_match) {
+        if (release[0])
+            pr_err("No System.map in %s matches the guest (Linux %s)",
+                    dir, release);
+        else
+            pr_err("No System.map in %s matches the guest", dir);
+        xfree(match);
+        goto out;
+    }
+
+    /* several builds of one release: let the build ID decide */
+    chosen = &md.entries[match[0]];
+    for (i = 1; i < nr_match; i++) {
+        if (!same_build(chosen, &md.entries[match[i]]))
+            break;
+    }
+    if (i < nr_match) {
+        guest_build_id[0] = '\0';
+        k = nr_match;
+        e = &md.entries[match[0]];
+        kaslr = vec0 - e->divide_error;
+        phys_base = idt_paddr - (e->idt_table + kaslr - __START_KERNEL_map);
+        if (!read_guest_build_id(e, kaslr, phys_base, guest_build_id)) {
+            for (k = 0; k < nr_match; k++) {
+                e = &md.entries[match[k]];
+                if (e->build_id[0] && !strcmp(e->build_id, guest_build_id)) {
+                    chosen = e;
+                    break;
+                }
+            }
+        }
+        if (k == nr_match)
+            pr_warning("%u maps in %s match the guest, using %s",
+                    nr_match, dir, chosen->name);
+    }
+    xfree(match);
+
+    if (KDEBUG(1))
+        pr_debug("mapdir: selected %s (Linux %s)", chosen->name, release);
+
+    snprintf(map_file, len, "%s/%s", dir, chosen->name);
+    ret = 0;
+out:
+    xfree(md.entries);
+    return ret;
+}
@@ -0,0 +1,53 @@
+/* mapdir.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __MAPDIR_H__
+#define __MAPDIR_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAPDIR_INDEX_NAME   ".kvm-dmesg-mapdir"
+
+#define MAPDIR_NAME_LEN     (256)
+#define MAPDIR_RELEASE_LEN  (65)
+#define MAPDIR_BUILD_ID_LEN (41)
+
+/*
+ * What kvm-dmesg needs to know about every System.map of a directory to
+ * pick the one the guest runs, without opening the maps again.
+ */
+struct mapdir_entry {
+    char name[MAPDIR_NAME_LEN];
+    uint64_t size;
+    uint64_t mtime;
+    uint64_t text;
+    uint64_t idt_table;
+    uint64_t divide_error;
+    uint64_t linux_banner;
+    uint64_t vmcoreinfo_data;
+    char release[MAPDIR_RELEASE_LEN];       /* from the file name */
+    char build_id[MAPDIR_BUILD_ID_LEN];     /* from vmlinux-<release> */
+};
+
+struct mapdir_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nr_entries;
+};
+
+int mapdir_select(const char *dir, char *map_file, size_t len);
+
+#endif
@@ -28,6 +28,39 @@
 
 static proc_mem_t *proc_mem = NULL;
 
+/*
+ * Guest RAM stays at the same place in QEMU's address space for the life
+ * of the process (short of memory hotplug), so the monitor's gpa2hva
+ * answer is cached per guest page instead of asked for on every read.
+ */
+#define HVA_CACHE_SIZE      (64)
+#define HVA_PAGE_SHIFT      (12)
+
+static struct {
+    uint64_t gfn_plus_one;          /* 0 when empty */
+    uint64_t hva;
+} hva_cache[HVA_CACHE_SIZE];
+
+static int mem_gpa2hva(uint64_t gpa, uint64_t *hva)
+{
+    uint64_t gfn = gpa >> HVA_PAGE_SHIFT;
+    uint64_t off = gpa & ((1ULL << HVA_PAGE_SHIFT) - 1);
+    int slot = gfn % HVA_CACHE_SIZE;
+
+    if (hva_cache[slot].gfn_plus_one == gfn + 1) {
+        *hva = hva_cache[slot].hva + off;
+        return 0;
+    }
+
+    if (proc_mem->gpa2hva(gpa - off, hva) < 0)
+        return -1;
+
+    hva_cache[slot].gfn_plus_one = gfn + 1;
+    hva_cache[slot].hva = *hva;
+    *hva += off;
+    return 0;
+}
+
 int mem_init(pid_t pid, int (*gpa2hva)(uint64_t, uint64_t*))
 {
     int fd;
@@ -60,6 +93,7 @@ int mem_uninit()
         close(proc_mem->mem_fd);
     }
     xfree(proc_mem);
+    memset(hva_cache, 0, sizeof(hva_cache));
     return 0;
 }
 
@@ -78,7 +112,7 @@ int mem_read(uint64_t addr, void *buffer, size_t size)
      * contiguous in the QEMU's address space, so it is always necessary to
      * calculate the HVA based on the GPA.
      */
-    if (proc_mem->gpa2hva(addr, &hva) < 0)
+    if (mem_gpa2hva(addr, &hva) < 0)
       return -1;
 
     if (lseek(proc_mem->mem_fd, hva, SEEK_SET) == -1) {
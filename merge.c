@@ -0,0 +1,435 @@
+/* merge.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "startup.h"
+#include "merge.h"
+
+/*
+ * --merge: the logs of several guests as one timeline in host time.  As
+ * with --watch-crash each guest is read by its own child process, which
+ * prints its log into a pipe as usual, preceded by the offset from its
+ * clock to the host's.  The parent keeps one record per guest and a heap
+ * of them ordered by host time, so memory does not grow with the logs and
+ * a child that is ahead blocks on its pipe until the others catch up.
+ */
+struct merge_stream {
+    const char *guest;
+    pid_t pid;
+    FILE *in;
+    int64_t offset;             /* host ns - guest ns */
+
+    char *line;                 /* the next record's first line, read ahead */
+    size_t line_size;
+    int eof;
+
+    uint64_t ts_nsec;           /* the record, in guest time */
+    char rec[MERGE_RECORD_MAX];
+    size_t rec_len;
+};
+
+/*
+ * printk's timestamps are local_clock(), which on KVM runs with the
+ * guest's CLOCK_MONOTONIC to within the few milliseconds they start apart
+ * at boot.  The timekeeper has the latter as of its last update,
+ * tkr_mono.base + (tkr_mono.xtime_nsec >> tkr_mono.shift), at offsets
+ * BTF knows or the x86_64 ones since 4.1.  Up to 4.12 tk_read_base still
+ * has the read() callback after the clocksource, which moves them by 8.
+ */
+struct merge_clock {
+    ulong kaddr;                /* tk_core.timekeeper.tkr_mono */
+    long shift;
+    long xtime_nsec;
+    long base;
+    long len;
+};
+
+static int merge_clock_init(struct merge_clock *c)
+{
+    long tkr_mono;
+
+    if (!kernel_symbol_exists("tk_core"))
+        return -1;
+
+    tkr_mono = MEMBER_OFFSET("timekeeper", "tkr_mono");
+    c->shift = MEMBER_OFFSET("tk_read_base", "shift");
+    c->xtime_nsec = MEMBER_OFFSET("tk_read_base", "xtime_nsec");
+    c->base = MEMBER_OFFSET("tk_read_base", "base");
+    if (tkr_mono < 0 || c->shift < 0 || c->xtime_nsec < 0 || c->base < 0) {
+        if (THIS_KERNEL_VERSION < LINUX(4,1,0))
+            return -1;
+        tkr_mono = 0;
+        if (THIS_KERNEL_VERSION < LINUX(4,13,0)) {
+            c->shift = 36;
+            c->xtime_nsec = 40;
+            c->base = 48;
+        } else {
+            c->shift = 28;
+            c->xtime_nsec = 32;
+            c->base = 40;
+        }
+    }
+
+    c->kaddr = relocate(symbol_value("tk_core")) +
+        MERGE_TK_CORE_TIMEKEEPER + tkr_mono;
+    c->len = MAX(c->shift + sizeof(uint32_t),
+            MAX(c->xtime_nsec, c->base) + sizeof(uint64_t));
+    return c->len > 256 ? -1 : 0;
+}
+
+static int merge_clock_read(struct merge_clock *c, uint64_t *ns)
+{
+    char buf[256];
+    uint64_t base;
+    uint shift;
+
+    if (readmem(c->kaddr, KVADDR, buf, c->len))
+        return -1;
+
+    /* a clocksource shift is below 32, and the clock has run since boot */
+    shift = UINT(buf + c->shift);
+    base = ULONGLONG(buf + c->base);
+    if (shift >= 32 || !base)
+        return -1;
+
+    *ns = base + (ULONGLONG(buf + c->xtime_nsec) >> shift);
+    return 0;
+}
+
+static uint64_t merge_host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The guest clock only moves when the timekeeper is updated, once a tick
+ * on a busy guest.  Read it until it moves: the update happened between
+ * the last two reads, which bounds the offset to their distance.  An idle
+ * guest may not tick for longer, and its offset is then late by up to
+ * the time since its last update.
+ */
+static int merge_calibrate(int64_t *offset)
+{
+    struct merge_clock c;
+    uint64_t mono, prev, start, before, after;
+
+    if (merge_clock_init(&c) || merge_clock_read(&c, &prev))
+        return -1;
+
+    start = after = merge_host_ns();
+    do {
+        before = after;
+        if (merge_clock_read(&c, &mono))
+            return -1;
+        after = merge_host_ns();
+    } while (mono == prev && after - start < MERGE_CALIBRATE_MS * 1000000ULL);
+
+    if (mono == prev) {
+        *offset = after - mono;
+        if (KDEBUG(1))
+            pr_debug("clock: no update in %dms, offset %lld",
+                    MERGE_CALIBRATE_MS, (long long)*offset);
+        return 0;
+    }
+
+    *offset = before + (after - before) / 2 - mono;
+    if (KDEBUG(1))
+        pr_debug("clock: offset %lld +/- %lluns", (long long)*offset,
+                (unsigned long long)(after - before) / 2);
+    return 0;
+}
+
+static int merge_guest(char *guest, char *symmap_file, char *map_dir,
+        int fd)
+{
+    guest_access_t ty;
+    int64_t offset = 0;
+    FILE *out;
+
+    if (!(out = fdopen(fd, "w")))
+        return 1;
+
+    /* only the log goes into the pipe */
+    if (!(fp = fopen("/dev/null", "w")))
+        return 1;
+
+    if (guest_access_type(guest, &ty) ||
+            startup_run(guest, ty, symmap_file, map_dir))
+        return 1;
+
+    if (ty == GUEST_MEMORY)
+        pr_warning("%s: a memory image has no clock to compare with the "
+                "host's, its times are left as they are", guest);
+    else if (merge_calibrate(&offset))
+        pr_warning("%s: cannot read the guest clock (tk_core), its times "
+                "are left as they are", guest);
+
+    fclose(fp);
+    fp = out;
+    fprintf(fp, "%lld\n", (long long)offset);
+    dump_kernel_log();
+    fclose(fp);
+    return 0;
+}
+
+static pid_t merge_spawn(struct merge_stream *s, char *symmap_file,
+        char *map_dir)
+{
+    pid_t pid;
+    int fds[2];
+
+    if (pipe(fds)) {
+        pr_err("%s: cannot create a pipe: %s", s->guest, strerror(errno));
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) == -1) {
+        pr_err("%s: cannot fork: %s", s->guest, strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (!pid) {
+        close(fds[0]);
+        exit(merge_guest((char *)s->guest, symmap_file, map_dir, fds[1]));
+    }
+
+    close(fds[1]);
+    if (!(s->in = fdopen(fds[0], "r"))) {
+        close(fds[0]);
+        return -1;
+    }
+    return pid;
+}
+
+/*
+ * "[    5.123456] text", or "<6>[    5.123456] text" from the plain
+ * log_buf of kernels before 3.5.
+ */
+static const char *merge_parse_ts(const char *line, uint64_t *ts_nsec)
+{
+    unsigned long long sec;
+    unsigned long usec;
+    int n = 0;
+
+    if (line[0] == '<' && isdigit((unsigned char)line[1]) && line[2] == '>')
+        line += 3;
+    if (line[0] != '[' ||
+            sscanf(line, "[%llu.%lu]%n", &sec, &usec, &n) != 2 || !n)
+        return NULL;
+
+    *ts_nsec = sec * 1000000000ULL + usec * 1000ULL;
+    line += n;
+    return *line == ' ' ? line + 1 : line;
+}
+
+static void merge_read_line(struct merge_stream *s)
+{
+    ssize_t n;
+
+    if (s->eof)
+        return;
+    if ((n = getline(&s->line, &s->line_size, s->in)) < 0) {
+        s->eof = TRUE;
+        return;
+    }
+    if (n && s->line[n - 1] == '\n')
+        s->line[n - 1] = '\0';
+}
+
+static void merge_append(struct merge_stream *s, const char *text)
+{
+    size_t n = strlen(text);
+
+    /* the lines that do not fit are dropped, the record's first one fits */
+    if (s->rec_len + n + 1 >= sizeof(s->rec))
+        return;
+    memcpy(s->rec + s->rec_len, text, n);
+    s->rec_len += n;
+    s->rec[s->rec_len++] = '\n';
+}
+
+/*
+ * Take the record read ahead and the continuation lines after it.  Lines
+ * before the first timestamp go with the time of the record before.
+ * Returns FALSE at the end of the stream.
+ */
+static int merge_next_record(struct merge_stream *s)
+{
+    const char *text;
+    uint64_t ts_nsec;
+
+    if (s->eof)
+        return FALSE;
+
+    s->rec_len = 0;
+    if (!(text = merge_parse_ts(s->line, &s->ts_nsec)))
+        text = s->line;
+    merge_append(s, text);
+
+    for (;;) {
+        merge_read_line(s);
+        if (s->eof)
+            break;
+        if (merge_parse_ts(s->line, &ts_nsec))
+            break;
+        if (s->line[0])
+            merge_append(s, s->line);
+    }
+    return TRUE;
+}
+
+static int merge_open_stream(struct merge_stream *s)
+{
+    long long offset;
+
+    merge_read_line(s);
+    if (s->eof || sscanf(s->line, "%lld", &offset) != 1) {
+        s->eof = TRUE;
+        return -1;
+    }
+    s->offset = offset;
+
+    merge_read_line(s);
+    /* an empty log still ends in a newline */
+    while (!s->eof && !s->line[0])
+        merge_read_line(s);
+    return 0;
+}
+
+static uint64_t merge_host_ts(const struct merge_stream *s)
+{
+    return s->ts_nsec + s->offset;
+}
+
+static void merge_print(const struct merge_stream *s)
+{
+    char stamp[64];
+    const char *p, *eol;
+    uint64_t ts = merge_host_ts(s);
+    time_t sec = ts / 1000000000;
+    struct tm tm;
+    size_t n;
+
+    localtime_r(&sec, &tm);
+    n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(stamp + n, sizeof(stamp) - n, ".%06lu",
+            (ulong)(ts % 1000000000) / 1000);
+
+    for (p = s->rec; p < s->rec + s->rec_len; p = eol + 1) {
+        eol = memchr(p, '\n', s->rec + s->rec_len - p);
+        fprintf(fp, "[%s] %s: %.*s\n", stamp, s->guest, (int)(eol - p), p);
+    }
+}
+
+/* a min-heap of streams by the host time of their record, ties by guest */
+static int merge_before(struct merge_stream *streams, int a, int b)
+{
+    uint64_t x = merge_host_ts(&streams[a]), y = merge_host_ts(&streams[b]);
+
+    return x != y ? x < y : a < b;
+}
+
+static void merge_heap_down(struct merge_stream *streams, int *heap, int n,
+        int i)
+{
+    int child, tmp;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n &&
+                merge_before(streams, heap[child + 1], heap[child]))
+            child++;
+        if (!merge_before(streams, heap[child], heap[i]))
+            break;
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+int merge_logs(char **guests, int nr_guests, char *symmap_file,
+        char *map_dir)
+{
+    struct merge_stream *streams, *s;
+    int *heap, n = 0, i, status, ret = 0;
+
+    streams = xcalloc(nr_guests, sizeof(struct merge_stream));
+    heap = xcalloc(nr_guests, sizeof(int));
+
+    for (i = 0; i < nr_guests; i++) {
+        streams[i].guest = guests[i];
+        if ((streams[i].pid = merge_spawn(&streams[i], symmap_file,
+                        map_dir)) <= 0)
+            ret = -1;
+    }
+
+    for (i = 0; i < nr_guests; i++) {
+        s = &streams[i];
+        if (!s->in || merge_open_stream(s))
+            continue;
+        if (merge_next_record(s))
+            heap[n++] = i;
+    }
+    for (i = n / 2 - 1; i >= 0; i--)
+        merge_heap_down(streams, heap, n, i);
+
+    while (n) {
+        s = &streams[heap[0]];
+        merge_print(s);
+        if (!merge_next_record(s))
+            heap[0] = heap[--n];
+        merge_heap_down(streams, heap, n, 0);
+    }
+    fflush(fp);
+
+    for (i = 0; i < nr_guests; i++) {
+        s = &streams[i];
+        if (s->in)
+            fclose(s->in);
+        free(s->line);
+        if (s->pid <= 0)
+            continue;
+        while (waitpid(s->pid, &status, 0) == -1 && errno == EINTR)
+            ;
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            pr_err("%s: could not read the log", s->guest);
+            ret = -1;
+        }
+    }
+
+    xfree(heap);
+    xfree(streams);
+    return ret;
+}
@@ -0,0 +1,28 @@
+/* merge.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+#define MERGE_CALIBRATE_MS      (100)   /* waiting for a timekeeping update */
+#define MERGE_RECORD_MAX        (8192)  /* a record and its continuation lines */
+
+/* struct timekeeper in tk_core, behind its seqcount (3.17+) */
+#define MERGE_TK_CORE_TIMEKEEPER    (8)
+
+int merge_logs(char **guests, int nr_guests, char *symmap_file,
+        char *map_dir);
+
+#endif
@@ -0,0 +1,389 @@
+/* oops.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/param.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "oops.h"
+
+/*
+ * --oops: pick the crash reports out of the log while it is decoded.  The
+ * decoders hand over every record, and a small state machine follows the
+ * header line of a report, its CPU/PID and RIP lines and its call trace.
+ * Only the report being read is kept; it is written out as one JSON line
+ * once it ends: after its call trace, at an end marker, at the next
+ * report, or at the end of the log.
+ */
+enum oops_type {
+    OOPS_NONE,
+    OOPS_BUG,
+    OOPS_OOPS,
+    OOPS_WARNING,
+    OOPS_PANIC,
+    OOPS_HUNG_TASK,
+    OOPS_RCU_STALL,
+};
+
+static const char *oops_type_names[] = {
+    [OOPS_NONE]      = "none",
+    [OOPS_BUG]       = "bug",
+    [OOPS_OOPS]      = "oops",
+    [OOPS_WARNING]   = "warning",
+    [OOPS_PANIC]     = "panic",
+    [OOPS_HUNG_TASK] = "hung_task",
+    [OOPS_RCU_STALL] = "rcu_stall",
+};
+
+/* the first line of a report, at the start of a line */
+static const struct oops_header {
+    const char *prefix;
+    enum oops_type type;
+} oops_headers[] = {
+    { "BUG: ",                       OOPS_BUG },
+    { "Oops: ",                      OOPS_OOPS },
+    { "general protection fault",    OOPS_OOPS },
+    { "Kernel panic - not syncing",  OOPS_PANIC },
+    { "WARNING: ",                   OOPS_WARNING },
+    { "INFO: task ",                 OOPS_HUNG_TASK },
+    { "rcu: INFO: ",                 OOPS_RCU_STALL },
+    { "INFO: rcu_",                  OOPS_RCU_STALL },  /* before 4.19 */
+};
+
+#define NR_OOPS_HEADERS (sizeof(oops_headers) / sizeof(oops_headers[0]))
+
+static struct {
+    FILE *fp;
+    unsigned long nr_reports;
+
+    /* the report being read */
+    enum oops_type type;
+    int in_trace;
+    int seen_trace;
+    int lines;
+    uint64_t ts_nsec;
+    uint32_t caller_id;
+    int cpu;
+    int pid;
+    char comm[32];
+    char title[OOPS_TITLE_MAX];
+    char rip[OOPS_FIELD_MAX];
+    char frames[OOPS_FRAMES_MAX][OOPS_FIELD_MAX];
+    int nr_frames;
+} oops;
+
+static int prefix(const char *s, const char *p)
+{
+    return !strncmp(s, p, strlen(p));
+}
+
+static void oops_json_string(const char *s)
+{
+    FILE *f = oops.fp;
+
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void oops_emit(void)
+{
+    FILE *f = oops.fp;
+    int i;
+
+    if (oops.type == OOPS_NONE)
+        return;
+
+    fprintf(f, "{\"type\": \"%s\", \"time\": %llu.%06llu",
+            oops_type_names[oops.type],
+            (unsigned long long)(oops.ts_nsec / 1000000000),
+            (unsigned long long)(oops.ts_nsec % 1000000000) / 1000);
+    if (oops.caller_id)
+        fprintf(f, ", \"caller\": \"%c%u\"",
+                oops.caller_id & OOPS_CALLER_CPU ? 'C' : 'T',
+                oops.caller_id & ~OOPS_CALLER_CPU);
+    if (oops.cpu >= 0)
+        fprintf(f, ", \"cpu\": %d", oops.cpu);
+    if (oops.pid >= 0)
+        fprintf(f, ", \"pid\": %d", oops.pid);
+    if (oops.comm[0]) {
+        fprintf(f, ", \"comm\": ");
+        oops_json_string(oops.comm);
+    }
+    fprintf(f, ", \"title\": ");
+    oops_json_string(oops.title);
+    if (oops.rip[0]) {
+        fprintf(f, ", \"rip\": ");
+        oops_json_string(oops.rip);
+    }
+    fprintf(f, ", \"frames\": [");
+    for (i = 0; i < oops.nr_frames; i++) {
+        if (i)
+            fprintf(f, ", ");
+        oops_json_string(oops.frames[i]);
+    }
+    fprintf(f, "]}\n");
+
+    oops.nr_reports++;
+    oops.type = OOPS_NONE;
+}
+
+static void oops_begin(enum oops_type type, const char *line,
+        uint64_t ts_nsec, uint32_t caller_id)
+{
+    oops_emit();
+
+    oops.type = type;
+    oops.in_trace = oops.seen_trace = FALSE;
+    oops.lines = 0;
+    oops.ts_nsec = ts_nsec;
+    oops.caller_id = caller_id;
+    oops.cpu = oops.pid = -1;
+    oops.comm[0] = oops.rip[0] = '\0';
+    oops.nr_frames = 0;
+    xstrlcpy(oops.title, line, sizeof(oops.title));
+
+    /* the caller is the task, or the CPU in interrupt context */
+    if (caller_id & OOPS_CALLER_CPU)
+        oops.cpu = caller_id & ~OOPS_CALLER_CPU;
+    else if (caller_id)
+        oops.pid = caller_id;
+
+    switch (type) {
+        case OOPS_WARNING:
+            /* WARNING: CPU: 0 PID: 1 at kernel/foo.c:12 foo+0x1/0x2 */
+            sscanf(line, "WARNING: CPU: %d PID: %d", &oops.cpu, &oops.pid);
+            break;
+        case OOPS_HUNG_TASK:
+            /* INFO: task kworker/0:1:12 blocked for more than 120 seconds. */
+            sscanf(line, "INFO: task %31[^ ]", oops.comm);
+            if (strrchr(oops.comm, ':')) {
+                oops.pid = atoi(strrchr(oops.comm, ':') + 1);
+                *strrchr(oops.comm, ':') = '\0';
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static const struct oops_header *oops_header(const char *line)
+{
+    size_t i;
+
+    for (i = 0; i < NR_OOPS_HEADERS; i++) {
+        if (prefix(line, oops_headers[i].prefix))
+            return &oops_headers[i];
+    }
+    return NULL;
+}
+
+/*
+ * A frame of "Call Trace:", " foo+0x1/0x2 [mod]" or, before 4.14,
+ * " [<ffffffff81000000>] foo+0x1/0x2".  Unreliable " ? " frames and the
+ * <IRQ>/<TASK> markers keep the trace going but are not kept.
+ */
+static int oops_frame(const char *line)
+{
+    const char *p;
+
+    if (line[0] != ' ')
+        return FALSE;
+
+    for (p = line; *p == ' '; p++)
+        ;
+    if (prefix(p, "[<") && (p = strstr(p, "] ")))
+        p += 2;
+
+    if (*p == '<' || prefix(p, "? ") || !*p)
+        return TRUE;
+
+    if (oops.nr_frames < OOPS_FRAMES_MAX)
+        xstrlcpy(oops.frames[oops.nr_frames++], p, OOPS_FIELD_MAX);
+    return TRUE;
+}
+
+static void oops_fields(const char *line)
+{
+    const char *p;
+
+    /* CPU: 1 PID: 42 Comm: insmod Not tainted 6.1.0 #1 (UID: since 6.12) */
+    if (prefix(line, "CPU: ") && !oops.comm[0]) {
+        sscanf(line, "CPU: %d", &oops.cpu);
+        if ((p = strstr(line, " PID: ")))
+            sscanf(p, " PID: %d", &oops.pid);
+        if ((p = strstr(line, " Comm: ")))
+            sscanf(p, " Comm: %31s", oops.comm);
+        return;
+    }
+
+    /* RIP: 0010:foo+0x1/0x2, IP: [<ffffffff81000000>] foo+0x1/0x2 */
+    if ((prefix(line, "RIP: ") || prefix(line, "IP: ")) && !oops.rip[0]) {
+        p = strchr(line, ' ') + 1;
+        if (strstr(p, "] "))
+            p = strrchr(p, ']') + 1;
+        else if (strchr(p, ':'))
+            p = strchr(p, ':') + 1;
+        while (*p == ' ')
+            p++;
+        xstrlcpy(oops.rip, p, sizeof(oops.rip));
+        return;
+    }
+
+    if (prefix(line, "Call Trace:")) {
+        oops.in_trace = oops.seen_trace = TRUE;
+        return;
+    }
+}
+
+static void oops_line(const char *line, uint64_t ts_nsec, uint32_t caller_id)
+{
+    const struct oops_header *h;
+
+    if (prefix(line, "---[ end ")) {
+        oops_emit();
+        return;
+    }
+
+    if ((h = oops_header(line))) {
+        /* BUG: unable to handle page fault ... is followed by Oops: */
+        if (h->type == OOPS_OOPS && oops.type == OOPS_BUG &&
+                !oops.seen_trace)
+            return;
+        oops_begin(h->type, line, ts_nsec, caller_id);
+        return;
+    }
+
+    if (oops.type == OOPS_NONE)
+        return;
+
+    if (++oops.lines > OOPS_LINES_MAX) {
+        oops_emit();
+        return;
+    }
+
+    if (oops.in_trace) {
+        if (oops_frame(line))
+            return;
+        /* nothing after the trace belongs in the report */
+        oops_emit();
+        return;
+    }
+
+    oops_fields(line);
+}
+
+/*
+ * Feed one log record, which may hold several lines.  The text is neither
+ * NUL-terminated nor sanitized.
+ */
+void oops_record(uint64_t ts_nsec, uint32_t caller_id, const char *text,
+        int len)
+{
+    char line[OOPS_TITLE_MAX];
+    const char *end = text + len, *eol;
+    size_t n;
+
+    if (!oops.fp)
+        return;
+
+    while (text < end) {
+        if (!(eol = memchr(text, '\n', end - text)))
+            eol = end;
+
+        n = MIN((size_t)(eol - text), sizeof(line) - 1);
+        memcpy(line, text, n);
+        while (n && isspace((unsigned char)line[n - 1]))
+            n--;
+        line[n] = '\0';
+
+        oops_line(line, ts_nsec, caller_id);
+        text = eol + 1;
+    }
+}
+
+/*
+ * A line of the plain log_buf of kernels before 3.5, which still carries
+ * its <level> and, with CONFIG_PRINTK_TIME, [seconds.micros] prefixes.
+ */
+void oops_raw_line(const char *text, int len)
+{
+    const char *end = text + len, *p;
+    unsigned long sec, usec;
+    uint64_t ts_nsec = 0;
+
+    if (len >= 3 && text[0] == '<' && text[2] == '>')
+        text += 3;
+
+    if (text < end && *text == '[' && (p = memchr(text, ']', end - text)) &&
+            sscanf(text, "[%lu.%lu]", &sec, &usec) == 2) {
+        ts_nsec = sec * 1000000000ULL + usec * 1000ULL;
+        text = p + 1;
+        if (text < end && *text == ' ')
+            text++;
+    }
+
+    oops_record(ts_nsec, 0, text, end - text);
+}
+
+int oops_open(const char *path)
+{
+    memset(&oops, 0, sizeof(oops));
+
+    if (!strcmp(path, "-")) {
+        oops.fp = stdout;
+        return 0;
+    }
+
+    if (!(oops.fp = fopen(path, "w"))) {
+        pr_err("Cannot create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write out the report the log ended in, and return how many were found.
+ */
+unsigned long oops_close(void)
+{
+    if (!oops.fp)
+        return 0;
+
+    oops_emit();
+
+    if (oops.fp == stdout)
+        fflush(oops.fp);
+    else
+        fclose(oops.fp);
+    oops.fp = NULL;
+
+    if (KDEBUG(1))
+        pr_debug("oops: %lu crash reports", oops.nr_reports);
+    return oops.nr_reports;
+}
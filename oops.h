@@ -0,0 +1,35 @@
+/* oops.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __OOPS_H__
+#define __OOPS_H__
+
+#include <stdint.h>
+
+#define OOPS_TITLE_MAX      (256)
+#define OOPS_FIELD_MAX      (128)
+#define OOPS_FRAMES_MAX     (32)
+#define OOPS_LINES_MAX      (256)   /* lines a report spans at most */
+
+/* printk caller_id: CPU number if this bit is set, PID otherwise */
+#define OOPS_CALLER_CPU     (0x80000000)
+
+int oops_open(const char *path);
+void oops_record(uint64_t ts_nsec, uint32_t caller_id, const char *text,
+        int len);
+void oops_raw_line(const char *text, int len);
+unsigned long oops_close(void);
+
+#endif
@@ -16,12 +16,18 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "xutil.h"
 #include "client.h"
 #include "log.h"
 #include "defs.h"
 #include "printk.h"
+#include "btf.h"
+#include "vmcoreinfo.h"
+#include "spsc.h"
+#include "oops.h"
+#include "stats.h"
 
 #define DESC_SV_BITS		(sizeof(unsigned long) * 8)
 #define DESC_FLAGS_SHIFT	(DESC_SV_BITS - 2)
@@ -38,102 +44,153 @@ enum desc_state {
     desc_reusable	= 0x3,	/* free, not yet used by any writer */
 };
 
-static char *vmcoreinfo_buf = NULL;
-
-char *vmcoreinfo_read_string(const char *key)
+/*
+ * Struct layouts come from BTF when a vmlinux or --btf provided it, and
+ * from the OFFSET()/SIZE() entries of VMCOREINFO otherwise.  Returns -1
+ * when neither knows the field.
+ */
+long datatype_info(char *name, char *member, int datatype)
 {
-    const char *buf = vmcoreinfo_buf;
-    char *value_string = NULL;
-    char *p1, *p2;
-    size_t value_length;
-    char keybuf[80] = {0};
+    char buf[64];
+    long value = -1;
 
-    snprintf(keybuf, sizeof(keybuf), "%s=", key);
-
-    if ((p1 = strstr(buf, keybuf))) {
-        p2 = p1 + strlen(keybuf);
-        p1 = strstr(p2, "\n");
-        value_length = p1 - p2;
-        value_string = xcalloc(value_length + 1, sizeof(char));
-        strncpy(value_string, p2, value_length);
-        value_string[value_length] = '\0';
+    if (btf_loaded()) {
+        if (datatype == STRUCT_SIZE_REQUEST)
+            value = btf_struct_size(name);
+        else if (datatype == MEMBER_OFFSET_REQUEST)
+            value = btf_member_offset(name, member);
+        if (value >= 0)
+            return value;
     }
 
-    return value_string;
-}
-
-long datatype_info(char *name, char *member, int datatype)
-{
-    char buf[64] = {0};
-    char *value_string;
-    char *endptr;
-    long value  = 0;
-
-    if (datatype == STRUCT_SIZE_REQUEST){
+    if (datatype == STRUCT_SIZE_REQUEST)
         snprintf(buf, sizeof(buf), "SIZE(%s)", name);
-    } else if (datatype == MEMBER_OFFSET_REQUEST) {
+    else if (datatype == MEMBER_OFFSET_REQUEST)
         snprintf(buf, sizeof(buf), "OFFSET(%s.%s)", name, member);
-    }
+    else
+        return -1;
 
-    if (strlen(buf)) {
-        value_string = vmcoreinfo_read_string(buf);
-        if (value_string) {
-            value = strtol(value_string, &endptr, 10);
-            xfree(value_string);
-        }
-   }
+    if (vmcoreinfo_number(buf, &value))
+        value = -1;
 
     return value;
 }
 
-void vmcoreinfo_init()
-{
-    char *buf;
-    size_t vmcoreinfo_size;
-    ulong vmcoreinfo_data;
-    ulong osrelease;
-
-    // ASCII value of "OSRELEAS"
-    // crash> rd vmcoreinfo_data 1
-    // ffffffffbd56ca60:  5341454c4552534f                    OSRELEAS
-    osrelease=0x5341454c4552534f;
-
-    get_symbol_data("vmcoreinfo_size", sizeof(vmcoreinfo_size), &vmcoreinfo_size);
-    vmcoreinfo_size &= ((1<<13) - 1);
+/*
+ * Built-in layouts of the printk structures on x86_64, newest last.  They
+ * fill in what neither BTF nor VMCOREINFO describes, and the fields those
+ * do describe are checked against them.  Fields a layout does not use are
+ * left at 0.
+ */
+struct printk_layout {
+    uint version;               /* first kernel with this layout */
+    const char *name;
+    struct offset_table offsets;
+    struct size_table sizes;
+};
 
-    vmcoreinfo_buf = xmalloc(vmcoreinfo_size + 1);
-    buf = vmcoreinfo_buf;
+#define PRB_LAYOUT_OFFSETS(DESC_RING_SIZE)                          \
+        .prb_desc_ring = 0,                                         \
+        .prb_text_data_ring = (DESC_RING_SIZE),                     \
+        .prb_desc_ring_count_bits = 0,                              \
+        .prb_desc_ring_descs = 8,                                   \
+        .prb_desc_ring_infos = 16,                                  \
+        .prb_desc_ring_head_id = 24,                                \
+        .prb_desc_ring_tail_id = 32,                                \
+        .prb_data_ring_size_bits = 0,                               \
+        .prb_data_ring_data = 8,                                    \
+        .prb_desc_state_var = 0,                                    \
+        .prb_desc_text_blk_lpos = 8,                                \
+        .prb_data_blk_lpos_begin = 0,                               \
+        .prb_data_blk_lpos_next = 8,                                \
+        .printk_info_seq = 0,                                       \
+        .printk_info_ts_nsec = 8,                                   \
+        .printk_info_text_len = 16,                                 \
+        .printk_info_caller_id = 20,                                \
+        .printk_info_dev_info = 24,                                 \
+        .dev_printk_info_subsystem = 0,                             \
+        .dev_printk_info_device = 16,                               \
+        .atomic_long_t_counter = 0
 
-    get_symbol_data("vmcoreinfo_data", sizeof(vmcoreinfo_data), &vmcoreinfo_data);
+#define PRB_LAYOUT_SIZES(DESC_RING_SIZE)                            \
+        .printk_info = 88,                                          \
+        .prb_desc = 24,                                             \
+        .printk_ringbuffer = (DESC_RING_SIZE) + 32 + 8,             \
+        .prb_desc_ring = (DESC_RING_SIZE),                          \
+        .prb_data_ring = 32
 
-    // For legacy kernels like CentOS 3.10.x, the type of vmcoreinfo_data is string array
-    // instead of char pointer, get_symbol_data would simply return the string itself
-    // instead of address, which is not what we want.
-    //
-    // The best way to deal with it is get vmcoreinfo_data data type via tools like
-    // gdb, just like crash utility
-    if (vmcoreinfo_data == osrelease)
+static const struct printk_layout printk_layouts[] = {
     {
-        vmcoreinfo_data = symbol_value("vmcoreinfo_data");
-        vmcoreinfo_data -= kt->relocate;
-    }
+        LINUX(3,5,0), "struct log",
+        .offsets = {
+            .printk_log_ts_nsec = 0,
+            .printk_log_len = 8,
+            .printk_log_text_len = 10,
+        },
+        /* 20 with CONFIG_PRINTK_CALLER (5.1+), VMCOREINFO tells */
+        .sizes = { .printk_log = 16 },
+    },
+    {
+        LINUX(5,10,0), "printk_ringbuffer",
+        .offsets = { PRB_LAYOUT_OFFSETS(40) },
+        .sizes = { PRB_LAYOUT_SIZES(40) },
+    },
+    {
+        /* prb_desc_ring.last_finalized_id */
+        LINUX(5,18,0), "printk_ringbuffer",
+        .offsets = { PRB_LAYOUT_OFFSETS(48) },
+        .sizes = { PRB_LAYOUT_SIZES(48) },
+    },
+};
 
-    if (readmem(vmcoreinfo_data, KVADDR, buf, vmcoreinfo_size)) {
-        pr_err("cannot read vmcoreinfo_data\n");
-        goto err;
+static const struct printk_layout *printk_layout_find()
+{
+    int i;
+
+    for (i = sizeof(printk_layouts) / sizeof(printk_layouts[0]) - 1; i > 0; i--) {
+        if (THIS_KERNEL_VERSION >= printk_layouts[i].version)
+            break;
     }
+    return &printk_layouts[i];
+}
 
-    buf[vmcoreinfo_size] = '\n';
+/*
+ * Fill the fields left unknown from the built-in layout and count those
+ * that disagree with it.  Both tables are plain arrays of longs.
+ */
+static int layout_merge(long *table, const long *builtin, size_t nr,
+        long invalid_below, int *defaults)
+{
+    int differ = 0;
+    size_t i;
 
-    if (KDEBUG(2)) {
-        for (size_t i = 0; i < vmcoreinfo_size; i++) {
-            fprintf(fp, "%c", buf[i]);
+    for (i = 0; i < nr; i++) {
+        if (table[i] < invalid_below) {
+            table[i] = builtin[i];
+            (*defaults)++;
+        } else if (table[i] != builtin[i]) {
+            differ++;
         }
-        fprintf(fp, "\n");
     }
-    return;
-err:
-    xfree(vmcoreinfo_buf);
+    return differ;
+}
+
+static void offsets_fallback()
+{
+    const struct printk_layout *l = printk_layout_find();
+    int defaults = 0, differ;
+
+    differ = layout_merge((long *)&offset_table, (const long *)&l->offsets,
+            sizeof(offset_table) / sizeof(long), 0, &defaults);
+    differ += layout_merge((long *)&size_table, (const long *)&l->sizes,
+            sizeof(size_table) / sizeof(long), 1, &defaults);
+
+    /* the kernel's own values win, the decoder then takes the slow path */
+    if (KDEBUG(1))
+        pr_debug("printk layout: built-in %s (%u.%u+), %d fields defaulted, "
+                "%d differ from %s", l->name, l->version >> 24,
+                (l->version >> 16) & 0xff, defaults, differ,
+                btf_loaded() ? "BTF" : "VMCOREINFO");
 }
 
 static void offsets_init()
@@ -163,6 +220,47 @@ static void offsets_init()
     STRUCT_SIZE_INIT(prb_data_ring, n);
     MEMBER_OFFSET_INIT(prb_data_ring_size_bits, n, "size_bits");
     MEMBER_OFFSET_INIT(prb_data_ring_data, n, "data");
+
+    n = "prb_desc";
+    MEMBER_OFFSET_INIT(prb_desc_state_var, n, "state_var");
+    MEMBER_OFFSET_INIT(prb_desc_text_blk_lpos, n, "text_blk_lpos");
+
+    n = "prb_data_blk_lpos";
+    MEMBER_OFFSET_INIT(prb_data_blk_lpos_begin, n, "begin");
+    MEMBER_OFFSET_INIT(prb_data_blk_lpos_next, n, "next");
+
+    n = "printk_info";
+    MEMBER_OFFSET_INIT(printk_info_seq, n, "seq");
+    MEMBER_OFFSET_INIT(printk_info_ts_nsec, n, "ts_nsec");
+    MEMBER_OFFSET_INIT(printk_info_text_len, n, "text_len");
+    MEMBER_OFFSET_INIT(printk_info_caller_id, n, "caller_id");
+    MEMBER_OFFSET_INIT(printk_info_dev_info, n, "dev_info");
+
+    n = "dev_printk_info";
+    MEMBER_OFFSET_INIT(dev_printk_info_subsystem, n, "subsystem");
+    MEMBER_OFFSET_INIT(dev_printk_info_device, n, "device");
+
+    n = "atomic_long_t";
+    MEMBER_OFFSET_INIT(atomic_long_t_counter, n, "counter");
+
+    n = THIS_KERNEL_VERSION >= LINUX(3,11,0) ? "printk_log" : "log";
+    STRUCT_SIZE_INIT(printk_log, n);
+    MEMBER_OFFSET_INIT(printk_log_ts_nsec, n, "ts_nsec");
+    MEMBER_OFFSET_INIT(printk_log_len, n, "len");
+    MEMBER_OFFSET_INIT(printk_log_text_len, n, "text_len");
+
+    offsets_fallback();
+}
+
+/*
+ * Resolve the printk layout once.  The bootstrap cache restores resolved
+ * tables, in which case there is nothing left to do.
+ */
+void printk_layout_init()
+{
+    if (VALID_SIZE(printk_info) || VALID_SIZE(printk_log))
+        return;
+    offsets_init();
 }
 
 static enum desc_state get_desc_state(unsigned long id,
@@ -174,137 +272,963 @@ static enum desc_state get_desc_state(unsigned long id,
     return DESC_STATE(state_val);
 }
 
-static void dump_record(struct prb_map *m, unsigned long id)
+/*
+ * The ring is read, decoded and written by three stages so that the first
+ * lines reach the terminal after the first batch of descriptors instead of
+ * after the whole ring has been transferred:
+ *
+ *   reader (thread)  ->  decoder (caller)  ->  writer (thread)
+ *
+ * The reader fetches descriptor/info slices in id order together with the
+ * text pages they reference and hands finished batches to the decoder.
+ * The decoder formats records into output chunks for the writer.
+ */
+#define PRB_BATCH_MIN       (8)
+#define PRB_BATCH_MAX       (256)
+#define PRB_QUEUE_SIZE      (64)
+#define PRB_OUTBUF_SIZE     (128 * 1024)
+#define PRB_TEXT_GAP_MAX    (PAGE_SIZE)
+#define PRB_REREAD_MAX      (3)
+
+/* a stretch [begin, next) of the data ring, copied to the batch at off */
+struct prb_text_run {
+    unsigned long begin;
+    unsigned long next;
+    unsigned long off;
+};
+
+/*
+ * The descriptors and infos of a batch have their own ring slots, but text
+ * blocks of a ring that wrapped while it was read may land where an older
+ * batch's text was, so each batch owns a copy of its text.
+ */
+struct prb_batch {
+    unsigned long id;       /* first descriptor id */
+    unsigned long nr;       /* number of descriptors, 0 ends the stream */
+
+    struct prb_text_run *runs;
+    unsigned long nr_runs;
+    char *text;
+    unsigned long text_size;
+};
+
+struct prb_outbuf {
+    size_t len;
+    char data[PRB_OUTBUF_SIZE];
+};
+
+struct prb_pipeline {
+    struct prb_map *m;
+    struct spsc_queue batches;
+    struct spsc_queue outbufs;
+    int error;
+};
+
+/*
+ * The per-record helpers take the layout as an argument and are always
+ * inlined.  Called with &prb_builtin_layout the offsets and strides become
+ * constants; with &m->layout they are loaded once per batch.
+ */
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+
+static const struct prb_record_layout prb_builtin_layout = {
+    .desc_size = sizeof(struct prb_desc),
+    .desc_state_var = offsetof(struct prb_desc, state_var) +
+        offsetof(atomic_long_t, counter),
+    .desc_lpos_begin = offsetof(struct prb_desc, text_blk_lpos) +
+        offsetof(struct prb_data_blk_lpos, begin),
+    .desc_lpos_next = offsetof(struct prb_desc, text_blk_lpos) +
+        offsetof(struct prb_data_blk_lpos, next),
+    .info_size = sizeof(struct printk_info),
+    .info_ts_nsec = offsetof(struct printk_info, ts_nsec),
+    .info_text_len = offsetof(struct printk_info, text_len),
+    .info_caller_id = offsetof(struct printk_info, caller_id),
+    .info_facility = offsetof(struct printk_info, facility),
+    .info_dev_subsystem = offsetof(struct printk_info, dev_info) +
+        offsetof(struct dev_printk_info, subsystem),
+    .info_dev_device = offsetof(struct printk_info, dev_info) +
+        offsetof(struct dev_printk_info, device),
+};
+
+static void prb_layout_init(struct prb_map *m)
+{
+    struct prb_record_layout *l = &m->layout;
+
+    l->desc_size = SIZE(prb_desc);
+    l->desc_state_var = OFFSET(prb_desc_state_var) +
+        OFFSET(atomic_long_t_counter);
+    l->desc_lpos_begin = OFFSET(prb_desc_text_blk_lpos) +
+        OFFSET(prb_data_blk_lpos_begin);
+    l->desc_lpos_next = OFFSET(prb_desc_text_blk_lpos) +
+        OFFSET(prb_data_blk_lpos_next);
+    l->info_size = SIZE(printk_info);
+    l->info_ts_nsec = OFFSET(printk_info_ts_nsec);
+    l->info_text_len = OFFSET(printk_info_text_len);
+    l->info_caller_id = OFFSET(printk_info_caller_id);
+    /* not in VMCOREINFO, but right after text_len since 5.10 */
+    l->info_facility = OFFSET(printk_info_text_len) + sizeof(uint16_t);
+    l->info_dev_subsystem = OFFSET(printk_info_dev_info) +
+        OFFSET(dev_printk_info_subsystem);
+    l->info_dev_device = OFFSET(printk_info_dev_info) +
+        OFFSET(dev_printk_info_device);
+    if (l->info_dev_subsystem + (long)DEV_PRINTK_SUBSYSTEM_LEN > l->info_size ||
+            l->info_dev_device + (long)DEV_PRINTK_DEVICE_LEN > l->info_size)
+        l->info_dev_subsystem = l->info_dev_device = -1;
+
+    m->builtin_layout = !memcmp(l, &prb_builtin_layout, sizeof(*l));
+
+    if (KDEBUG(1))
+        pr_debug("prb: %s record layout", m->builtin_layout ?
+                "built-in" : "generic");
+}
+
+static __always_inline char *prb_desc_ptr(struct prb_map *m, unsigned long id,
+        const struct prb_record_layout *l)
+{
+    return m->descs + ((id % m->desc_ring_count) * l->desc_size);
+}
+
+static __always_inline char *prb_info_ptr(struct prb_map *m, unsigned long id,
+        const struct prb_record_layout *l)
+{
+    return m->infos + ((id % m->desc_ring_count) * l->info_size);
+}
+
+/*
+ * Return the offsets of the text block of a committed record inside the
+ * data ring, or -1 if the record has no readable text.
+ */
+static __always_inline int prb_text_span(struct prb_map *m, unsigned long id,
+        unsigned long *begin, unsigned long *next,
+        const struct prb_record_layout *l)
 {
-    unsigned short text_len;
     unsigned long state_var;
-    char *desc, *info, *text, *p;
     enum desc_state state;
+    char *desc;
+
+    desc = prb_desc_ptr(m, id, l);
+
+    state_var = ULONG(desc + l->desc_state_var);
+    state = get_desc_state(id, state_var);
+
+    if (state != desc_committed && state != desc_finalized)
+        return -1;
+
+    *begin = ULONG(desc + l->desc_lpos_begin) % m->text_data_ring_size;
+    *next = ULONG(desc + l->desc_lpos_next) % m->text_data_ring_size;
+
+    if (*begin > *next)
+        *begin = 0;
+
+    return 0;
+}
+
+static size_t outbuf_room(struct prb_outbuf *ob)
+{
+    return PRB_OUTBUF_SIZE - ob->len;
+}
+
+/*
+ * The text of the block [begin, next), from the run read last that holds
+ * it: a record read again has its new text in a run of its own.
+ */
+static char *prb_batch_text(struct prb_batch *b, unsigned long begin,
+        unsigned long next)
+{
+    struct prb_text_run *r;
+    unsigned long i;
+
+    for (i = b->nr_runs; i > 0; i--) {
+        r = &b->runs[i - 1];
+        if (begin >= r->begin && next <= r->next)
+            return b->text + r->off + (begin - r->begin);
+    }
+    return NULL;
+}
+
+static __always_inline void dump_record(struct prb_map *m,
+        struct prb_batch *b, unsigned long id, struct prb_outbuf *ob,
+        const struct prb_record_layout *l)
+{
+    unsigned short text_len;
+    char *info, *text, *p, *out;
     unsigned long begin;
     unsigned long next;
     uint64_t ts_nsec;
     unsigned long long nanos;
     unsigned long rem;
-    char buf[1024];
+    size_t n;
+    long room;
     int i;
 
-    desc = m->descs + ((id % m->desc_ring_count) * sizeof(struct prb_desc));
-
-    state_var = ULONG(desc + offsetof(struct prb_desc, state_var) +
-            offsetof(atomic_long_t, counter));
-    state = get_desc_state(id, state_var);
-
-    if (state != desc_committed && state != desc_finalized)
+    if (prb_text_span(m, id, &begin, &next, l))
         return;
 
-    info = m->infos + ((id % m->desc_ring_count) * sizeof(struct printk_info));
+    out = ob->data + ob->len;
 
-    text_len = USHORT(info + offsetof(struct printk_info, text_len));
+    if (begin == next || !(text = prb_batch_text(b, begin, next)))
+        goto out;
 
-    begin = ULONG(desc + offsetof(struct prb_desc, text_blk_lpos) +
-            offsetof(struct prb_data_blk_lpos, begin)) % m->text_data_ring_size;
-    next = ULONG(desc + offsetof(struct prb_desc, text_blk_lpos) +
-            offsetof(struct prb_data_blk_lpos, next)) % m->text_data_ring_size;
+    info = prb_info_ptr(m, id, l);
 
-    if (begin == next)
-        goto out;
+    text_len = USHORT(info + l->info_text_len);
 
-    ts_nsec = ULONGLONG(info + offsetof(struct printk_info, ts_nsec));
+    ts_nsec = ULONGLONG(info + l->info_ts_nsec);
     nanos = (unsigned long long)ts_nsec / (unsigned long long)1000000000;
     rem = (unsigned long long)ts_nsec % (unsigned long long)1000000000;
-    snprintf(buf, sizeof(buf), "[%5lld.%06ld] ", nanos, rem/1000);
-    fprintf(fp, "%s", buf);
-
-    if (begin > next)
-        begin = 0;
+    out += snprintf(out, outbuf_room(ob), "[%5lld.%06ld] ", nanos, rem/1000);
 
     begin += sizeof(unsigned long);
+    text += sizeof(unsigned long);
 
     if (next - begin < text_len)
         text_len = next - begin;
 
-    text = m->text_data + begin;
+    if (pc->flags & OOPS_REPORT)
+        oops_record(ts_nsec, UINT(info + l->info_caller_id), text, text_len);
 
     for (i = 0, p = text; i < text_len; i++, p++) {
+        if (*p == '[' && (pc->flags & SYMBOLIZE)) {
+            /* leave room for the rest of the text after the rewrite */
+            room = ob->data + PRB_OUTBUF_SIZE - out - (text_len - i) - 1;
+            if (room > 0 && (n = symbolize_address(p, text_len - i, out,
+                            room))) {
+                out += n;
+                i += SYMBOLIZE_ADDR_LEN - 1;
+                p += SYMBOLIZE_ADDR_LEN - 1;
+                continue;
+            }
+        }
         if (*p == '\n')
-            fprintf(fp, "\n");
+            *out++ = '\n';
         else if (isprint(*p) || isspace(*p))
-            fputc(*p, fp);
+            *out++ = *p;
         else
-            fputc('.', fp);
+            *out++ = '.';
     }
 
 out:
-    fprintf(fp, "\n");
+    *out++ = '\n';
+    ob->len = out - ob->data;
 }
 
-void dump_lockless_record_log()
+/*
+ * --stats-only: what the info says about the record, and its text if it
+ * was read.
+ */
+static __always_inline void prb_stats_record(struct prb_map *m,
+        struct prb_batch *b, unsigned long id,
+        const struct prb_record_layout *l)
 {
-    unsigned long head_id;
-    unsigned long tail_id;
-    unsigned long kaddr;
-    unsigned long id;
-    struct prb_map m;
+    unsigned long begin, next;
+    unsigned short text_len = 0;
+    char *info, *text = NULL;
+
+    if (prb_text_span(m, id, &begin, &next, l))
+        return;
 
-    if (SIZE(printk_info) == 0) {
-        offsets_init();
+    info = prb_info_ptr(m, id, l);
+
+    if (begin != next && (text = prb_batch_text(b, begin, next))) {
+        begin += sizeof(unsigned long);
+        text += sizeof(unsigned long);
+        text_len = USHORT(info + l->info_text_len);
+        if (next - begin < text_len)
+            text_len = next - begin;
     }
 
-    get_symbol_data("prb", sizeof(char *), &kaddr);
-    m.prb = xmalloc(SIZE(printk_ringbuffer));
+    stats_record(ULONGLONG(info + l->info_ts_nsec),
+            UCHAR(info + l->info_facility + 1) >> 5,
+            UCHAR(info + l->info_facility),
+            l->info_dev_subsystem < 0 ? NULL : info + l->info_dev_subsystem,
+            DEV_PRINTK_SUBSYSTEM_LEN,
+            l->info_dev_device < 0 ? NULL : info + l->info_dev_device,
+            DEV_PRINTK_DEVICE_LEN,
+            text, text_len);
+}
 
-    if (readmem(kaddr, KVADDR, m.prb, SIZE(printk_ringbuffer))) {
-        pr_err("Cannot read printk_ringbuffer contents");
-        goto out_prb;
+/*
+ * Read descriptors or infos [id, id + nr) into their ring slots, splitting
+ * the transfer where the slice wraps around the end of the array.
+ */
+static int prb_read_slice(struct prb_map *m, unsigned long kaddr, char *array,
+        size_t stride, unsigned long id, unsigned long nr)
+{
+    unsigned long idx = id % m->desc_ring_count;
+    unsigned long n;
+
+    while (nr) {
+        n = m->desc_ring_count - idx;
+        if (n > nr)
+            n = nr;
+        if (readmem(kaddr + idx * stride, KVADDR, array + idx * stride,
+                    n * stride))
+            return -1;
+        nr -= n;
+        idx = 0;
     }
 
-    m.desc_ring = m.prb + OFFSET(prb_desc_ring);
-    m.desc_ring_count = 1 << UINT(m.desc_ring + OFFSET(prb_desc_ring_count_bits));
+    return 0;
+}
 
-    kaddr = ULONG(m.desc_ring + OFFSET(prb_desc_ring_descs));
-    m.descs = xmalloc(SIZE(prb_desc) * m.desc_ring_count);
+/*
+ * Read the text blocks [begin, next) of the data ring into a new run at the
+ * end of the batch's text.
+ */
+static int prb_read_text(struct prb_map *m, struct prb_batch *b,
+        unsigned long begin, unsigned long next)
+{
+    struct prb_text_run *r;
 
-    if (readmem(kaddr, KVADDR, m.descs, SIZE(prb_desc) * m.desc_ring_count)) {
-        pr_err("Cannot read prb_desc_ring contents");
-        goto out_descs;
+    b->runs = xrealloc(b->runs, (b->nr_runs + 1) * sizeof(*r));
+    r = &b->runs[b->nr_runs++];
+    r->begin = begin;
+    r->next = next;
+    r->off = b->text_size;
+
+    b->text_size += next - begin;
+    b->text = xrealloc(b->text, b->text_size);
+
+    return readmem(m->text_data_kaddr + begin, KVADDR, b->text + r->off,
+            next - begin);
+}
+
+/*
+ * Fetch the text of records [id, id + nr).  Consecutive records have
+ * consecutive blocks, so the batch is read as one run per stretch of the
+ * ring, taking small gaps (records without readable text) along.  All of
+ * it is read after the batch's descriptors, which prb_validate_batch()
+ * relies on, into the batch's own buffer.
+ */
+static __always_inline int prb_fetch_batch_text(struct prb_map *m,
+        struct prb_batch *b, const struct prb_record_layout *l)
+{
+    unsigned long id = b->id, nr = b->nr;
+    unsigned long begin, next, run_begin = 0, run_next = 0, i;
+
+    for (i = 0; i < nr; i++, id = (id + 1) & DESC_ID_MASK) {
+        if (prb_text_span(m, id, &begin, &next, l) || begin == next)
+            continue;
+
+        if (run_next && begin >= run_begin &&
+                begin <= run_next + PRB_TEXT_GAP_MAX) {
+            if (next > run_next)
+                run_next = next;
+            continue;
+        }
+
+        if (run_next && prb_read_text(m, b, run_begin, run_next))
+            return -1;
+        run_begin = begin;
+        run_next = next;
     }
 
-    kaddr = ULONG(m.desc_ring + OFFSET(prb_desc_ring_infos));
-    m.infos = xmalloc(SIZE(printk_info) * m.desc_ring_count);
+    if (run_next && prb_read_text(m, b, run_begin, run_next))
+        return -1;
+    return 0;
+}
 
-    if (readmem(kaddr, KVADDR, m.infos, SIZE(printk_info) * m.desc_ring_count)) {
-        pr_err("Cannot read prb_info_ring contents");
-        goto out_infos;
+static __always_inline int prb_desc_changed(const char *desc,
+        const char *check, const struct prb_record_layout *l)
+{
+    return ULONG(desc + l->desc_state_var) !=
+            ULONG(check + l->desc_state_var) ||
+        ULONG(desc + l->desc_lpos_begin) != ULONG(check + l->desc_lpos_begin) ||
+        ULONG(desc + l->desc_lpos_next) != ULONG(check + l->desc_lpos_next);
+}
+
+/*
+ * The descriptor of id changed while its record was being read.  As long
+ * as it still belongs to id and is committed (it was finalized, or had a
+ * continuation line appended) read the record again; otherwise it was
+ * recycled and is dropped.  Returns 0 when the record is readable.
+ */
+static int prb_reread_record(struct prb_map *m, struct prb_batch *b,
+        unsigned long id)
+{
+    const struct prb_record_layout *l = &m->layout;
+    unsigned long idx = id % m->desc_ring_count;
+    unsigned long begin, next;
+    char *desc = prb_desc_ptr(m, id, l);
+    char *check = m->descs_check + idx * l->desc_size;
+    int try;
+
+    for (try = 0; try < PRB_REREAD_MAX; try++) {
+        memcpy(desc, check, l->desc_size);
+
+        if (prb_text_span(m, id, &begin, &next, l)) {
+            /* reopened by a writer appending to it */
+            if (get_desc_state(id, ULONG(desc + l->desc_state_var)) !=
+                    desc_reserved ||
+                    readmem(m->descs_kaddr + idx * l->desc_size, KVADDR,
+                        check, l->desc_size))
+                break;
+            continue;
+        }
+
+        if (readmem(m->infos_kaddr + idx * l->info_size, KVADDR,
+                    prb_info_ptr(m, id, l), l->info_size) ||
+                (begin < next && m->read_text &&
+                 prb_read_text(m, b, begin, next)) ||
+                readmem(m->descs_kaddr + idx * l->desc_size, KVADDR,
+                    check, l->desc_size))
+            break;
+
+        if (!prb_desc_changed(desc, check, l))
+            return 0;
+    }
+
+    /* a state_var of 0 is never committed, whatever the id */
+    ULONG(desc + l->desc_state_var) = 0;
+    return -1;
+}
+
+/*
+ * The guest keeps writing while the ring is read.  Like a seqlock reader,
+ * read the descriptors of the batch once more after their infos and text:
+ * a writer recycling a record changes its descriptor before it touches the
+ * info or the text, so a record whose state_var and text_blk_lpos did not
+ * change was read consistently.  Only the records that did change cost
+ * more reads.
+ */
+static int prb_validate_batch(struct prb_map *m, struct prb_batch *b)
+{
+    const struct prb_record_layout *l = &m->layout;
+    unsigned long id = b->id, nr = b->nr;
+    unsigned long begin, next, i;
+    char *desc, *check;
+    int was_readable;
+
+    if (prb_read_slice(m, m->descs_kaddr, m->descs_check, l->desc_size,
+                id, nr))
+        return -1;
+
+    for (i = 0; i < nr; i++, id = (id + 1) & DESC_ID_MASK) {
+        desc = prb_desc_ptr(m, id, l);
+        check = m->descs_check + (id % m->desc_ring_count) * l->desc_size;
+        if (!prb_desc_changed(desc, check, l))
+            continue;
+
+        was_readable = !prb_text_span(m, id, &begin, &next, l);
+        if (!prb_reread_record(m, b, id))
+            m->reread++;
+        else if (was_readable)
+            m->torn++;
     }
 
-    m.text_data_ring = m.prb + OFFSET(prb_text_data_ring);
-    m.text_data_ring_size = 1 << UINT(m.text_data_ring + OFFSET(prb_data_ring_size_bits));
+    return 0;
+}
+
+static int prb_read_batch(struct prb_map *m, struct prb_batch *b)
+{
+    unsigned long id = b->id, nr = b->nr;
+    int ret;
+
+    if (prb_read_slice(m, m->descs_kaddr, m->descs, m->layout.desc_size,
+                id, nr)) {
+        pr_err("Cannot read prb_desc_ring contents");
+        return -1;
+    }
 
-    kaddr = ULONG(m.text_data_ring + OFFSET(prb_data_ring_data));
-    m.text_data = xmalloc(m.text_data_ring_size);
+    if (prb_read_slice(m, m->infos_kaddr, m->infos, m->layout.info_size,
+                id, nr)) {
+        pr_err("Cannot read prb_info_ring contents");
+        return -1;
+    }
 
-    if (readmem(kaddr, KVADDR, m.text_data, m.text_data_ring_size)) {
+    /* --stats-only without --stats-top: the infos are all it takes */
+    if (!m->read_text)
+        ret = 0;
+    else if (m->builtin_layout)
+        ret = prb_fetch_batch_text(m, b, &prb_builtin_layout);
+    else
+        ret = prb_fetch_batch_text(m, b, &m->layout);
+    if (ret) {
         pr_err("Cannot read prb_text_data_ring contents");
-        goto out_text_data;
+        return -1;
+    }
+
+    if (prb_validate_batch(m, b)) {
+        pr_err("Cannot read prb_desc_ring contents");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void prb_batch_free(struct prb_batch *b)
+{
+    xfree(b->text);
+    xfree(b->runs);
+    xfree(b);
+}
+
+static void *prb_reader_thread(void *arg)
+{
+    struct prb_pipeline *pl = arg;
+    struct prb_map *m = pl->m;
+    struct prb_batch *b;
+    unsigned long id, left, batch = PRB_BATCH_MIN;
+
+    id = m->tail_id;
+    left = ((m->head_id - m->tail_id) & DESC_ID_MASK) + 1;
+    if (left > m->desc_ring_count)
+        left = m->desc_ring_count;
+
+    while (left) {
+        b = xmalloc(sizeof(*b));
+        b->id = id;
+        b->nr = left < batch ? left : batch;
+
+        if (prb_read_batch(m, b)) {
+            pl->error = 1;
+            prb_batch_free(b);
+            break;
+        }
+
+        id = (id + b->nr) & DESC_ID_MASK;
+        left -= b->nr;
+        spsc_push_wait(&pl->batches, b);
+
+        /* Small batches first so that the first lines show up quickly */
+        if (batch < PRB_BATCH_MAX)
+            batch <<= 1;
+    }
+
+    b = xmalloc(sizeof(*b));
+    b->nr = 0;
+    spsc_push_wait(&pl->batches, b);
+
+    return NULL;
+}
+
+static void *prb_writer_thread(void *arg)
+{
+    struct prb_pipeline *pl = arg;
+    struct prb_outbuf *ob;
+
+    while ((ob = spsc_pop_wait(&pl->outbufs))->len) {
+        fwrite(ob->data, 1, ob->len, fp);
+        fflush(fp);
+        xfree(ob);
+    }
+    xfree(ob);
+
+    return NULL;
+}
+
+static struct prb_outbuf *prb_outbuf_flush(struct prb_pipeline *pl,
+        struct prb_outbuf *ob)
+{
+    if (ob->len) {
+        spsc_push_wait(&pl->outbufs, ob);
+        ob = xmalloc(sizeof(*ob));
+    }
+    return ob;
+}
+
+static __always_inline struct prb_outbuf *prb_decode_batch(
+        struct prb_pipeline *pl, struct prb_batch *b, struct prb_outbuf *ob,
+        const struct prb_record_layout *l)
+{
+    unsigned long id, i;
+
+    for (i = 0, id = b->id; i < b->nr; i++, id = (id + 1) & DESC_ID_MASK) {
+        if (pc->flags & STATS_ONLY) {
+            prb_stats_record(pl->m, b, id, l);
+            continue;
+        }
+        /* One record expands to at most text_len plus a prefix */
+        if (outbuf_room(ob) < 0x10000 + 64)
+            ob = prb_outbuf_flush(pl, ob);
+        dump_record(pl->m, b, id, ob, l);
+    }
+    return ob;
+}
+
+static void prb_decode(struct prb_pipeline *pl)
+{
+    struct prb_map *m = pl->m;
+    struct prb_outbuf *ob;
+    struct prb_batch *b;
+
+    ob = xmalloc(sizeof(*ob));
+
+    while ((b = spsc_pop_wait(&pl->batches))->nr) {
+        if (m->builtin_layout)
+            ob = prb_decode_batch(pl, b, ob, &prb_builtin_layout);
+        else
+            ob = prb_decode_batch(pl, b, ob, &m->layout);
+        ob = prb_outbuf_flush(pl, ob);
+        prb_batch_free(b);
     }
+    prb_batch_free(b);
 
-    tail_id = ULONG(m.desc_ring + OFFSET(prb_desc_ring_tail_id) +
-            offsetof(atomic_long_t, counter));
-    head_id = ULONG(m.desc_ring + OFFSET(prb_desc_ring_head_id) +
-            offsetof(atomic_long_t, counter));
+    /* An empty chunk terminates the writer */
+    ob->len = 0;
+    spsc_push_wait(&pl->outbufs, ob);
+}
 
-    for (id = tail_id; id != head_id; id = (id + 1) & DESC_ID_MASK) {
-        dump_record(&m, id);
+static void prb_run_pipeline(struct prb_map *m)
+{
+    struct prb_pipeline pl = { .m = m };
+    pthread_t reader, writer;
+    int reader_started;
+
+    spsc_init(&pl.batches, PRB_QUEUE_SIZE);
+    spsc_init(&pl.outbufs, PRB_QUEUE_SIZE);
+
+    if (pthread_create(&writer, NULL, prb_writer_thread, &pl)) {
+        pr_err("Cannot create writer thread");
+        goto out;
     }
 
-    dump_record(&m, id);
+    reader_started = !pthread_create(&reader, NULL, prb_reader_thread, &pl);
+    if (!reader_started) {
+        pr_err("Cannot create reader thread");
+        spsc_push_wait(&pl.batches, xcalloc(1, sizeof(struct prb_batch)));
+    }
+
+    prb_decode(&pl);
+
+    if (reader_started)
+        pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    if (pl.error)
+        pr_err("printk ringbuffer was only partially read");
+out:
+    spsc_destroy(&pl.batches);
+    spsc_destroy(&pl.outbufs);
+}
+
+static struct prb_map prb_map;
+static int prb_map_ready = FALSE;
+
+/*
+ * Read the printk_ringbuffer header.  This only needs the prb symbol and
+ * the VMCOREINFO layout, so startup issues it as soon as those are known.
+ */
+int prb_prefetch()
+{
+    struct prb_map *m = &prb_map;
+    unsigned long kaddr;
+
+    if (prb_map_ready)
+        return 0;
+
+    printk_layout_init();
+    prb_layout_init(m);
+
+    if (!kt->prb)
+        get_symbol_data("prb", sizeof(char *), &kt->prb);
+    kaddr = kt->prb;
+    m->prb = xmalloc(SIZE(printk_ringbuffer));
+
+    if (readmem(kaddr, KVADDR, m->prb, SIZE(printk_ringbuffer))) {
+        pr_err("Cannot read printk_ringbuffer contents");
+        xfree(m->prb);
+        return -1;
+    }
+
+    m->desc_ring = m->prb + OFFSET(prb_desc_ring);
+    m->desc_ring_count = 1 << UINT(m->desc_ring + OFFSET(prb_desc_ring_count_bits));
+    m->descs_kaddr = ULONG(m->desc_ring + OFFSET(prb_desc_ring_descs));
+    m->infos_kaddr = ULONG(m->desc_ring + OFFSET(prb_desc_ring_infos));
+    m->descs = xmalloc(m->layout.desc_size * m->desc_ring_count);
+    m->descs_check = xmalloc(m->layout.desc_size * m->desc_ring_count);
+    m->infos = xmalloc(m->layout.info_size * m->desc_ring_count);
+
+    m->text_data_ring = m->prb + OFFSET(prb_text_data_ring);
+    m->text_data_ring_size = 1 << UINT(m->text_data_ring + OFFSET(prb_data_ring_size_bits));
+    m->text_data_kaddr = ULONG(m->text_data_ring + OFFSET(prb_data_ring_data));
+    m->read_text = (pc->flags & (STATS_ONLY | STATS_TEXT)) != STATS_ONLY;
+
+    m->tail_id = ULONG(m->desc_ring + OFFSET(prb_desc_ring_tail_id) +
+            OFFSET(atomic_long_t_counter));
+    m->head_id = ULONG(m->desc_ring + OFFSET(prb_desc_ring_head_id) +
+            OFFSET(atomic_long_t_counter));
+    m->reread = m->torn = 0;
+
+    prb_map_ready = TRUE;
+    return 0;
+}
+
+void dump_lockless_record_log()
+{
+    struct prb_map *m = &prb_map;
+
+    if (prb_prefetch())
+        return;
+
+    prb_run_pipeline(m);
+
+    if (m->torn)
+        pr_warning("records overwritten while being read: %lu",
+                m->torn);
+    if (KDEBUG(1))
+        pr_debug("prb: %lu records read again, %lu torn records dropped",
+                m->reread, m->torn);
+
+    xfree(m->infos);
+    xfree(m->descs_check);
+    xfree(m->descs);
+    xfree(m->prb);
+    prb_map_ready = FALSE;
+}
 
-out_text_data:
-    xfree(m.text_data);
-out_infos:
-    xfree(m.infos);
-out_descs:
-    xfree(m.descs);
-out_prb:
-    xfree(m.prb);
+/*
+ * Where the log's writer position lives: prb.desc_ring.head_id, or
+ * log_next_idx (log_end before 3.5).  A poller that finds the value there
+ * unchanged has nothing new to read.  Once the ring header is read the
+ * value is the head the decode starts from, so anything logged during the
+ * read still shows up as a change the next time.
+ */
+int printk_head(ulong *kaddr, ulong *size, ulong *value)
+{
+    *value = 0;
+
+    if (kernel_symbol_exists("prb")) {
+        if (!kt->prb)
+            get_symbol_data("prb", sizeof(char *), &kt->prb);
+        *kaddr = kt->prb + OFFSET(prb_desc_ring) +
+            OFFSET(prb_desc_ring_head_id) + OFFSET(atomic_long_t_counter);
+        *size = sizeof(ulong);
+        if (prb_map_ready) {
+            *value = prb_map.head_id;
+            return 0;
+        }
+    } else if (kernel_symbol_exists("log_next_idx")) {
+        *kaddr = relocate(symbol_value("log_next_idx"));
+        *size = sizeof(uint32_t);
+    } else if (kernel_symbol_exists("log_end")) {
+        *kaddr = relocate(symbol_value("log_end"));
+        *size = sizeof(uint);
+    } else {
+        return -1;
+    }
+
+    return readmem(*kaddr, KVADDR, value, *size);
+}
+
+/*
+ * Where a counter of the records logged so far lives, for telling how fast
+ * a guest logs without reading its log: prb.desc_ring.head_id, which wraps
+ * within DESC_ID_MASK, or log_next_seq (3.5 - 5.9).  Before 3.5 only the
+ * characters are counted.
+ */
+int printk_seq(ulong *kaddr, ulong *size, ulong *mask)
+{
+    if (kernel_symbol_exists("prb")) {
+        if (!kt->prb)
+            get_symbol_data("prb", sizeof(char *), &kt->prb);
+        *kaddr = kt->prb + OFFSET(prb_desc_ring) +
+            OFFSET(prb_desc_ring_head_id) + OFFSET(atomic_long_t_counter);
+        *size = sizeof(ulong);
+        *mask = DESC_ID_MASK;
+    } else if (kernel_symbol_exists("log_next_seq")) {
+        *kaddr = relocate(symbol_value("log_next_seq"));
+        *size = sizeof(uint64_t);
+        *mask = ~0UL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The variable length record buffer of 3.5 - 5.9.  As for the lockless
+ * ringbuffer the record helpers are specialized for the built-in layout.
+ */
+struct log_record_layout {
+    long size;                  /* the text follows the header */
+    long ts_nsec;
+    long len;
+    long text_len;
+};
+
+static const struct log_record_layout log_builtin_layout = {
+    .size = sizeof(struct log),
+    .ts_nsec = offsetof(struct log, ts_nsec),
+    .len = offsetof(struct log, len),
+    .text_len = offsetof(struct log, text_len),
+};
+
+static __always_inline char *log_from_idx(uint32_t idx, char *logbuf,
+        const struct log_record_layout *l)
+{
+    char *logptr;
+    uint16_t msglen;
+
+    logptr = logbuf + idx;
+
+    msglen = USHORT(logptr + l->len);
+    if (!msglen)
+        logptr = logbuf;
+
+    return logptr;
+}
+
+static __always_inline uint32_t log_next(uint32_t idx, char *logbuf,
+        const struct log_record_layout *l)
+{
+    char *logptr;
+    uint16_t msglen;
+
+    logptr = logbuf + idx;
+
+    msglen = USHORT(logptr + l->len);
+    if (!msglen) {
+        msglen = USHORT(logbuf + l->len);
+        return msglen;
+    }
+
+    return idx + msglen;
+}
+
+static __always_inline void dump_log_entry(char *logptr,
+        const struct log_record_layout *l)
+{
+    char *msg, *p;
+    uint16_t i, text_len;
+    uint64_t ts_nsec;
+    ulonglong nanos;
+    ulong rem;
+    char buf[64];
+    char sym[KSYM_NAME_LEN + 64];
+
+    text_len = USHORT(logptr + l->text_len);
+
+    ts_nsec = ULONGLONG(logptr + l->ts_nsec);
+    msg = logptr + l->size;
+
+    /* the caller_id of CONFIG_PRINTK_CALLER is not described here */
+    if (pc->flags & OOPS_REPORT)
+        oops_record(ts_nsec, 0, msg, text_len);
+
+    nanos = (ulonglong)ts_nsec / (ulonglong)1000000000;
+    rem = (ulonglong)ts_nsec % (ulonglong)1000000000;
+    sprintf(buf, "[%5lld.%06ld] ", nanos, rem/1000);
+    fprintf(fp, "%s", buf);
+
+    for (i = 0, p = msg; i < text_len; i++, p++) {
+        if (*p == '[' && (pc->flags & SYMBOLIZE) &&
+                symbolize_address(p, text_len - i, sym, sizeof(sym))) {
+            fputs(sym, fp);
+            i += SYMBOLIZE_ADDR_LEN - 1;
+            p += SYMBOLIZE_ADDR_LEN - 1;
+            continue;
+        }
+        if (*p == '\n')
+            fprintf(fp, "\n");
+        else if (isprint(*p) || isspace(*p))
+            fputc(*p, fp);
+        else
+            fputc('.', fp);
+    }
+
+    fprintf(fp, "\n");
+}
+
+/*
+ * --stats-only: struct printk_log has dict_len, facility and the
+ * flags:5, level:3 byte right after text_len, and the dictionary
+ * ("SUBSYSTEM=pci\0DEVICE=+pci:0000:00:1f.2") right after the text.
+ */
+static __always_inline void stats_log_entry(char *logptr,
+        const struct log_record_layout *l)
+{
+    uint16_t text_len, dict_len;
+    const char *subsystem = NULL, *device = NULL;
+    int subsystem_len = 0, device_len = 0;
+    char *msg, *dict, *end, *p;
+
+    text_len = USHORT(logptr + l->text_len);
+    dict_len = USHORT(logptr + l->text_len + 2);
+    if (l->size + text_len + dict_len > USHORT(logptr + l->len))
+        dict_len = 0;
+    msg = logptr + l->size;
+    dict = msg + text_len;
+    end = dict + dict_len;
+
+    for (p = dict; p < end; p += strnlen(p, end - p) + 1) {
+        if (!strncmp(p, "SUBSYSTEM=", 10)) {
+            subsystem = p + 10;
+            subsystem_len = end - subsystem;
+        } else if (!strncmp(p, "DEVICE=", 7)) {
+            device = p + 7;
+            device_len = end - device;
+        }
+    }
+
+    stats_record(ULONGLONG(logptr + l->ts_nsec),
+            UCHAR(logptr + l->text_len + 5) >> 5,
+            UCHAR(logptr + l->text_len + 4),
+            subsystem, subsystem_len, device, device_len,
+            (pc->flags & STATS_TEXT) ? msg : NULL, text_len);
+}
+
+static __always_inline void dump_log_records(char *logbuf, uint32_t log_buf_len,
+        uint32_t first, uint32_t next, const struct log_record_layout *l)
+{
+    uint32_t idx = first;
+
+    while (idx != next) {
+        if (pc->flags & STATS_ONLY)
+            stats_log_entry(log_from_idx(idx, logbuf, l), l);
+        else
+            dump_log_entry(log_from_idx(idx, logbuf, l), l);
+
+        idx = log_next(idx, logbuf, l);
+
+        if (idx >= log_buf_len) {
+            break;
+        }
+    }
+}
+
+void dump_variable_length_record_log()
+{
+    struct log_record_layout layout;
+    uint32_t log_first_idx, log_next_idx, log_buf_len;
+    ulong log_buf;
+    char *logbuf;
+
+    printk_layout_init();
+
+    layout.size = SIZE(printk_log);
+    layout.ts_nsec = OFFSET(printk_log_ts_nsec);
+    layout.len = OFFSET(printk_log_len);
+    layout.text_len = OFFSET(printk_log_text_len);
+
+    get_symbol_data("log_first_idx", sizeof(uint32_t), &log_first_idx);
+    get_symbol_data("log_next_idx", sizeof(uint32_t), &log_next_idx);
+    get_symbol_data("log_buf_len", sizeof(uint32_t), &log_buf_len);
+    get_symbol_data("log_buf", sizeof(char *), &log_buf);
+
+    if (KDEBUG(1)) {
+        pr_debug("log_buf: %lx", (ulong)log_buf);
+        pr_debug("log_buf_len: %d", log_buf_len);
+        pr_debug("log_first_idx: %d", log_first_idx);
+        pr_debug("log_next_idx: %d", log_next_idx);
+    }
+
+    log_buf_len &= ((1<<20) | ((1<<20) - 1));
+    logbuf = xmalloc(log_buf_len);
+
+    if (readmem(log_buf, KVADDR, logbuf, log_buf_len)) {
+        pr_err("Cannot read log_buf contents");
+        goto out;
+    }
+
+    if (!memcmp(&layout, &log_builtin_layout, sizeof(layout)))
+        dump_log_records(logbuf, log_buf_len, log_first_idx, log_next_idx,
+                &log_builtin_layout);
+    else
+        dump_log_records(logbuf, log_buf_len, log_first_idx, log_next_idx,
+                &layout);
+out:
+    xfree(logbuf);
 }
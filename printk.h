@@ -79,19 +79,61 @@ struct printk_ringbuffer {
     atomic_long_t fail;
 };
 
+/*
+ * The per-record fields of the lockless ringbuffer, copied out of the
+ * offset and size tables so the decoder does not go through them for
+ * every record.
+ */
+struct prb_record_layout {
+    long desc_size;
+    long desc_state_var;        /* prb_desc.state_var.counter */
+    long desc_lpos_begin;       /* prb_desc.text_blk_lpos.begin */
+    long desc_lpos_next;        /* prb_desc.text_blk_lpos.next */
+    long info_size;
+    long info_ts_nsec;
+    long info_text_len;
+    long info_caller_id;
+    long info_facility;         /* followed by the flags:5, level:3 byte */
+    long info_dev_subsystem;    /* printk_info.dev_info.subsystem */
+    long info_dev_device;       /* printk_info.dev_info.device */
+};
+
 struct prb_map {
     char *prb;
 
+    struct prb_record_layout layout;
+    int builtin_layout;             /* layout is the one of printk.h */
+
     char *desc_ring;
     unsigned long desc_ring_count;
     char *descs;
+    char *descs_check;              /* descs read again after the text */
     char *infos;
+    unsigned long descs_kaddr;
+    unsigned long infos_kaddr;
 
     char *text_data_ring;
     unsigned long text_data_ring_size;
-    char *text_data;
+    unsigned long text_data_kaddr;
+    int read_text;                  /* --stats-only needs no text */
+
+    unsigned long tail_id;
+    unsigned long head_id;
+
+    unsigned long reread;           /* records read again after a change */
+    unsigned long torn;             /* records recycled while being read */
 };
 
+#define DEV_PRINTK_SUBSYSTEM_LEN    (sizeof(((struct dev_printk_info *)0)->subsystem))
+#define DEV_PRINTK_DEVICE_LEN       (sizeof(((struct dev_printk_info *)0)->device))
+
+void printk_layout_init();
+int prb_prefetch();
 void dump_lockless_record_log();
+void dump_variable_length_record_log();
+int printk_head(unsigned long *kaddr, unsigned long *size,
+        unsigned long *value);
+int printk_seq(unsigned long *kaddr, unsigned long *size,
+        unsigned long *mask);
 
 #endif
@@ -13,6 +13,7 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +29,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "defs.h"
 #include "xutil.h"
 #include "log.h"
 #include "parse_hmp.h"
@@ -44,6 +46,22 @@ static int qmp_fd;
 #define QMP_COMMAND_XP          "{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"xp /%" PRIu64 "xb 0x%zx\"}}"
 #define QMP_COMMAND_GPA2HVA     "{\"execute\": \"human-monitor-command\", \"arguments\": {\"command-line\": \"gpa2hva 0x%lx\"}}"
 
+#define QMP_EVENT_KEY           "\"event\": \""
+#define QMP_EVENT_NAME_MAX      (32)
+#define QMP_EVENT_QUEUE_MAX     (16)
+#define QMP_EVENT_LINE_MAX      (4096)
+
+/*
+ * Events arrive whenever qemu has one, in between a command and its reply
+ * too.  They are kept here until qmp_wait_event() hands them out.
+ */
+static char qmp_events[QMP_EVENT_QUEUE_MAX][QMP_EVENT_NAME_MAX];
+static int qmp_nr_events;
+
+/* the start of an event line that a read in qmp_wait_event() cut off */
+static char qmp_partial[QMP_EVENT_LINE_MAX];
+static size_t qmp_partial_len;
+
 static char* get_absolute_path(const char *file_path)
 {
     char *abs_path = (char *)xmalloc(MAX_PATH_LEN);
@@ -185,8 +203,67 @@ pid_t qmp_get_pid(char *sock_path)
     return find_pid_by_inode(inode);
 }
 
+/*
+ * {"timestamp": {...}, "event": "RESET", "data": {...}}\r\n
+ */
+static void qmp_queue_event(const char *line)
+{
+    const char *name = strstr(line, QMP_EVENT_KEY);
+    size_t len;
+
+    if (!name)
+        return;
+    name += strlen(QMP_EVENT_KEY);
+    len = strcspn(name, "\"");
+
+    /* nobody waits for events unless --events: keep the latest ones */
+    if (qmp_nr_events == QMP_EVENT_QUEUE_MAX) {
+        memmove(qmp_events[0], qmp_events[1],
+                --qmp_nr_events * sizeof(qmp_events[0]));
+    }
+    if (len >= QMP_EVENT_NAME_MAX)
+        len = QMP_EVENT_NAME_MAX - 1;
+    memcpy(qmp_events[qmp_nr_events], name, len);
+    qmp_events[qmp_nr_events][len] = '\0';
+    qmp_nr_events++;
+
+    if (KDEBUG(1))
+        pr_debug("QMP event %s", qmp_events[qmp_nr_events - 1]);
+}
+
+/*
+ * Move the event lines out of what was read, so that the reply parsers
+ * only ever see replies.  Returns the length left.
+ */
+static size_t qmp_strip_events(char *buf, size_t len)
+{
+    char *line = buf, *end = buf + len, *eol;
+    size_t line_len;
+
+    while (line < end) {
+        if (!(eol = memchr(line, '\n', end - line)))
+            break;
+        line_len = eol - line + 1;
+
+        if (strncmp(line, "{\"return\"", 9) &&
+                strncmp(line, "{\"error\"", 8) &&
+                memmem(line, line_len, QMP_EVENT_KEY, strlen(QMP_EVENT_KEY))) {
+            line[line_len - 1] = '\0';
+            qmp_queue_event(line);
+            memmove(line, line + line_len, end - line - line_len);
+            end -= line_len;
+            memset(end, 0, line_len);
+            continue;
+        }
+        line += line_len;
+    }
+
+    return end - buf;
+}
+
 static int qmp_read(int fd, void *buf, size_t *len)
 {
+    char *start = buf;
     struct pollfd pfd;
     size_t tread = 0, nread;
     int r;
@@ -207,7 +284,7 @@ static int qmp_read(int fd, void *buf, size_t *len)
         }
     }
 
-    *len = tread;
+    *len = qmp_strip_events(start, tread);
     return 0;
 }
 
@@ -315,6 +392,8 @@ err_exit:
 
 int qmp_client_uninit()
 {
+    qmp_nr_events = 0;
+
     if (close(qmp_fd) == -1) {
         return -1;
     }
@@ -526,3 +605,51 @@ err_exit:
     xfree(buf);
     return -1;
 }
+
+/*
+ * Wait up to timeout_ms (forever if negative) for an asynchronous event.
+ * Returns 1 with its name in event, 0 on timeout, -1 once qemu is gone.
+ */
+int qmp_wait_event(int timeout_ms, char *event, size_t len)
+{
+    struct pollfd pfd;
+    char buf[2 * QMP_EVENT_LINE_MAX];
+    char *eol, *rest;
+    ssize_t nread;
+    size_t left;
+    int r;
+
+    pfd.fd = qmp_fd;
+    pfd.events = POLLIN;
+
+    while (!qmp_nr_events) {
+        if ((r = poll(&pfd, 1, timeout_ms)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            return 0;
+
+        memcpy(buf, qmp_partial, qmp_partial_len);
+        nread = read(qmp_fd, buf + qmp_partial_len,
+                sizeof(buf) - 1 - qmp_partial_len);
+        if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (nread <= 0)
+            return -1;
+        left = qmp_strip_events(buf, qmp_partial_len + nread);
+
+        /* replies nobody waits for are dropped, a cut-off line is kept */
+        rest = (eol = memrchr(buf, '\n', left)) ? eol + 1 : buf;
+        qmp_partial_len = buf + left - rest;
+        if (qmp_partial_len >= QMP_EVENT_LINE_MAX)
+            qmp_partial_len = 0;
+        memmove(qmp_partial, rest, qmp_partial_len);
+    }
+
+    xstrlcpy(event, qmp_events[0], len);
+    memmove(qmp_events[0], qmp_events[1],
+            --qmp_nr_events * sizeof(qmp_events[0]));
+    return 1;
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+#
+# Time --no-map: the cold decode of the guest's kallsyms (--no-cache)
+# and the warm run that reads the cached map back.  Only the "mapsel"
+# startup phase is measured.
+#
+# usage: bench-kallsyms.sh guest [runs]
+
+GUEST=$1
+RUNS=${2:-20}
+KVM_DMESG=$(dirname $0)/../kvm-dmesg
+
+if [ -z "$GUEST" ]; then
+    echo "usage: $0 guest [runs]" >&2
+    exit 1
+fi
+
+mapsel_ms() {
+    "$KVM_DMESG" -d 1 --no-map "$@" "$GUEST" 2>&1 >/dev/null |
+        grep -Po 'phase mapsel .* took +\K[0-9.]+'
+}
+
+bench() {
+    local name=$1; shift
+
+    for i in $(seq $RUNS); do
+        mapsel_ms "$@"
+    done | sort -n | awk -v name="$name" '
+        { v[NR] = $1; sum += $1 }
+        END {
+            if (!NR) { print name ": no samples"; exit 1 }
+            printf "%-8s runs %3d  min %8.3fms  median %8.3fms  mean %8.3fms\n",
+                name, NR, v[1], v[int((NR + 1) / 2)], sum / NR
+        }'
+}
+
+bench cold --no-cache
+"$KVM_DMESG" --no-map "$GUEST" >/dev/null || exit 1
+bench warm
@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+#
+# Time System.map loading: the cold scan (--no-cache) and the compiled
+# index.  Only the "symtab" startup phase is measured, so any guest name
+# will do; it does not have to exist.
+#
+# usage: bench-sysmap.sh System.map [runs] [guest]
+
+MAP=$1
+RUNS=${2:-20}
+GUEST=${3:-bench-no-such-guest}
+KVM_DMESG=$(dirname $0)/../kvm-dmesg
+
+if [ -z "$MAP" ] || [ ! -f "$MAP" ]; then
+    echo "usage: $0 System.map [runs] [guest]" >&2
+    exit 1
+fi
+
+symtab_ms() {
+    "$KVM_DMESG" -d 1 "$@" "$GUEST" "$MAP" 2>&1 >/dev/null |
+        grep -Po 'phase symtab .* took +\K[0-9.]+'
+}
+
+bench() {
+    local name=$1; shift
+
+    for i in $(seq $RUNS); do
+        symtab_ms "$@"
+    done | sort -n | awk -v name="$name" '
+        { v[NR] = $1; sum += $1 }
+        END {
+            if (!NR) { print name ": no samples"; exit 1 }
+            printf "%-8s runs %3d  min %8.3fms  median %8.3fms  mean %8.3fms\n",
+                name, NR, v[1], v[int((NR + 1) / 2)], sum / NR
+        }'
+}
+
+bench scan --no-cache
+"$KVM_DMESG" --index "$MAP" >/dev/null || exit 1
+bench index
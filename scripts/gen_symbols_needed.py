@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# gen_symbols_needed.py
+#
+# Copyright (C) 2024 Ray Lee <hburaylee@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+"""Generate symbols_needed.h, a perfect hash of the kernel symbols kvm-dmesg
+keeps from System.map.
+
+Edit NEEDED below and re-run:  python3 scripts/gen_symbols_needed.py
+"""
+
+import itertools
+import os
+import sys
+
+# (name, symbols that become unnecessary once this one has been seen)
+#
+# The System.map scanner stops as soon as every symbol that is still
+# expected has been found, so alternatives for the same job exclude each
+# other.
+NEEDED = [
+    ("log_first_idx",           []),
+    ("log_next_idx",            []),
+    ("log_buf",                 []),
+    ("log_end",                 ["log_first_idx", "log_next_idx", "prb",
+                                 "log_next_seq"]),
+    ("log_buf_len",             []),
+    ("divide_error",            ["asm_exc_divide_error"]),
+    ("asm_exc_divide_error",    ["divide_error"]),
+    ("idt_table",               []),
+    ("vmcoreinfo_data",         []),
+    ("vmcoreinfo_size",         []),
+    ("page_offset_base",        []),
+    ("vmalloc_base",            []),
+    ("_end",                    []),
+    ("linux_banner",            []),
+    ("prb",                     ["log_first_idx", "log_next_idx", "log_end",
+                                 "log_next_seq"]),
+    ("panic_cpu",               []),
+    ("oops_in_progress",        []),
+    ("tainted_mask",            []),
+    ("panic_on_oops",           []),
+    ("crash_kexec_post_notifiers", []),
+    ("log_next_seq",            ["log_end", "prb"]),
+    ("tk_core",                 []),
+]
+
+# only looked for with --watch-crash, the map scan does not wait for them
+WATCH = [
+    "panic_cpu",
+    "oops_in_progress",
+    "tainted_mask",
+    "panic_on_oops",
+    "crash_kexec_post_notifiers",
+    "log_next_seq",             # --storm, 3.5 - 5.9
+]
+
+# only looked for with --merge
+MERGE = [
+    "tk_core",
+]
+
+# log_first_idx/log_next_idx (3.5 - 5.9) replace log_end (older kernels)
+EXTRA_EXCLUDES = {
+    "log_first_idx": ["log_end", "prb"],
+    "log_next_idx":  ["log_end", "prb"],
+}
+
+OUTPUT = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      "..", "symbols_needed.h")
+
+HEADER = """/* symbols_needed.h
+ *
+ * Generated by scripts/gen_symbols_needed.py, do not edit.
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+"""
+
+
+def slot(name, mul, size):
+    n = len(name)
+    return ((ord(name[0]) * mul[0] + ord(name[-1]) * mul[1] +
+             ord(name[n // 2]) * mul[2] + n * mul[3]) & (size - 1))
+
+
+def find_hash(names):
+    size = 1
+    while size < 2 * len(names):
+        size <<= 1
+    while True:
+        for mul in itertools.product(range(1, 32), repeat=4):
+            slots = [slot(n, mul, size) for n in names]
+            if len(set(slots)) == len(slots):
+                return size, mul, slots
+        size <<= 1
+
+
+def main():
+    names = [n for n, _ in NEEDED]
+    if len(names) > 64:
+        sys.exit("too many symbols for a 64-bit mask")
+
+    size, mul, slots = find_hash(names)
+    table = [-1] * size
+    for i, s in enumerate(slots):
+        table[s] = i
+
+    excludes = []
+    for name, ex in NEEDED:
+        ex = ex + EXTRA_EXCLUDES.get(name, [])
+        excludes.append(sum(1 << names.index(e) for e in set(ex)))
+
+    out = [HEADER]
+    out.append("#ifndef __SYMBOLS_NEEDED_H__")
+    out.append("#define __SYMBOLS_NEEDED_H__")
+    out.append("")
+    out.append("#include <stdint.h>")
+    out.append("#include <string.h>")
+    out.append("")
+    out.append("enum needed_symbol {")
+    for n in names:
+        out.append("    SYM_%s," % n)
+    out.append("    NR_NEEDED_SYMBOLS")
+    out.append("};")
+    out.append("")
+    out.append("#define NEEDED_SYMBOLS_MAX_LEN  (%d)" % max(len(n) for n in names))
+    out.append("#define NEEDED_SYMBOLS_HASH_SIZE (%d)" % size)
+    out.append("#define NEEDED_SYMBOLS_WATCH    (0x%xULL)" %
+               sum(1 << names.index(n) for n in WATCH))
+    out.append("#define NEEDED_SYMBOLS_MERGE    (0x%xULL)" %
+               sum(1 << names.index(n) for n in MERGE))
+    out.append("")
+    out.append("static const char *const needed_symbol_names[NR_NEEDED_SYMBOLS] = {")
+    for n in names:
+        out.append("    \"%s\"," % n)
+    out.append("};")
+    out.append("")
+    out.append("static const unsigned char needed_symbol_lens[NR_NEEDED_SYMBOLS] = {")
+    out.append("    " + ", ".join(str(len(n)) for n in names) + ",")
+    out.append("};")
+    out.append("")
+    out.append("/* symbols that are no longer expected once this one has been seen */")
+    out.append("static const uint64_t needed_symbol_excludes[NR_NEEDED_SYMBOLS] = {")
+    for n, e in zip(names, excludes):
+        out.append("    0x%xULL,%s/* %s */" % (e, " " * (12 - len("%x" % e)), n))
+    out.append("};")
+    out.append("")
+    out.append("static const signed char needed_symbol_slots[NEEDED_SYMBOLS_HASH_SIZE] = {")
+    for i in range(0, size, 16):
+        out.append("    " + ", ".join("%2d" % v for v in table[i:i + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("static inline int needed_symbol_id(const char *s, size_t len)")
+    out.append("{")
+    out.append("    unsigned int h;")
+    out.append("    int id;")
+    out.append("")
+    out.append("    if (len == 0 || len > NEEDED_SYMBOLS_MAX_LEN)")
+    out.append("        return -1;")
+    out.append("")
+    out.append("    h = ((unsigned char)s[0] * %du + (unsigned char)s[len - 1] * %du +" % mul[:2])
+    out.append("         (unsigned char)s[len / 2] * %du + len * %du) &" % mul[2:])
+    out.append("        (NEEDED_SYMBOLS_HASH_SIZE - 1);")
+    out.append("    id = needed_symbol_slots[h];")
+    out.append("")
+    out.append("    if (id < 0 || needed_symbol_lens[id] != len ||")
+    out.append("            memcmp(s, needed_symbol_names[id], len))")
+    out.append("        return -1;")
+    out.append("")
+    out.append("    return id;")
+    out.append("}")
+    out.append("")
+    out.append("#endif")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,173 @@
+/* spsc.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <sched.h>
+#include <pthread.h>
+
+#include "xutil.h"
+
+/*
+ * Bounded single-producer/single-consumer queue of pointers.
+ *
+ * The producer only writes tail and the consumer only writes head, so no
+ * locking is needed; the release store on the index publishes the slot.
+ * The lock and condition variable are only used by a side that has run
+ * out of spins and sleeps until the other side moves its index.
+ */
+struct spsc_queue {
+    unsigned long mask;
+    void **slots;
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    int waiters __attribute__((aligned(64)));
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+#define SPSC_SPIN_LOOPS (128)
+
+static inline void spsc_init(struct spsc_queue *q, unsigned long size)
+{
+    /* size must be a power of two */
+    q->mask = size - 1;
+    q->slots = xcalloc(size, sizeof(void *));
+    q->head = 0;
+    q->tail = 0;
+    q->waiters = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+static inline void spsc_destroy(struct spsc_queue *q)
+{
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    xfree(q->slots);
+    q->slots = NULL;
+}
+
+/*
+ * Called after head or tail moved.  The fence pairs with the one in
+ * spsc_sleep(): either the sleeper sees the new index when it checks
+ * again, or we see it registered and wake it.
+ */
+static inline void spsc_wake(struct spsc_queue *q)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&q->waiters, __ATOMIC_RELAXED))
+        return;
+
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static inline int __spsc_push(struct spsc_queue *q, void *p)
+{
+    unsigned long tail = q->tail;
+
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+        return -1;
+
+    q->slots[tail & q->mask] = p;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline void *__spsc_pop(struct spsc_queue *q)
+{
+    unsigned long head = q->head;
+    void *p;
+
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    p = q->slots[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+static inline int spsc_push(struct spsc_queue *q, void *p)
+{
+    if (__spsc_push(q, p))
+        return -1;
+    spsc_wake(q);
+    return 0;
+}
+
+static inline void *spsc_pop(struct spsc_queue *q)
+{
+    void *p = __spsc_pop(q);
+
+    if (p)
+        spsc_wake(q);
+    return p;
+}
+
+static inline int spsc_try(struct spsc_queue *q, void **p, int push)
+{
+    if (push)
+        return !__spsc_push(q, *p);
+    return !!(*p = __spsc_pop(q));
+}
+
+/* block until spsc_try() succeeds, then wake the other side */
+static inline void spsc_sleep(struct spsc_queue *q, void **p, int push)
+{
+    pthread_mutex_lock(&q->lock);
+    __atomic_add_fetch(&q->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!spsc_try(q, p, push))
+        pthread_cond_wait(&q->cond, &q->lock);
+    __atomic_sub_fetch(&q->waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&q->lock);
+    spsc_wake(q);
+}
+
+/*
+ * The other side may be blocked on a monitor round trip for a long time,
+ * so spin briefly and then sleep until it moves.
+ */
+static inline void spsc_wait(struct spsc_queue *q, void **p, int push)
+{
+    unsigned int spins;
+
+    for (spins = 0; spins < SPSC_SPIN_LOOPS; spins++) {
+        if (spsc_try(q, p, push)) {
+            spsc_wake(q);
+            return;
+        }
+        sched_yield();
+    }
+    spsc_sleep(q, p, push);
+}
+
+static inline void spsc_push_wait(struct spsc_queue *q, void *p)
+{
+    spsc_wait(q, &p, 1);
+}
+
+static inline void *spsc_pop_wait(struct spsc_queue *q)
+{
+    void *p;
+
+    spsc_wait(q, &p, 0);
+    return p;
+}
+
+#endif
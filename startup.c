@@ -0,0 +1,372 @@
+/* startup.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "printk.h"
+#include "startup.h"
+#include "bootcache.h"
+#include "mapdir.h"
+#include "vmcoreinfo.h"
+#include "kallsyms.h"
+
+/*
+ * Startup is a small dependency graph.  Every phase runs in its own thread
+ * as soon as the phases it depends on have finished, so independent work
+ * (parsing System.map, the monitor handshake and register fetch) overlaps.
+ * Phases that talk to the guest are additionally serialized because the
+ * readers and the page table caches in machdep are not thread safe.
+ */
+enum {
+    PHASE_CLIENT,
+    PHASE_SYMTAB,
+    PHASE_TEXT_SYMS,
+    PHASE_MACHDEP,
+    PHASE_MAPSEL,
+    PHASE_BOOTCACHE,
+    PHASE_REGS,
+    PHASE_KASLR,
+    PHASE_POST_RELOC,
+    PHASE_VMCOREINFO,
+    PHASE_KERNEL,
+    PHASE_PRB,
+    NR_PHASES,
+};
+
+#define DEP(x)              (1U << (x))
+
+#define PHASE_GUEST_IO      (0x1)   /* reads guest memory or the monitor */
+
+enum phase_state {
+    PHASE_WAITING,
+    PHASE_DONE,
+    PHASE_FAILED,
+};
+
+struct startup_phase {
+    const char *name;
+    int (*fn)(void);
+    unsigned int deps;
+    unsigned int flags;
+
+    enum phase_state state;
+    struct timespec start;
+    struct timespec end;
+};
+
+static struct {
+    char *guest_ac;
+    guest_access_t ty;
+    char *symmap_file;
+    char *map_dir;
+} args;
+
+static pthread_mutex_t phase_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t phase_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t guest_io_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int phase_client(void)
+{
+    return guest_client_new(args.guest_ac, args.ty);
+}
+
+static int phase_symtab(void)
+{
+    symtab_init(args.symmap_file);
+    return 0;
+}
+
+static int phase_text_syms(void)
+{
+    if (!(pc->flags & SYMBOLIZE))
+        return 0;
+    return symtab_full_init();
+}
+
+static int phase_machdep(void)
+{
+    x86_64_init();
+    return 0;
+}
+
+/*
+ * --map-dir and --no-map: the map is not known up front.  Pick it from
+ * the guest's IDT, or rebuild it from the guest's kallsyms; symtab and
+ * the bootstrap cache wait for this phase only in those modes.
+ */
+static int phase_mapsel(void)
+{
+    char path[PATH_MAX];
+
+    if (pc->flags & NO_MAP) {
+        if (kallsyms_select(path, sizeof(path)))
+            return -1;
+        args.symmap_file = xstrdup(path);
+        return 0;
+    }
+
+    if (!args.map_dir)
+        return 0;
+
+    if (x86_64_get_registers())
+        return -1;
+    if (mapdir_select(args.map_dir, path, sizeof(path)))
+        return -1;
+
+    args.symmap_file = xstrdup(path);
+    return 0;
+}
+
+static int phase_bootcache(void)
+{
+    /* a miss is not an error, the following phases do the work */
+    bootcache_load(guest_client->pid, args.symmap_file);
+    return 0;
+}
+
+static int phase_regs(void)
+{
+    if (bootcache_hit() || machdep->machspec->idtr ||
+            (pc->flags & SCAN_VMCOREINFO))
+        return 0;
+    return x86_64_get_registers();
+}
+
+static int phase_kaslr(void)
+{
+    if (bootcache_hit())
+        return 0;
+
+    if (pc->flags & SCAN_VMCOREINFO) {
+        if (!vmcoreinfo_scan(NULL))
+            return 0;
+        pr_warning("VMCOREINFO not found in guest memory, using registers");
+        if (!machdep->machspec->idtr && x86_64_get_registers())
+            return -1;
+    }
+
+    return derive_kaslr_offset();
+}
+
+static int phase_post_reloc(void)
+{
+    if (bootcache_hit())
+        return 0;
+    x86_64_post_reloc();
+    return 0;
+}
+
+static int phase_vmcoreinfo(void)
+{
+    vmcoreinfo_init();
+    return 0;
+}
+
+static int phase_kernel(void)
+{
+    kernel_init();
+    return 0;
+}
+
+static int phase_prb(void)
+{
+    printk_layout_init();
+    /*
+     * With --capture the header is read, and recorded, by the decode.
+     * --watch-crash only reads the log once the guest crashed.
+     */
+    if (!kernel_symbol_exists("prb") || (pc->flags & (CAPTURE | WATCH_CRASH)))
+        return 0;
+    return prb_prefetch();
+}
+
+static struct startup_phase phases[NR_PHASES] = {
+    [PHASE_CLIENT] = {
+        "client", phase_client,
+        0, PHASE_GUEST_IO },
+    [PHASE_SYMTAB] = {
+        "symtab", phase_symtab,
+        0, 0 },
+    [PHASE_TEXT_SYMS] = {
+        "text_syms", phase_text_syms,
+        DEP(PHASE_SYMTAB), 0 },
+    [PHASE_MACHDEP] = {
+        "machdep", phase_machdep,
+        0, 0 },
+    [PHASE_MAPSEL] = {
+        "mapsel", phase_mapsel,
+        DEP(PHASE_CLIENT) | DEP(PHASE_MACHDEP), PHASE_GUEST_IO },
+    [PHASE_BOOTCACHE] = {
+        "bootcache", phase_bootcache,
+        DEP(PHASE_CLIENT) | DEP(PHASE_MACHDEP), PHASE_GUEST_IO },
+    [PHASE_REGS] = {
+        "registers", phase_regs,
+        DEP(PHASE_BOOTCACHE), PHASE_GUEST_IO },
+    [PHASE_KASLR] = {
+        "kaslr", phase_kaslr,
+        DEP(PHASE_REGS) | DEP(PHASE_SYMTAB), PHASE_GUEST_IO },
+    [PHASE_POST_RELOC] = {
+        "post_reloc", phase_post_reloc,
+        DEP(PHASE_KASLR), PHASE_GUEST_IO },
+    [PHASE_VMCOREINFO] = {
+        "vmcoreinfo", phase_vmcoreinfo,
+        DEP(PHASE_POST_RELOC), PHASE_GUEST_IO },
+    [PHASE_KERNEL] = {
+        "kernel", phase_kernel,
+        DEP(PHASE_VMCOREINFO), 0 },
+    [PHASE_PRB] = {
+        "prb", phase_prb,
+        DEP(PHASE_KERNEL), PHASE_GUEST_IO },
+};
+
+static double ts_diff_ms(struct timespec *a, struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/*
+ * Wait until every dependency has finished.  Returns -1 when one of them
+ * failed, in which case the phase is skipped and fails too.
+ */
+static int phase_wait_deps(struct startup_phase *p)
+{
+    int i, ready, ret = 0;
+
+    pthread_mutex_lock(&phase_lock);
+    for (;;) {
+        ready = TRUE;
+        for (i = 0; i < NR_PHASES; i++) {
+            if (!(p->deps & DEP(i)))
+                continue;
+            if (phases[i].state == PHASE_FAILED) {
+                ret = -1;
+                goto out;
+            }
+            if (phases[i].state != PHASE_DONE)
+                ready = FALSE;
+        }
+        if (ready)
+            break;
+        pthread_cond_wait(&phase_cond, &phase_lock);
+    }
+out:
+    pthread_mutex_unlock(&phase_lock);
+    return ret;
+}
+
+static void *phase_thread(void *arg)
+{
+    struct startup_phase *p = arg;
+    int ret;
+
+    ret = phase_wait_deps(p);
+
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    if (!ret) {
+        if (p->flags & PHASE_GUEST_IO)
+            pthread_mutex_lock(&guest_io_lock);
+        ret = p->fn();
+        if (p->flags & PHASE_GUEST_IO)
+            pthread_mutex_unlock(&guest_io_lock);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &p->end);
+
+    pthread_mutex_lock(&phase_lock);
+    p->state = ret ? PHASE_FAILED : PHASE_DONE;
+    pthread_cond_broadcast(&phase_cond);
+    pthread_mutex_unlock(&phase_lock);
+
+    return NULL;
+}
+
+/*
+ * --probe: connect and ask the bootstrap cache whether the log changed
+ * since the last run, without any of the phases above.
+ */
+int startup_probe(char *guest_ac, guest_access_t ty, char *symmap_file)
+{
+    if (guest_client_new(guest_ac, ty))
+        return -1;
+    x86_64_init();
+    return bootcache_probe(guest_client->pid, symmap_file);
+}
+
+int startup_run(char *guest_ac, guest_access_t ty, char *symmap_file,
+        char *map_dir)
+{
+    pthread_t threads[NR_PHASES];
+    int started[NR_PHASES];
+    struct timespec begin, end;
+    struct startup_phase *p;
+    int i, ret = 0;
+
+    args.guest_ac = guest_ac;
+    args.ty = ty;
+    args.symmap_file = symmap_file;
+    args.map_dir = map_dir;
+
+    if (map_dir || (pc->flags & NO_MAP)) {
+        phases[PHASE_SYMTAB].deps |= DEP(PHASE_MAPSEL);
+        phases[PHASE_BOOTCACHE].deps |= DEP(PHASE_MAPSEL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for (i = 0; i < NR_PHASES; i++) {
+        p = &phases[i];
+        started[i] = !pthread_create(&threads[i], NULL, phase_thread, p);
+        if (!started[i]) {
+            /* fall back to running the phase inline */
+            phase_thread(p);
+        }
+    }
+
+    for (i = 0; i < NR_PHASES; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < NR_PHASES; i++) {
+        p = &phases[i];
+        if (p->state == PHASE_FAILED)
+            ret = -1;
+        if (KDEBUG(1)) {
+            pr_debug("phase %-10s %s  start %8.3fms  took %8.3fms",
+                    p->name, p->state == PHASE_DONE ? "ok  " : "fail",
+                    ts_diff_ms(&begin, &p->start),
+                    ts_diff_ms(&p->start, &p->end));
+        }
+    }
+
+    if (KDEBUG(1))
+        pr_debug("startup took %.3fms", ts_diff_ms(&begin, &end));
+
+    if (!ret)
+        bootcache_save(guest_client->pid, args.symmap_file);
+
+    /* a --no-map --no-cache map is only read during startup */
+    kallsyms_release();
+
+    return ret;
+}
@@ -0,0 +1,25 @@
+/* startup.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __STARTUP_H__
+#define __STARTUP_H__
+
+#include "client.h"
+
+int startup_run(char *guest_ac, guest_access_t ty, char *symmap_file,
+        char *map_dir);
+int startup_probe(char *guest_ac, guest_access_t ty, char *symmap_file);
+
+#endif
@@ -0,0 +1,286 @@
+/* stats.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/param.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "stats.h"
+
+/*
+ * --stats-only: count the records of the log instead of printing them.
+ * The decoders hand over what the record's info says, the text only when
+ * --stats-top asks for message prefixes, so that the ring text is not even
+ * read otherwise.
+ */
+struct stats_entry {
+    char key[STATS_KEY_LEN];
+    unsigned long count;
+};
+
+/* open addressing, keys past 3/4 of the slots are counted as "other" */
+struct stats_table {
+    const char *name;
+    struct stats_entry *slots;
+    unsigned long used;
+    unsigned long other;
+};
+
+struct stats_bucket {
+    uint64_t start;             /* seconds */
+    unsigned long count;
+};
+
+static struct {
+    unsigned long bucket_sec;
+    unsigned long top;
+
+    unsigned long records;
+    unsigned long levels[8];
+    unsigned long facilities[256];
+    struct stats_table subsystems;
+    struct stats_table devices;
+    struct stats_table prefixes;
+
+    /* records are in time order, so buckets are appended */
+    struct stats_bucket *buckets;
+    unsigned long nr_buckets;
+    unsigned long max_buckets;
+} stats;
+
+static void stats_table_init(struct stats_table *t, const char *name)
+{
+    t->name = name;
+    t->slots = xcalloc(STATS_TABLE_SIZE, sizeof(struct stats_entry));
+    t->used = t->other = 0;
+}
+
+static void stats_table_count(struct stats_table *t, const char *key,
+        size_t len)
+{
+    struct stats_entry *e;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    len = MIN(len, STATS_KEY_LEN - 1);
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+
+    for (i = hash % STATS_TABLE_SIZE;; i = (i + 1) % STATS_TABLE_SIZE) {
+        e = &t->slots[i];
+        if (!e->count)
+            break;
+        if (!strncmp(e->key, key, len) && !e->key[len]) {
+            e->count++;
+            return;
+        }
+    }
+
+    if (t->used >= STATS_TABLE_SIZE / 4 * 3) {
+        t->other++;
+        return;
+    }
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    e->count = 1;
+    t->used++;
+}
+
+static int stats_entry_cmp(const void *a, const void *b)
+{
+    const struct stats_entry *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return strcmp(x->key, y->key);
+}
+
+/*
+ * Most frequent first, at most max entries (all of them if 0).
+ */
+static void stats_table_print(struct stats_table *t, unsigned long max,
+        int quoted)
+{
+    struct stats_entry *e = t->slots;
+    unsigned long i, n = 0;
+
+    for (i = 0; i < STATS_TABLE_SIZE; i++) {
+        if (t->slots[i].count)
+            e[n++] = t->slots[i];
+    }
+    qsort(e, n, sizeof(*e), stats_entry_cmp);
+    if (max && n > max)
+        n = max;
+
+    if (quoted) {
+        for (i = 0; i < n; i++)
+            fprintf(fp, "%s %lu \"%s\"\n", t->name, e[i].count, e[i].key);
+        return;
+    }
+
+    fprintf(fp, "%s", t->name);
+    for (i = 0; i < n; i++)
+        fprintf(fp, " %s=%lu", e[i].key, e[i].count);
+    if (t->other)
+        fprintf(fp, " (other)=%lu", t->other);
+    fprintf(fp, "\n");
+}
+
+static void stats_bucket_count(uint64_t ts_nsec)
+{
+    uint64_t start = ts_nsec / 1000000000 / stats.bucket_sec *
+        stats.bucket_sec;
+    long i;
+
+    for (i = stats.nr_buckets - 1; i >= 0; i--) {
+        if (stats.buckets[i].start == start) {
+            stats.buckets[i].count++;
+            return;
+        }
+        if (stats.buckets[i].start < start)
+            break;
+    }
+
+    /* out of order records are rare, insert after i */
+    if (stats.nr_buckets == stats.max_buckets) {
+        stats.max_buckets = stats.max_buckets ? stats.max_buckets * 2 : 64;
+        stats.buckets = xrealloc(stats.buckets,
+                stats.max_buckets * sizeof(struct stats_bucket));
+    }
+    memmove(&stats.buckets[i + 2], &stats.buckets[i + 1],
+            (stats.nr_buckets - i - 1) * sizeof(struct stats_bucket));
+    stats.buckets[i + 1].start = start;
+    stats.buckets[i + 1].count = 1;
+    stats.nr_buckets++;
+}
+
+/*
+ * The start of a message with its numbers folded to '#', so that
+ * "usb 1-1: new device number 2" and "usb 2-1: new device number 3" count
+ * as the same message.
+ */
+static void stats_prefix_count(const char *text, int text_len)
+{
+    char key[STATS_PREFIX_LEN];
+    int i, n = 0;
+
+    for (i = 0; i < text_len && text[i] != '\n' &&
+            n < STATS_PREFIX_LEN - 1; i++) {
+        if (isxdigit((unsigned char)text[i]) &&
+                (isdigit((unsigned char)text[i]) || (n && key[n - 1] == '#'))) {
+            if (!n || key[n - 1] != '#')
+                key[n++] = '#';
+            continue;
+        }
+        key[n++] = isprint((unsigned char)text[i]) && text[i] != '"' ?
+            text[i] : '.';
+    }
+    stats_table_count(&stats.prefixes, key, n);
+}
+
+/*
+ * Subsystem and device names come straight from guest memory, and end up
+ * as the keys of key=count.
+ */
+static void stats_name_count(struct stats_table *t, const char *name,
+        int len)
+{
+    char key[STATS_KEY_LEN];
+    int i;
+
+    len = strnlen(name, MIN(len, STATS_KEY_LEN - 1));
+    for (i = 0; i < len; i++)
+        key[i] = isgraph((unsigned char)name[i]) && name[i] != '=' ?
+            name[i] : '.';
+    stats_table_count(t, key, len);
+}
+
+void stats_record(uint64_t ts_nsec, int level, int facility,
+        const char *subsystem, int subsystem_len,
+        const char *device, int device_len,
+        const char *text, int text_len)
+{
+    stats.records++;
+    stats.levels[level & 7]++;
+    stats.facilities[facility & 0xff]++;
+    stats_bucket_count(ts_nsec);
+
+    if (subsystem && *subsystem)
+        stats_name_count(&stats.subsystems, subsystem, subsystem_len);
+    if (device && *device)
+        stats_name_count(&stats.devices, device, device_len);
+    if (text && stats.top)
+        stats_prefix_count(text, text_len);
+}
+
+void stats_init(unsigned long bucket_sec, unsigned long top)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.bucket_sec = bucket_sec ? bucket_sec : STATS_BUCKET_SEC;
+    stats.top = top;
+    stats_table_init(&stats.subsystems, "subsystem");
+    stats_table_init(&stats.devices, "device");
+    stats_table_init(&stats.prefixes, "prefix");
+}
+
+/*
+ * records 4096
+ * level 4=12 6=4080 7=4
+ * facility 0=4090 3=6
+ * subsystem pci=30 usb=12
+ * device +pci:0000:00:01.0=5 c4:64=2
+ * time/60s 0=3900 60=150 120=46
+ * prefix 57 "usb #-#: new high-speed USB device"
+ */
+void stats_print(void)
+{
+    unsigned long i;
+
+    fprintf(fp, "records %lu\n", stats.records);
+
+    fprintf(fp, "level");
+    for (i = 0; i < 8; i++) {
+        if (stats.levels[i])
+            fprintf(fp, " %lu=%lu", i, stats.levels[i]);
+    }
+    fprintf(fp, "\nfacility");
+    for (i = 0; i < 256; i++) {
+        if (stats.facilities[i])
+            fprintf(fp, " %lu=%lu", i, stats.facilities[i]);
+    }
+    fprintf(fp, "\n");
+
+    stats_table_print(&stats.subsystems, 0, FALSE);
+    stats_table_print(&stats.devices, 0, FALSE);
+
+    fprintf(fp, "time/%lus", stats.bucket_sec);
+    for (i = 0; i < stats.nr_buckets; i++)
+        fprintf(fp, " %lu=%lu", (ulong)stats.buckets[i].start,
+                stats.buckets[i].count);
+    fprintf(fp, "\n");
+
+    if (stats.top)
+        stats_table_print(&stats.prefixes, stats.top, TRUE);
+
+    xfree(stats.subsystems.slots);
+    xfree(stats.devices.slots);
+    xfree(stats.prefixes.slots);
+    xfree(stats.buckets);
+}
@@ -0,0 +1,33 @@
+/* stats.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+#define STATS_BUCKET_SEC    (60)
+#define STATS_TABLE_SIZE    (1024)  /* slots per table, 3/4 of them used */
+#define STATS_KEY_LEN       (48)    /* dev_printk_info.device */
+#define STATS_PREFIX_LEN    (40)
+
+void stats_init(unsigned long bucket_sec, unsigned long top);
+void stats_record(uint64_t ts_nsec, int level, int facility,
+        const char *subsystem, int subsystem_len,
+        const char *device, int device_len,
+        const char *text, int text_len);
+void stats_print(void);
+
+#endif
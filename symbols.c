@@ -13,105 +13,193 @@
  * GNU General Public License for more details.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "defs.h"
 #include "log.h"
+#include "xutil.h"
 #include "client.h"
+#include "symindex.h"
+#include "sysmap.h"
+#include "vmlinux.h"
+#include "btf.h"
+#include "vmcoreinfo.h"
+#include "symbols_needed.h"
 
-#define MAX_LINE_LENGTH 256
+/*
+ * Only the symbols listed in scripts/gen_symbols_needed.py are kept.  The
+ * generated perfect hash maps a name straight to its slot here.
+ */
+static struct syment needed_syms[NR_NEEDED_SYMBOLS];
+
+static struct symindex symindex;
+static const char *symtab_map_file;
+
+/* symbols and BTF of a vmlinux given instead of a System.map */
+static struct vmlinux vmlinux;
+static struct symindex_builder vmlinux_syms;
+static pthread_t symindex_thread;
+static int symindex_thread_started = FALSE;
 
 int symbol_needed(const char *symbol)
 {
-    static char *symtab_array[] = {
-        "log_first_idx",
-        "log_next_idx",
-        "log_buf",
-        "log_end",
-        "log_buf_len",
-        "divide_error",
-        "asm_exc_divide_error",
-        "idt_table",
-        "vmcoreinfo_data",
-        "vmcoreinfo_size",
-        "page_offset_base",
-        "vmalloc_base",
-        "prb"
-    };
-    size_t array_size = sizeof(symtab_array) / sizeof(symtab_array[0]);
-
-    for (size_t i = 0; i < array_size; i++) {
-        if (STREQ(symbol, symtab_array[i])) {
-            return TRUE;
-        }
+    return needed_symbol_id(symbol, strlen(symbol)) >= 0;
+}
+
+static void needed_symbol_set(int id, ulong value)
+{
+    /* the first definition in the map wins */
+    if (needed_syms[id].name)
+        return;
+
+    needed_syms[id].value = value;
+    needed_syms[id].name = (char *)needed_symbol_names[id];
+}
+
+static struct syment *symname_hash_search(const char *name)
+{
+    int id;
+
+    if ((id = needed_symbol_id(name, strlen(name))) < 0)
+        return NULL;
+
+    return needed_syms[id].name ? &needed_syms[id] : NULL;
+}
+
+/*
+ * Fast path: the compiled index of this System.map is mapped and every
+ * needed symbol is a hash lookup away.
+ */
+static int symname_hash_init_index(const char *map_file)
+{
+    long i;
+
+    if (pc->flags & NO_CACHE)
+        return -1;
+
+    if (symindex_open(map_file, &symindex))
+        return -1;
+
+    for (int id = 0; id < NR_NEEDED_SYMBOLS; id++) {
+        if ((i = symindex_lookup(&symindex, needed_symbol_names[id])) >= 0)
+            needed_symbol_set(id, symindex.addrs[i]);
     }
-    return FALSE;
+
+    return 0;
 }
 
-static void symname_hash_install(struct syment *spn)
+/*
+ * Cold path: scan the map and stop as soon as every symbol that can still
+ * show up has been seen.  Alternatives (prb vs. log_first_idx, ...) drop
+ * each other from the expected set via needed_symbol_excludes[].
+ */
+static int symname_hash_scan_map(const char *map_file)
 {
-    struct syment *sp;
-    int index;
-
-    index = SYMNAME_HASH_INDEX(spn->name);
-    spn->cnt = 1;
-
-    if ((sp = st->symname_hash[index]) == NULL)
-        st->symname_hash[index] = spn;
-    else {
-        while (sp) {
-            if (STREQ(sp->name, spn->name)) {
-                sp->cnt++;
-                spn->cnt++;
-            }
-            if (sp->name_hash_next)
-                sp = sp->name_hash_next;
-            else {
-                sp->name_hash_next = spn;
-                break;
-            }
+    const uint64_t all = (1ULL << NR_NEEDED_SYMBOLS) - 1;
+    uint64_t seen = 0, excluded = 0;
+    struct sysmap_line l;
+    struct sysmap m;
+    const char *p;
+    ulong lines = 0;
+    int id;
+
+    if (sysmap_open(map_file, &m))
+        return -1;
+
+    if (!(pc->flags & WATCH_CRASH))
+        excluded |= NEEDED_SYMBOLS_WATCH;
+    if (!(pc->flags & MERGE))
+        excluded |= NEEDED_SYMBOLS_MERGE;
+
+    for (p = m.base; (p = sysmap_next(&m, p, &l)); lines++) {
+        if ((id = needed_symbol_id(l.name, l.name_len)) < 0 ||
+                (seen & (1ULL << id)))
+            continue;
+
+        needed_symbol_set(id, l.addr);
+        seen |= 1ULL << id;
+        excluded |= needed_symbol_excludes[id];
+
+        if (!(all & ~excluded & ~seen)) {
+            lines++;
+            break;
         }
     }
+
+    if (KDEBUG(1))
+        pr_debug("System.map: scanned %lu lines, %s", lines,
+                p ? "stopped early" : "read to the end");
+
+    sysmap_close(&m);
+    return 0;
 }
 
-static struct syment *symname_hash_search(const char *name)
+/*
+ * Compile the map in the background so that the next run can skip the
+ * scan.  This needs every symbol and would defeat the early exit above.
+ */
+static void *symindex_build_thread(void *arg)
 {
-    struct syment *sp;
+    struct symindex_builder b;
+    const char *map_file = arg;
 
-    sp = st->symname_hash[SYMNAME_HASH_INDEX(name)];
+    if (symindex_parse_map(map_file, &b))
+        return NULL;
 
-    while (sp) {
-        if (STREQ(sp->name, name))
-            return sp;
-        sp = sp->name_hash_next;
+    symindex_write(&b, map_file);
+    symindex_builder_free(&b);
+    return NULL;
+}
+
+static int symname_hash_init_vmlinux(const char *path)
+{
+    struct symindex_builder *b = &vmlinux_syms;
+    const char *name;
+    const void *data;
+    size_t len;
+    uint32_t i;
+    int id;
+
+    if (vmlinux_open(path, &vmlinux))
+        return -1;
+    if (vmlinux_read_symbols(&vmlinux, b))
+        return -1;
+
+    for (i = 0; i < b->nr_syms; i++) {
+        name = b->pool + b->names[i];
+        if ((id = needed_symbol_id(name, strlen(name))) >= 0)
+            needed_symbol_set(id, b->addrs[i]);
     }
 
-    return NULL;
+    if ((data = vmlinux_section(&vmlinux, ".BTF", &len)))
+        btf_load_data(data, len);
+
+    if (KDEBUG(1))
+        pr_debug("vmlinux: %u symbols, %s", b->nr_syms,
+                btf_loaded() ? "BTF" : "no BTF");
+    return 0;
 }
 
 static void symname_hash_init(const char *map_file)
 {
-   FILE *file = fopen(map_file, "r");
-    if (file == NULL) {
-        pr_err("Error opening file");
+    if (is_vmlinux_file(map_file)) {
+        symname_hash_init_vmlinux(map_file);
         return;
     }
 
-    char line[MAX_LINE_LENGTH];
-    while (fgets(line, sizeof(line), file)) {
-        ulong address;
-        char symbol[MAX_LINE_LENGTH];
+    if (symname_hash_init_index(map_file) == 0)
+        return;
 
-        if (sscanf(line, "%lx %*s %s", &address, symbol) == 2) {
-            if (symbol_needed(symbol)) {
-                struct syment *sp = (struct syment *)calloc(1, sizeof(struct syment));
-                sp->value = address;
-                sp->name = strdup(symbol);
-                symname_hash_install(sp);
-            }
+    if (symname_hash_scan_map(map_file))
+        return;
 
-        }
-    }
+    if (!(pc->flags & NO_CACHE) &&
+            !pthread_create(&symindex_thread, NULL, symindex_build_thread,
+                (void *)map_file))
+        symindex_thread_started = TRUE;
 }
 
 int kernel_symbol_exists(char *symbol)
@@ -124,6 +212,31 @@ int kernel_symbol_exists(char *symbol)
         return FALSE;
 }
 
+/*
+ * Add a symbol learned from elsewhere (VMCOREINFO) with its link-time
+ * value.  Only symbols we look up by name are kept.
+ */
+int symbol_install(const char *name, ulong value)
+{
+    int id;
+
+    if ((id = needed_symbol_id(name, strlen(name))) < 0)
+        return -1;
+
+    needed_symbol_set(id, value);
+    return 0;
+}
+
+/* Call fn with the name and link-time value of every symbol kept. */
+void symbol_foreach(void (*fn)(const char *, ulong, void *), void *arg)
+{
+    int id;
+
+    for (id = 0; id < NR_NEEDED_SYMBOLS; id++)
+        if (needed_syms[id].name)
+            fn(needed_syms[id].name, needed_syms[id].value, arg);
+}
+
 struct syment *symbol_search(char *s)
 {
     return symname_hash_search(s);
@@ -162,8 +275,15 @@ void get_symbol_data(char *symbol, long size, void *local)
 
 void symtab_init(const char *map_file)
 {
+    symtab_map_file = map_file;
     symname_hash_init(map_file);
 
+    /* an explicit --btf wins over the .BTF of a vmlinux */
+    if (pc->btf_file) {
+        btf_release();
+        btf_load_file(pc->btf_file);
+    }
+
     if (kernel_symbol_exists("asm_exc_divide_error")) {
         st->divide_error_vmlinux = symbol_value("asm_exc_divide_error");
     } else {
@@ -172,3 +292,184 @@ void symtab_init(const char *map_file)
 
     st->idt_table_vmlinux = symbol_value("idt_table");
 }
+
+/*
+ * Full table of kernel text symbols for --symbolize.
+ *
+ * Addresses are stored once sorted (for the symbol size) and once in
+ * Eytzinger order: the search descends an implicit binary tree laid out
+ * breadth first, so the first levels share a few cache lines and the next
+ * level can be prefetched while the current one is compared.
+ */
+struct text_symtab {
+    uint32_t nr;
+    uint64_t *addrs;            /* sorted */
+    const char **names;
+    uint64_t *eytz;             /* 1-based Eytzinger order */
+    uint32_t *eytz_rank;        /* sorted index of each Eytzinger slot */
+    uint64_t end;               /* _etext */
+    struct symindex_builder b;  /* owns the names without an index */
+};
+
+static struct text_symtab text_symtab;
+
+static uint32_t eytzinger_fill(struct text_symtab *t, uint32_t i, uint32_t k)
+{
+    if (k <= t->nr) {
+        i = eytzinger_fill(t, i, 2 * k);
+        t->eytz[k] = t->addrs[i];
+        t->eytz_rank[k] = i++;
+        i = eytzinger_fill(t, i, 2 * k + 1);
+    }
+    return i;
+}
+
+static int is_text_type(char type)
+{
+    return type == 't' || type == 'T';
+}
+
+int symtab_full_init(void)
+{
+    struct text_symtab *t = &text_symtab;
+    const uint64_t *addrs;
+    const char *types;
+    const char *name;
+    uint32_t i, nr;
+
+    if (t->nr)
+        return 0;
+
+    if (vmlinux_syms.addrs) {
+        t->b = vmlinux_syms;
+        memset(&vmlinux_syms, 0, sizeof(vmlinux_syms));
+        addrs = t->b.addrs;
+        types = t->b.types;
+        nr = t->b.nr_syms;
+    } else if (symindex.base) {
+        addrs = symindex.addrs;
+        types = symindex.types;
+        nr = symindex.hdr->nr_syms;
+    } else {
+        if (symindex_parse_map(symtab_map_file, &t->b))
+            return -1;
+        addrs = t->b.addrs;
+        types = t->b.types;
+        nr = t->b.nr_syms;
+    }
+
+    t->addrs = xmalloc(nr * sizeof(*t->addrs));
+    t->names = xmalloc(nr * sizeof(*t->names));
+    for (i = 0; i < nr; i++) {
+        name = symindex.base ? symindex_name(&symindex, i) :
+            t->b.pool + t->b.names[i];
+        if (!strcmp(name, "_etext"))
+            t->end = addrs[i];
+        if (!is_text_type(types[i]))
+            continue;
+        t->addrs[t->nr] = addrs[i];
+        t->names[t->nr] = name;
+        t->nr++;
+    }
+
+    if (!t->nr) {
+        pr_err("No text symbols in %s", symtab_map_file);
+        return -1;
+    }
+    if (!t->end)
+        t->end = t->addrs[t->nr - 1] + 1;
+
+    t->eytz = xmalloc((t->nr + 1) * sizeof(*t->eytz));
+    t->eytz_rank = xmalloc((t->nr + 1) * sizeof(*t->eytz_rank));
+    eytzinger_fill(t, 0, 1);
+
+    if (KDEBUG(1))
+        pr_debug("symbolize: %u text symbols, %lx-%lx", t->nr,
+                (ulong)t->addrs[0], (ulong)t->end);
+    return 0;
+}
+
+/*
+ * The text symbol containing the (relocated) kernel address addr.
+ */
+const char *symbol_lookup(ulong addr, ulong *offset, ulong *size)
+{
+    struct text_symtab *t = &text_symtab;
+    uint64_t vaddr = addr;
+    uint32_t k = 1, i;
+
+    if (!t->nr)
+        return NULL;
+
+    if (kt->flags & RELOC_SET)
+        vaddr += kt->relocate;
+    if (vaddr < t->addrs[0] || vaddr >= t->end)
+        return NULL;
+
+    /* k ends up at the first slot greater than vaddr, 0 if there is none */
+    while (k <= t->nr) {
+        __builtin_prefetch(t->eytz + 16 * k);
+        k = 2 * k + (t->eytz[k] <= vaddr);
+    }
+    k >>= __builtin_ffs(~k);
+
+    i = (k ? t->eytz_rank[k] : t->nr) - 1;
+    *offset = vaddr - t->addrs[i];
+    *size = (i + 1 < t->nr ? t->addrs[i + 1] : t->end) - t->addrs[i];
+    return t->names[i];
+}
+
+/*
+ * If p starts with a raw "[<address>]" in kernel text, write it to out as
+ * func+0xoff/0xsize.  Returns the length written, 0 when p is left alone.
+ */
+size_t symbolize_address(const char *p, size_t left, char *out, size_t room)
+{
+    const char *name;
+    ulong addr, offset, size;
+    uint64_t v;
+    int n;
+
+    if (left < SYMBOLIZE_ADDR_LEN || p[0] != '[' || p[1] != '<' ||
+            p[18] != '>' || p[19] != ']')
+        return 0;
+    if (sysmap_parse_hex(p + 2, p + 18, &v) != p + 18)
+        return 0;
+
+    addr = v;
+    if (!(name = symbol_lookup(addr, &offset, &size)))
+        return 0;
+
+    n = snprintf(out, room, "%s+0x%lx/0x%lx", name, offset, size);
+    if (n < 0 || (size_t)n >= room)
+        return 0;
+    return n;
+}
+
+static void text_symtab_free(void)
+{
+    struct text_symtab *t = &text_symtab;
+
+    xfree(t->addrs);
+    xfree(t->names);
+    xfree(t->eytz);
+    xfree(t->eytz_rank);
+    if (t->b.addrs)
+        symindex_builder_free(&t->b);
+    memset(t, 0, sizeof(*t));
+}
+
+void symtab_release(void)
+{
+    vmcoreinfo_release();
+    text_symtab_free();
+    btf_release();
+    if (vmlinux_syms.addrs)
+        symindex_builder_free(&vmlinux_syms);
+    vmlinux_close(&vmlinux);
+    if (symindex_thread_started) {
+        pthread_join(symindex_thread, NULL);
+        symindex_thread_started = FALSE;
+    }
+    symindex_close(&symindex);
+}
@@ -0,0 +1,137 @@
+/* symbols_needed.h
+ *
+ * Generated by scripts/gen_symbols_needed.py, do not edit.
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SYMBOLS_NEEDED_H__
+#define __SYMBOLS_NEEDED_H__
+
+#include <stdint.h>
+#include <string.h>
+
+enum needed_symbol {
+    SYM_log_first_idx,
+    SYM_log_next_idx,
+    SYM_log_buf,
+    SYM_log_end,
+    SYM_log_buf_len,
+    SYM_divide_error,
+    SYM_asm_exc_divide_error,
+    SYM_idt_table,
+    SYM_vmcoreinfo_data,
+    SYM_vmcoreinfo_size,
+    SYM_page_offset_base,
+    SYM_vmalloc_base,
+    SYM__end,
+    SYM_linux_banner,
+    SYM_prb,
+    SYM_panic_cpu,
+    SYM_oops_in_progress,
+    SYM_tainted_mask,
+    SYM_panic_on_oops,
+    SYM_crash_kexec_post_notifiers,
+    SYM_log_next_seq,
+    SYM_tk_core,
+    NR_NEEDED_SYMBOLS
+};
+
+#define NEEDED_SYMBOLS_MAX_LEN  (26)
+#define NEEDED_SYMBOLS_HASH_SIZE (64)
+#define NEEDED_SYMBOLS_WATCH    (0x1f8000ULL)
+#define NEEDED_SYMBOLS_MERGE    (0x200000ULL)
+
+static const char *const needed_symbol_names[NR_NEEDED_SYMBOLS] = {
+    "log_first_idx",
+    "log_next_idx",
+    "log_buf",
+    "log_end",
+    "log_buf_len",
+    "divide_error",
+    "asm_exc_divide_error",
+    "idt_table",
+    "vmcoreinfo_data",
+    "vmcoreinfo_size",
+    "page_offset_base",
+    "vmalloc_base",
+    "_end",
+    "linux_banner",
+    "prb",
+    "panic_cpu",
+    "oops_in_progress",
+    "tainted_mask",
+    "panic_on_oops",
+    "crash_kexec_post_notifiers",
+    "log_next_seq",
+    "tk_core",
+};
+
+static const unsigned char needed_symbol_lens[NR_NEEDED_SYMBOLS] = {
+    13, 12, 7, 7, 11, 12, 20, 9, 15, 15, 16, 12, 4, 12, 3, 9, 16, 12, 13, 26, 12, 7,
+};
+
+/* symbols that are no longer expected once this one has been seen */
+static const uint64_t needed_symbol_excludes[NR_NEEDED_SYMBOLS] = {
+    0x4008ULL,        /* log_first_idx */
+    0x4008ULL,        /* log_next_idx */
+    0x0ULL,           /* log_buf */
+    0x104003ULL,      /* log_end */
+    0x0ULL,           /* log_buf_len */
+    0x40ULL,          /* divide_error */
+    0x20ULL,          /* asm_exc_divide_error */
+    0x0ULL,           /* idt_table */
+    0x0ULL,           /* vmcoreinfo_data */
+    0x0ULL,           /* vmcoreinfo_size */
+    0x0ULL,           /* page_offset_base */
+    0x0ULL,           /* vmalloc_base */
+    0x0ULL,           /* _end */
+    0x0ULL,           /* linux_banner */
+    0x10000bULL,      /* prb */
+    0x0ULL,           /* panic_cpu */
+    0x0ULL,           /* oops_in_progress */
+    0x0ULL,           /* tainted_mask */
+    0x0ULL,           /* panic_on_oops */
+    0x0ULL,           /* crash_kexec_post_notifiers */
+    0x4008ULL,        /* log_next_seq */
+    0x0ULL,           /* tk_core */
+};
+
+static const signed char needed_symbol_slots[NEEDED_SYMBOLS_HASH_SIZE] = {
+    -1, -1, -1, 18,  8, -1,  4, 21,  9, -1, -1, -1, -1, 12, -1, -1,
+    -1, -1, -1,  0, -1,  6, -1, -1, -1, -1, -1, -1, -1,  5, -1, -1,
+    -1, 20, 16,  7, 10, 15, -1, 14,  1, -1,  3, 19,  2, -1, -1, -1,
+    -1, -1, -1, -1, 13, -1, 11, -1, -1, -1, -1, -1, -1, -1, -1, 17,
+};
+
+static inline int needed_symbol_id(const char *s, size_t len)
+{
+    unsigned int h;
+    int id;
+
+    if (len == 0 || len > NEEDED_SYMBOLS_MAX_LEN)
+        return -1;
+
+    h = ((unsigned char)s[0] * 1u + (unsigned char)s[len - 1] * 1u +
+         (unsigned char)s[len / 2] * 5u + len * 9u) &
+        (NEEDED_SYMBOLS_HASH_SIZE - 1);
+    id = needed_symbol_slots[h];
+
+    if (id < 0 || needed_symbol_lens[id] != len ||
+            memcmp(s, needed_symbol_names[id], len))
+        return -1;
+
+    return id;
+}
+
+#endif
@@ -0,0 +1,448 @@
+/* symindex.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "bootcache.h"
+#include "symindex.h"
+#include "sysmap.h"
+
+/*
+ * Compiled System.map.  Parsing a map costs a pass over 100k+ lines; the
+ * index is built once (kvm-dmesg --index, or automatically on the first
+ * run) and later runs mmap it read-only.  Because the mapping is shared,
+ * every kvm-dmesg process looking at guests that run the same kernel uses
+ * the same page cache copy.
+ *
+ * The index sits next to the map as <map>.kdmidx, or in BOOTCACHE_DIR when
+ * the map directory is not writable, and is matched to its map by size
+ * and mtime.  The content hash identifies the kernel build.
+ */
+#define SYMINDEX_MAGIC      "KDMSYMIX"
+#define SYMINDEX_VERSION    (2)
+
+#define FNV64_OFFSET        (0xcbf29ce484222325ULL)
+#define FNV64_PRIME         (0x100000001b3ULL)
+
+static uint64_t fnv64(uint64_t h, const char *s, size_t len)
+{
+    while (len--) {
+        h ^= (unsigned char)*s++;
+        h *= FNV64_PRIME;
+    }
+    return h;
+}
+
+static uint32_t symindex_hash(const char *name)
+{
+    uint32_t h = 2166136261U;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void symindex_paths(const char *map_file, struct stat *sb,
+        char *primary, char *fallback, size_t len)
+{
+    snprintf(primary, len, "%s" SYMINDEX_SUFFIX, map_file);
+    snprintf(fallback, len, BOOTCACHE_DIR "/%lx-%lx" SYMINDEX_SUFFIX,
+            (ulong)sb->st_dev, (ulong)sb->st_ino);
+}
+
+void symindex_builder_add(struct symindex_builder *b, uint64_t addr, char type,
+        const char *name, size_t name_len)
+{
+    size_t len = name_len + 1;
+
+    if (b->nr_syms == b->max_syms) {
+        b->max_syms = b->max_syms ? b->max_syms * 2 : 4096;
+        b->addrs = xrealloc(b->addrs, b->max_syms * sizeof(*b->addrs));
+        b->names = xrealloc(b->names, b->max_syms * sizeof(*b->names));
+        b->types = xrealloc(b->types, b->max_syms * sizeof(*b->types));
+    }
+
+    while (b->pool_size + len > b->max_pool) {
+        b->max_pool = b->max_pool ? b->max_pool * 2 : 256 * 1024;
+        b->pool = xrealloc(b->pool, b->max_pool);
+    }
+
+    b->addrs[b->nr_syms] = addr;
+    b->names[b->nr_syms] = b->pool_size;
+    b->types[b->nr_syms] = type;
+    memcpy(b->pool + b->pool_size, name, name_len);
+    b->pool[b->pool_size + name_len] = '\0';
+    b->pool_size += len;
+    b->nr_syms++;
+}
+
+static struct symindex_builder *sort_builder;
+
+static int cmp_sym(const void *a, const void *b)
+{
+    uint32_t i = *(const uint32_t *)a, j = *(const uint32_t *)b;
+    uint64_t x = sort_builder->addrs[i], y = sort_builder->addrs[j];
+
+    if (x != y)
+        return x < y ? -1 : 1;
+    return i < j ? -1 : (i > j);
+}
+
+/* System.map is normally sorted already, only reorder when it is not */
+void symindex_builder_sort(struct symindex_builder *b)
+{
+    uint64_t *addrs;
+    uint32_t *names, *order, i;
+    char *types;
+
+    for (i = 1; i < b->nr_syms; i++) {
+        if (b->addrs[i - 1] > b->addrs[i])
+            break;
+    }
+    if (i >= b->nr_syms)
+        return;
+
+    order = xmalloc(b->nr_syms * sizeof(*order));
+    for (i = 0; i < b->nr_syms; i++)
+        order[i] = i;
+    sort_builder = b;
+    qsort(order, b->nr_syms, sizeof(*order), cmp_sym);
+
+    addrs = xmalloc(b->max_syms * sizeof(*addrs));
+    names = xmalloc(b->max_syms * sizeof(*names));
+    types = xmalloc(b->max_syms * sizeof(*types));
+    for (i = 0; i < b->nr_syms; i++) {
+        addrs[i] = b->addrs[order[i]];
+        names[i] = b->names[order[i]];
+        types[i] = b->types[order[i]];
+    }
+    xfree(b->addrs);
+    xfree(b->names);
+    xfree(b->types);
+    xfree(order);
+    b->addrs = addrs;
+    b->names = names;
+    b->types = types;
+}
+
+/* FNV-1a over 64-bit words, the map is only hashed to identify it */
+static uint64_t hash_map(const char *p, size_t len)
+{
+    uint64_t h = FNV64_OFFSET, w;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * FNV64_PRIME;
+    }
+    return fnv64(h, p, len);
+}
+
+int symindex_parse_map(const char *map_file, struct symindex_builder *b)
+{
+    struct sysmap_line l;
+    struct sysmap m;
+    const char *p;
+
+    memset(b, 0, sizeof(*b));
+
+    if (sysmap_open(map_file, &m))
+        return -1;
+
+    b->map_size = m.sb.st_size;
+    b->map_mtime = m.sb.st_mtime;
+    b->map_hash = hash_map(m.base, m.len);
+
+    for (p = m.base; (p = sysmap_next(&m, p, &l)); ) {
+        if (l.name_len)
+            symindex_builder_add(b, l.addr, l.type, l.name, l.name_len);
+    }
+    sysmap_close(&m);
+
+    symindex_builder_sort(b);
+    return 0;
+}
+
+void symindex_builder_free(struct symindex_builder *b)
+{
+    xfree(b->addrs);
+    xfree(b->names);
+    xfree(b->types);
+    xfree(b->pool);
+    memset(b, 0, sizeof(*b));
+}
+
+static int write_index_file(const char *path, const char *buf, size_t len)
+{
+    char tmp[PATH_MAX + 16];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        return -1;
+
+    if (xwrite(fd, buf, len) != len) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int symindex_write(struct symindex_builder *b, const char *map_file)
+{
+    char primary[PATH_MAX], fallback[PATH_MAX];
+    struct symindex_header header, *hdr = &header;
+    uint32_t *chain, *buckets, h, i;
+    struct stat sb;
+    size_t len;
+    char *buf;
+    int ret;
+
+    if (stat(map_file, &sb))
+        return -1;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, SYMINDEX_MAGIC, sizeof(hdr->magic));
+    hdr->version = SYMINDEX_VERSION;
+    hdr->nr_syms = b->nr_syms;
+    hdr->map_size = b->map_size;
+    hdr->map_mtime = b->map_mtime;
+    hdr->map_hash = b->map_hash;
+    for (hdr->nr_buckets = 1; hdr->nr_buckets < b->nr_syms; )
+        hdr->nr_buckets <<= 1;
+    hdr->pool_size = b->pool_size;
+
+    len = roundup(sizeof(*hdr), 8);
+    hdr->addrs_off = len;
+    len += b->nr_syms * sizeof(uint64_t);
+    hdr->names_off = len;
+    len += b->nr_syms * sizeof(uint32_t);
+    hdr->chain_off = len;
+    len += b->nr_syms * sizeof(uint32_t);
+    hdr->buckets_off = len;
+    len += hdr->nr_buckets * sizeof(uint32_t);
+    hdr->types_off = len;
+    len += b->nr_syms;
+    hdr->pool_off = len;
+    len += b->pool_size;
+
+    buf = xcalloc(1, len);
+    memcpy(buf, hdr, sizeof(*hdr));
+    memcpy(buf + hdr->addrs_off, b->addrs, b->nr_syms * sizeof(uint64_t));
+    memcpy(buf + hdr->names_off, b->names, b->nr_syms * sizeof(uint32_t));
+    memcpy(buf + hdr->types_off, b->types, b->nr_syms);
+    memcpy(buf + hdr->pool_off, b->pool, b->pool_size);
+
+    /* walk backwards so that a bucket lists duplicates lowest address first */
+    chain = (uint32_t *)(buf + hdr->chain_off);
+    buckets = (uint32_t *)(buf + hdr->buckets_off);
+    for (i = b->nr_syms; i-- > 0; ) {
+        h = symindex_hash(b->pool + b->names[i]) & (hdr->nr_buckets - 1);
+        chain[i] = buckets[h];
+        buckets[h] = i + 1;
+    }
+
+    symindex_paths(map_file, &sb, primary, fallback, sizeof(primary));
+    ret = write_index_file(primary, buf, len);
+    if (ret) {
+        if (mkdir(BOOTCACHE_DIR, 0700) && errno != EEXIST) {
+            xfree(buf);
+            return -1;
+        }
+        ret = write_index_file(fallback, buf, len);
+    }
+
+    if (KDEBUG(1))
+        pr_debug("symindex: %s %u symbols (map hash %016lx)",
+                ret ? "failed to write" : "wrote", b->nr_syms,
+                (ulong)b->map_hash);
+
+    xfree(buf);
+    return ret;
+}
+
+/* [off, off + nr * size) lies in the file and is aligned for its type */
+static int symindex_section_ok(uint64_t off, uint64_t nr, uint64_t size,
+        uint64_t len)
+{
+    return off >= sizeof(struct symindex_header) && off % size == 0 &&
+        off <= len && nr <= (len - off) / size;
+}
+
+/*
+ * The index lives in a writable directory when the map's own is not, so
+ * nothing in it is trusted: every section must lie in the file, and every
+ * symbol and chain link within the arrays.  symindex_write() only links a
+ * symbol to a later one, so a chain that does not move forward is a loop.
+ */
+static int symindex_check(const struct symindex_header *hdr, const char *base,
+        uint64_t len)
+{
+    const uint32_t *names, *chain, *buckets;
+    uint32_t i;
+
+    if (!hdr->nr_buckets || (hdr->nr_buckets & (hdr->nr_buckets - 1)) ||
+            !symindex_section_ok(hdr->addrs_off, hdr->nr_syms,
+                sizeof(uint64_t), len) ||
+            !symindex_section_ok(hdr->names_off, hdr->nr_syms,
+                sizeof(uint32_t), len) ||
+            !symindex_section_ok(hdr->chain_off, hdr->nr_syms,
+                sizeof(uint32_t), len) ||
+            !symindex_section_ok(hdr->buckets_off, hdr->nr_buckets,
+                sizeof(uint32_t), len) ||
+            !symindex_section_ok(hdr->types_off, hdr->nr_syms, 1, len) ||
+            !symindex_section_ok(hdr->pool_off, hdr->pool_size, 1, len) ||
+            !hdr->pool_size || base[hdr->pool_off + hdr->pool_size - 1])
+        return -1;
+
+    names = (const uint32_t *)(base + hdr->names_off);
+    chain = (const uint32_t *)(base + hdr->chain_off);
+    buckets = (const uint32_t *)(base + hdr->buckets_off);
+
+    for (i = 0; i < hdr->nr_syms; i++) {
+        if (names[i] >= hdr->pool_size || chain[i] > hdr->nr_syms ||
+                (chain[i] && chain[i] <= i + 1))
+            return -1;
+    }
+    for (i = 0; i < hdr->nr_buckets; i++) {
+        if (buckets[i] > hdr->nr_syms)
+            return -1;
+    }
+    return 0;
+}
+
+static int symindex_map(const char *path, struct stat *map_sb,
+        struct symindex *ix)
+{
+    const struct symindex_header *hdr;
+    struct stat sb;
+    void *base;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    hdr = base;
+    if (memcmp(hdr->magic, SYMINDEX_MAGIC, sizeof(hdr->magic)) ||
+            hdr->version != SYMINDEX_VERSION ||
+            hdr->map_size != (uint64_t)map_sb->st_size ||
+            hdr->map_mtime != (uint64_t)map_sb->st_mtime ||
+            hdr->pool_off + hdr->pool_size != (uint64_t)sb.st_size ||
+            symindex_check(hdr, base, sb.st_size)) {
+        munmap(base, sb.st_size);
+        return -1;
+    }
+
+    ix->base = base;
+    ix->len = sb.st_size;
+    ix->hdr = hdr;
+    ix->addrs = (const uint64_t *)((char *)base + hdr->addrs_off);
+    ix->names = (const uint32_t *)((char *)base + hdr->names_off);
+    ix->chain = (const uint32_t *)((char *)base + hdr->chain_off);
+    ix->buckets = (const uint32_t *)((char *)base + hdr->buckets_off);
+    ix->types = (const char *)base + hdr->types_off;
+    ix->pool = (const char *)base + hdr->pool_off;
+
+    return 0;
+}
+
+int symindex_open(const char *map_file, struct symindex *ix)
+{
+    char primary[PATH_MAX], fallback[PATH_MAX];
+    struct stat sb;
+
+    memset(ix, 0, sizeof(*ix));
+
+    if (stat(map_file, &sb))
+        return -1;
+
+    symindex_paths(map_file, &sb, primary, fallback, sizeof(primary));
+    if (symindex_map(primary, &sb, ix) && symindex_map(fallback, &sb, ix))
+        return -1;
+
+    if (KDEBUG(1))
+        pr_debug("symindex: mapped %u symbols (map hash %016lx)",
+                ix->hdr->nr_syms, (ulong)ix->hdr->map_hash);
+    return 0;
+}
+
+void symindex_close(struct symindex *ix)
+{
+    if (ix->base)
+        munmap(ix->base, ix->len);
+    memset(ix, 0, sizeof(*ix));
+}
+
+long symindex_lookup(const struct symindex *ix, const char *name)
+{
+    uint32_t i;
+
+    i = ix->buckets[symindex_hash(name) & (ix->hdr->nr_buckets - 1)];
+    while (i) {
+        if (!strcmp(symindex_name(ix, i - 1), name))
+            return i - 1;
+        i = ix->chain[i - 1];
+    }
+
+    return -1;
+}
+
+/* kvm-dmesg --index System.map */
+int symindex_create(const char *map_file)
+{
+    struct symindex_builder b;
+    int ret;
+
+    if (symindex_parse_map(map_file, &b))
+        return -1;
+
+    ret = symindex_write(&b, map_file);
+    if (ret)
+        pr_err("Failed to write the index for %s", map_file);
+    else
+        fprintf(fp, "Indexed %u symbols from %s\n", b.nr_syms, map_file);
+
+    symindex_builder_free(&b);
+    return ret;
+}
@@ -0,0 +1,96 @@
+/* symindex.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SYMINDEX_H__
+#define __SYMINDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SYMINDEX_SUFFIX     ".kdmidx"
+
+/*
+ * On-disk layout, all offsets are from the start of the file:
+ *
+ *   header
+ *   uint64_t addrs[nr_syms]        sorted by address
+ *   uint32_t names[nr_syms]        offset of the name in the string pool
+ *   uint32_t chain[nr_syms]        next symbol in the hash bucket, + 1
+ *   uint32_t buckets[nr_buckets]   first symbol in the hash bucket, + 1
+ *   char     types[nr_syms]        System.map type letter
+ *   char     pool[pool_size]       NUL terminated names
+ */
+struct symindex_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nr_syms;
+    uint64_t map_size;
+    uint64_t map_mtime;
+    uint64_t map_hash;              /* hash of the System.map contents */
+    uint32_t nr_buckets;            /* power of two */
+    uint32_t pool_size;
+    uint64_t addrs_off;
+    uint64_t names_off;
+    uint64_t chain_off;
+    uint64_t buckets_off;
+    uint64_t types_off;
+    uint64_t pool_off;
+};
+
+struct symindex {
+    void *base;
+    size_t len;
+    const struct symindex_header *hdr;
+    const uint64_t *addrs;
+    const uint32_t *names;
+    const uint32_t *chain;
+    const uint32_t *buckets;
+    const char *types;
+    const char *pool;
+};
+
+struct symindex_builder {
+    uint32_t nr_syms;
+    uint32_t max_syms;
+    uint64_t *addrs;
+    uint32_t *names;
+    char *types;
+    char *pool;
+    uint32_t pool_size;
+    uint32_t max_pool;
+    uint64_t map_size;
+    uint64_t map_mtime;
+    uint64_t map_hash;
+};
+
+void symindex_builder_add(struct symindex_builder *b, uint64_t addr, char type,
+        const char *name, size_t name_len);
+void symindex_builder_sort(struct symindex_builder *b);
+int symindex_parse_map(const char *map_file, struct symindex_builder *b);
+int symindex_write(struct symindex_builder *b, const char *map_file);
+void symindex_builder_free(struct symindex_builder *b);
+
+int symindex_open(const char *map_file, struct symindex *ix);
+void symindex_close(struct symindex *ix);
+long symindex_lookup(const struct symindex *ix, const char *name);
+
+static inline const char *symindex_name(const struct symindex *ix, long i)
+{
+    return ix->pool + ix->names[i];
+}
+
+int symindex_create(const char *map_file);
+
+#endif
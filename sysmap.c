@@ -0,0 +1,59 @@
+/* sysmap.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "sysmap.h"
+
+int sysmap_open(const char *map_file, struct sysmap *m)
+{
+    void *base;
+    int fd;
+
+    memset(m, 0, sizeof(*m));
+
+    if ((fd = open(map_file, O_RDONLY)) == -1) {
+        pr_err("Error opening file: %s", map_file);
+        return -1;
+    }
+
+    if (fstat(fd, &m->sb) || m->sb.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, m->sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        pr_err("Failed to mmap %s", map_file);
+        return -1;
+    }
+    madvise(base, m->sb.st_size, MADV_SEQUENTIAL);
+
+    m->base = base;
+    m->len = m->sb.st_size;
+    return 0;
+}
+
+void sysmap_close(struct sysmap *m)
+{
+    if (m->base)
+        munmap((void *)m->base, m->len);
+    m->base = NULL;
+}
@@ -0,0 +1,120 @@
+/* sysmap.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __SYSMAP_H__
+#define __SYSMAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * mmap'ed System.map scanner.  Lines look like
+ *
+ *   ffffffff81000000 T _text
+ *
+ * and are split without sscanf: newlines are located 16 bytes at a time
+ * and the address is converted by hand.
+ */
+struct sysmap {
+    const char *base;
+    size_t len;
+    struct stat sb;
+};
+
+struct sysmap_line {
+    uint64_t addr;
+    char type;
+    const char *name;
+    size_t name_len;        /* 0 for lines that do not parse */
+};
+
+int sysmap_open(const char *map_file, struct sysmap *m);
+void sysmap_close(struct sysmap *m);
+
+static inline const char *sysmap_find_eol(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    unsigned int mask;
+
+    while (end - p >= 16) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)p), nl));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\n')
+        p++;
+    return p;
+}
+
+static inline const char *sysmap_parse_hex(const char *p, const char *end,
+        uint64_t *val)
+{
+    uint64_t v = 0;
+    unsigned int c;
+
+    for (; p < end; p++) {
+        c = (unsigned char)*p;
+        if (c - '0' < 10)
+            c -= '0';
+        else if ((c | 0x20) - 'a' < 6)
+            c = (c | 0x20) - 'a' + 10;
+        else
+            break;
+        v = (v << 4) | c;
+    }
+
+    *val = v;
+    return p;
+}
+
+/*
+ * Parse the line starting at p into l and return the start of the next
+ * line, or NULL at the end of the map.
+ */
+static inline const char *sysmap_next(const struct sysmap *m, const char *p,
+        struct sysmap_line *l)
+{
+    const char *end = m->base + m->len;
+    const char *eol, *q, *name;
+
+    if (p >= end)
+        return NULL;
+
+    eol = sysmap_find_eol(p, end);
+    l->name_len = 0;
+
+    q = sysmap_parse_hex(p, eol, &l->addr);
+    if (q == p || eol - q < 4 || q[0] != ' ' || q[2] != ' ')
+        goto out;
+
+    l->type = q[1];
+    name = q + 3;
+    for (q = name; q < eol && *q != ' ' && *q != '\t' && *q != '\r'; q++)
+        ;
+    l->name = name;
+    l->name_len = q - name;
+out:
+    return eol + 1;
+}
+
+#endif
@@ -72,7 +72,10 @@ def kvmdmesg_test(sysmap_path):
             print(line, end="")
             if " Linux version " in line:
                 print("\n" + Colors.GREEN + "Test ok!" + Colors.ENDC + "\n")
-                return True
+                # the monitor takes one client at a time
+                process.terminate()
+                process.wait()
+                return kvmdmesg_replay_test(sysmap_path)
 
         print("\n" + Colors.RED + "Test failed." + Colors.ENDC + "\n")
 
@@ -83,6 +86,69 @@ def kvmdmesg_test(sysmap_path):
         print(f"Error occurred while starting kvm-dmesg: {e}")
         return False
 
+def kvmdmesg_run(args):
+    command = ["../kvm-dmesg"] + args
+    print(f"Running command: {' '.join(command)}")
+    try:
+        result = subprocess.run(command, stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE, timeout=120)
+    except subprocess.TimeoutExpired:
+        print(Colors.RED + "kvm-dmesg timed out." + Colors.ENDC)
+        return None
+    if result.returncode != 0:
+        print(result.stderr.decode('utf-8', errors='replace'))
+        return None
+    return result.stdout.decode('utf-8', errors='replace')
+
+def kvmdmesg_same(name, expected, args):
+    output = kvmdmesg_run(args)
+    if output is not None and output == expected:
+        print(Colors.GREEN + f"{name}: same log as the live guest" + Colors.ENDC)
+        return True
+    print(Colors.RED + f"{name}: log differs from the live guest" + Colors.ENDC)
+    return False
+
+def kvmdmesg_replay_test(sysmap_path):
+    """Decode the log again from a capture and from guest memory dumps."""
+    capture_path = "/tmp/kvm-dmesg-test.cap"
+    core_path = "/tmp/kvm-dmesg-test.core"
+    kdump_path = "/tmp/kvm-dmesg-test.kdump"
+
+    # stopped, the guest logs nothing between the runs
+    if monitor_command("stop") is None:
+        return False
+
+    passed = True
+    try:
+        live = kvmdmesg_run([sysmap_path, '/tmp/qmp.sock'])
+        if live is None:
+            return False
+
+        if kvmdmesg_run([sysmap_path, '/tmp/qmp.sock',
+                         '--capture', capture_path]) is None:
+            passed = False
+        elif not kvmdmesg_same("--from-capture", live,
+                               ['--from-capture', capture_path]):
+            passed = False
+
+        if monitor_command(f"dump-guest-memory {core_path}") is None or \
+                not kvmdmesg_same("ELF core", live, [sysmap_path, core_path]):
+            passed = False
+        if os.path.exists(core_path):
+            os.remove(core_path)
+
+        if monitor_command(f"dump-guest-memory -z {kdump_path}") is None or \
+                not kvmdmesg_same("kdump zlib", live,
+                                  [sysmap_path, kdump_path]):
+            passed = False
+    finally:
+        monitor_command("cont")
+        for path in (capture_path, core_path, kdump_path):
+            if os.path.exists(path):
+                os.remove(path)
+
+    return passed
+
 def find_qemu():
     qemu_paths_search = [
             "/bin/qemu-system-x86_64",
@@ -153,6 +219,30 @@ def qemu_run(vmlinux_path):
         print(f"Error occurred while starting QEMU: {e}")
         return False
 
+def monitor_read(sock):
+    data = b""
+    while not data.endswith(b"(qemu) "):
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        data += chunk
+    return data.decode('utf-8', errors='replace')
+
+def monitor_command(command):
+    try:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        # dump-guest-memory returns once the dump is written
+        sock.settimeout(120)
+        sock.connect('/tmp/mon.sock')
+        monitor_read(sock)
+        sock.sendall((command + "\n").encode())
+        output = monitor_read(sock)
+        sock.close()
+        return output
+    except Exception as e:
+        print(f"Monitor command {command} failed: {e}")
+        return None
+
 def qemu_shutdown():
     try:
         sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
@@ -0,0 +1,148 @@
+/* tlb.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "tlb.h"
+
+/*
+ * Every guest page-table walk costs up to four backend reads, each a
+ * monitor round trip for QMP and libvirt.  Two caches cut that down:
+ *
+ *  - a set-associative TLB from virtual page to physical frame, filled
+ *    by x86_64_kvtop() after each successful walk;
+ *  - the page-table pages themselves by physical address, so walks for
+ *    neighbouring addresses share their upper levels.
+ *
+ * Both are dropped by tlb_flush() whenever CR3 or the KASLR offset
+ * changes.  Guest IO is serialized by the callers, so there is no locking.
+ */
+struct tlb_entry {
+    ulong vpn;                  /* virtual page number + 1, 0 is empty */
+    ulong pfn;
+};
+
+struct ptcache_page {
+    physaddr_t paddr;           /* page-table page address + 1, 0 is empty */
+    ulong used;                 /* last use, for LRU replacement */
+    char *data;
+};
+
+static struct {
+    struct tlb_entry sets[TLB_SETS][TLB_WAYS];
+    unsigned char next_way[TLB_SETS];   /* round-robin victim */
+    struct ptcache_page pages[PTCACHE_PAGES];
+    ulong clock;
+    ulong hits, misses;
+    ulong pt_hits, pt_reads;
+} tlb;
+
+int tlb_lookup(ulong vaddr, physaddr_t *paddr)
+{
+    ulong vpn = vaddr >> PAGE_SHIFT;
+    struct tlb_entry *set = tlb.sets[vpn % TLB_SETS];
+    int i;
+
+    for (i = 0; i < TLB_WAYS; i++) {
+        if (set[i].vpn == vpn + 1) {
+            *paddr = (set[i].pfn << PAGE_SHIFT) + PAGEOFFSET(vaddr);
+            tlb.hits++;
+            return 0;
+        }
+    }
+
+    tlb.misses++;
+    return -1;
+}
+
+void tlb_insert(ulong vaddr, physaddr_t paddr)
+{
+    ulong vpn = vaddr >> PAGE_SHIFT;
+    ulong idx = vpn % TLB_SETS;
+    struct tlb_entry *e;
+
+    e = &tlb.sets[idx][tlb.next_way[idx]];
+    tlb.next_way[idx] = (tlb.next_way[idx] + 1) % TLB_WAYS;
+
+    e->vpn = vpn + 1;
+    e->pfn = paddr >> PAGE_SHIFT;
+}
+
+/*
+ * Return the page-table page at paddr, reading it on a miss.  The pointer
+ * is valid until the next call.
+ */
+char *ptcache_read(physaddr_t paddr)
+{
+    struct ptcache_page *p, *victim = NULL;
+    int i;
+
+    paddr &= ~(physaddr_t)(PAGE_SIZE - 1);
+    tlb.clock++;
+
+    for (i = 0; i < PTCACHE_PAGES; i++) {
+        p = &tlb.pages[i];
+        if (p->paddr == paddr + 1) {
+            p->used = tlb.clock;
+            tlb.pt_hits++;
+            return p->data;
+        }
+        if (!victim || p->used < victim->used)
+            victim = p;
+    }
+
+    if (!victim->data)
+        victim->data = xmalloc(PAGE_SIZE);
+
+    tlb.pt_reads++;
+    if (readmem(paddr, PHYSADDR, victim->data, PAGE_SIZE)) {
+        victim->paddr = 0;
+        victim->used = 0;
+        return NULL;
+    }
+    victim->paddr = paddr + 1;
+    victim->used = tlb.clock;
+    return victim->data;
+}
+
+void tlb_flush(void)
+{
+    int i;
+
+    memset(tlb.sets, 0, sizeof(tlb.sets));
+    for (i = 0; i < PTCACHE_PAGES; i++) {
+        tlb.pages[i].paddr = 0;
+        tlb.pages[i].used = 0;
+    }
+}
+
+void tlb_release(void)
+{
+    int i;
+
+    if (KDEBUG(1) && (tlb.hits || tlb.misses))
+        pr_debug("tlb: %lu hits, %lu misses; page tables: %lu hits, "
+                "%lu reads", tlb.hits, tlb.misses, tlb.pt_hits,
+                tlb.pt_reads);
+
+    for (i = 0; i < PTCACHE_PAGES; i++)
+        xfree(tlb.pages[i].data);
+    memset(&tlb, 0, sizeof(tlb));
+}
@@ -0,0 +1,31 @@
+/* tlb.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include "defs.h"
+
+#define TLB_SETS            (64)
+#define TLB_WAYS            (4)
+#define PTCACHE_PAGES       (16)
+
+int tlb_lookup(ulong vaddr, physaddr_t *paddr);
+void tlb_insert(ulong vaddr, physaddr_t paddr);
+char *ptcache_read(physaddr_t paddr);
+void tlb_flush(void);
+void tlb_release(void);
+
+#endif
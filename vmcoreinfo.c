@@ -0,0 +1,514 @@
+/* vmcoreinfo.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "tlb.h"
+#include "vmcoreinfo.h"
+
+/*
+ * The VMCOREINFO note is read from the guest once and split into a hash
+ * table of KEY=value lines.  Keys and values point into a private copy of
+ * the note; numbers are converted up front using the base the kernel
+ * printed them in, so lookups neither scan the note nor allocate.
+ */
+struct vmcoreinfo_entry {
+    const char *key;
+    const char *value;
+    uint32_t hash;
+    int has_number;
+    long number;
+};
+
+static struct {
+    char *buf;
+    struct vmcoreinfo_entry *table;
+    uint32_t mask;
+    uint32_t nr;
+    physaddr_t scan_paddr;      /* where vmcoreinfo_scan() found the note */
+    size_t scan_size;
+} vmcoreinfo;
+
+static uint32_t vmcoreinfo_hash(const char *key)
+{
+    uint32_t h = 2166136261U;
+
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static struct vmcoreinfo_entry *vmcoreinfo_slot(const char *key, uint32_t h)
+{
+    struct vmcoreinfo_entry *e;
+    uint32_t i;
+
+    for (i = h & vmcoreinfo.mask; ; i = (i + 1) & vmcoreinfo.mask) {
+        e = &vmcoreinfo.table[i];
+        if (!e->key || (e->hash == h && !strcmp(e->key, key)))
+            return e;
+    }
+}
+
+/* SYMBOL() and KERNELOFFSET are printed in hex, everything else in decimal */
+static int vmcoreinfo_is_hex(const char *key)
+{
+    return !strncmp(key, "SYMBOL(", 7) || !strcmp(key, "KERNELOFFSET");
+}
+
+static void vmcoreinfo_add(const char *key, const char *value)
+{
+    struct vmcoreinfo_entry *e;
+    uint32_t h = vmcoreinfo_hash(key);
+    char *end;
+
+    e = vmcoreinfo_slot(key, h);
+    if (e->key)
+        return;     /* the first definition wins */
+
+    e->key = key;
+    e->value = value;
+    e->hash = h;
+
+    errno = 0;
+    if (vmcoreinfo_is_hex(key))
+        e->number = (long)strtoul(value, &end, 16);
+    else
+        e->number = strtol(value, &end, 10);
+    e->has_number = *value && !*end && !errno;
+
+    vmcoreinfo.nr++;
+}
+
+int vmcoreinfo_parse(const char *data, size_t size)
+{
+    char *p, *eol, *eq;
+    uint32_t lines = 0, len;
+
+    vmcoreinfo_release();
+
+    vmcoreinfo.buf = xmalloc(size + 1);
+    memcpy(vmcoreinfo.buf, data, size);
+    vmcoreinfo.buf[size] = '\0';
+
+    for (p = vmcoreinfo.buf; *p; p++) {
+        if (*p == '\n')
+            lines++;
+    }
+
+    for (len = 16; len < 2 * (lines + 1); )
+        len <<= 1;
+    vmcoreinfo.table = xcalloc(len, sizeof(*vmcoreinfo.table));
+    vmcoreinfo.mask = len - 1;
+
+    for (p = vmcoreinfo.buf; *p; p = eol + 1) {
+        if ((eol = strchr(p, '\n')))
+            *eol = '\0';
+        if ((eq = strchr(p, '=')) && eq != p) {
+            *eq = '\0';
+            vmcoreinfo_add(p, eq + 1);
+        }
+        if (!eol)
+            break;
+    }
+
+    if (KDEBUG(1))
+        pr_debug("vmcoreinfo: %u keys", vmcoreinfo.nr);
+    return 0;
+}
+
+void vmcoreinfo_release(void)
+{
+    xfree(vmcoreinfo.buf);
+    xfree(vmcoreinfo.table);
+    vmcoreinfo.buf = NULL;
+    vmcoreinfo.table = NULL;
+    vmcoreinfo.mask = 0;
+    vmcoreinfo.nr = 0;
+}
+
+static struct vmcoreinfo_entry *vmcoreinfo_find(const char *key)
+{
+    struct vmcoreinfo_entry *e;
+
+    if (!vmcoreinfo.table)
+        return NULL;
+
+    e = vmcoreinfo_slot(key, vmcoreinfo_hash(key));
+    return e->key ? e : NULL;
+}
+
+const char *vmcoreinfo_lookup(const char *key)
+{
+    struct vmcoreinfo_entry *e = vmcoreinfo_find(key);
+
+    return e ? e->value : NULL;
+}
+
+int vmcoreinfo_number(const char *key, long *value)
+{
+    struct vmcoreinfo_entry *e = vmcoreinfo_find(key);
+
+    if (!e || !e->has_number)
+        return -1;
+
+    *value = e->number;
+    return 0;
+}
+
+/*
+ * SYMBOL() entries carry runtime addresses of variables.  Those the
+ * System.map does not have are added to the symbol table, so for example
+ * a map without prb or log_buf still works.
+ */
+static void vmcoreinfo_install_symbols(void)
+{
+    struct vmcoreinfo_entry *e;
+    char name[128];
+    const char *p;
+    size_t len;
+    uint32_t i;
+    ulong value;
+
+    for (i = 0; i <= vmcoreinfo.mask; i++) {
+        e = &vmcoreinfo.table[i];
+        if (!e->key || !e->has_number || strncmp(e->key, "SYMBOL(", 7))
+            continue;
+
+        p = e->key + 7;
+        len = strlen(p);
+        if (!len || p[len - 1] != ')' || len > sizeof(name))
+            continue;
+        memcpy(name, p, len - 1);
+        name[len - 1] = '\0';
+
+        if (kernel_symbol_exists(name))
+            continue;
+
+        value = e->number;
+        if (kt->flags & RELOC_SET)
+            value += kt->relocate;
+        if (symbol_install(name, value) == 0 && KDEBUG(1))
+            pr_debug("vmcoreinfo: %s from SYMBOL()", name);
+    }
+}
+
+void vmcoreinfo_init()
+{
+    char *buf;
+    size_t vmcoreinfo_size;
+    ulong vmcoreinfo_data;
+    ulong osrelease;
+
+    // ASCII value of "OSRELEAS"
+    // crash> rd vmcoreinfo_data 1
+    // ffffffffbd56ca60:  5341454c4552534f                    OSRELEAS
+    osrelease=0x5341454c4552534f;
+
+    if (vmcoreinfo.scan_paddr && !kt->vmcoreinfo_data) {
+        /* every page is in the direct map, which is known by now */
+        kt->vmcoreinfo_data = PAGE_OFFSET + vmcoreinfo.scan_paddr;
+        kt->vmcoreinfo_size = vmcoreinfo.scan_size;
+    }
+
+    if (kt->vmcoreinfo_data) {
+        /* already known from the bootstrap cache or the scan */
+        vmcoreinfo_data = kt->vmcoreinfo_data;
+        vmcoreinfo_size = kt->vmcoreinfo_size;
+    } else {
+        get_symbol_data("vmcoreinfo_size", sizeof(vmcoreinfo_size), &vmcoreinfo_size);
+        vmcoreinfo_size &= ((1<<13) - 1);
+
+        get_symbol_data("vmcoreinfo_data", sizeof(vmcoreinfo_data), &vmcoreinfo_data);
+
+        // For legacy kernels like CentOS 3.10.x, the type of vmcoreinfo_data is string array
+        // instead of char pointer, get_symbol_data would simply return the string itself
+        // instead of address, which is not what we want.
+        //
+        // The best way to deal with it is get vmcoreinfo_data data type via tools like
+        // gdb, just like crash utility
+        if (vmcoreinfo_data == osrelease)
+        {
+            vmcoreinfo_data = symbol_value("vmcoreinfo_data");
+            vmcoreinfo_data -= kt->relocate;
+        }
+
+        kt->vmcoreinfo_data = vmcoreinfo_data;
+        kt->vmcoreinfo_size = vmcoreinfo_size;
+    }
+
+    buf = xmalloc(vmcoreinfo_size + 1);
+
+    if (readmem(vmcoreinfo_data, KVADDR, buf, vmcoreinfo_size)) {
+        pr_err("cannot read vmcoreinfo_data\n");
+        xfree(buf);
+        return;
+    }
+    buf[vmcoreinfo_size] = '\0';
+
+    if (KDEBUG(2))
+        fprintf(fp, "%s\n", buf);
+
+    vmcoreinfo_parse(buf, vmcoreinfo_size);
+    xfree(buf);
+
+    vmcoreinfo_install_symbols();
+}
+
+/*
+ * Register-free bootstrap: find the VMCOREINFO note in guest-physical
+ * memory and take the KASLR offset, phys_base and the kernel page table
+ * from it.  A hit is only accepted when linux_banner, looked up in the
+ * System.map (or in the guest's kallsyms with --no-map) and read through
+ * the derived mapping, names the release of the note; stale copies and
+ * stray "OSRELEASE=" strings fail that check.
+ */
+#define SCAN_CHUNK          (2UL << 20)
+#define SCAN_KEY            "OSRELEASE="
+#define SCAN_KEY_LEN        (sizeof(SCAN_KEY) - 1)
+#define SCAN_LIKELY_END     (1UL << 30)     /* kernel image, early allocations */
+#define SCAN_4G             (1UL << 32)
+#define SCAN_MAX            (1UL << 40)
+
+static const char *scan_find(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i o = _mm_set1_epi8('O');
+    const __m128i s = _mm_set1_epi8('S');
+    unsigned int mask;
+
+    while (end - p >= 17) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)p), o)) &
+            _mm_movemask_epi8(_mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i *)(p + 1)), s));
+        while (mask) {
+            const char *q = p + __builtin_ctz(mask);
+
+            if (end - q >= (long)SCAN_KEY_LEN &&
+                    !memcmp(q, SCAN_KEY, SCAN_KEY_LEN))
+                return q;
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+#endif
+    for (; end - p >= (long)SCAN_KEY_LEN; p++) {
+        if (*p == 'O' && !memcmp(p, SCAN_KEY, SCAN_KEY_LEN))
+            return p;
+    }
+    return NULL;
+}
+
+/*
+ * Does the guest's linux_banner, at link-time address banner under the
+ * given relocation, name this release?
+ */
+int vmcoreinfo_banner_matches(ulong banner, ulong kaslr, ulong phys_base,
+        const char *release)
+{
+    char buf[128];
+    physaddr_t paddr;
+    size_t len;
+
+    paddr = banner + kaslr - __START_KERNEL_map + phys_base;
+    memset(buf, 0, sizeof(buf));
+    if (readmem(paddr, PHYSADDR, buf, sizeof(buf) - 1))
+        return FALSE;
+
+    len = strlen(release);
+    return !strncmp(buf, "Linux version ", 14) &&
+        !strncmp(buf + 14, release, len) && buf[14 + len] == ' ';
+}
+
+/* the default check, with linux_banner from the System.map */
+static int scan_validate_map(ulong kaslr, ulong phys_base,
+        const char *release)
+{
+    if (!kernel_symbol_exists("linux_banner"))
+        return -1;
+
+    return vmcoreinfo_banner_matches(symbol_value("linux_banner"), kaslr,
+            phys_base, release) ? 0 : -1;
+}
+
+/*
+ * Check a candidate note and, when it is the live one, set up the
+ * relocation from it.  paddr is where the note is in guest memory, or 0
+ * for the copy a dump file keeps outside of it.
+ */
+static int scan_check(const char *buf, size_t len, physaddr_t paddr,
+        vmcoreinfo_validate_t validate)
+{
+    const char *release;
+    long kaslr = 0, phys_base, pgt;
+    int ret = -1;
+
+    vmcoreinfo_parse(buf, len);
+
+    if (!(release = vmcoreinfo_lookup("OSRELEASE")) || !*release)
+        goto out;
+
+    /* KERNELOFFSET is missing on kernels without KASLR */
+    vmcoreinfo_number("KERNELOFFSET", &kaslr);
+
+    if (vmcoreinfo_number("NUMBER(phys_base)", &phys_base)) {
+        /* before 4.10: the note is the vmcoreinfo_data array itself */
+        if (!paddr || !kernel_symbol_exists("vmcoreinfo_data"))
+            goto out;
+        phys_base = paddr - (symbol_value("vmcoreinfo_data") + kaslr -
+                __START_KERNEL_map);
+    }
+
+    if (validate(kaslr, phys_base, release))
+        goto out;
+
+    /* KVADDRs outside the linear maps are read through these tables */
+    if (vmcoreinfo_number("SYMBOL(init_top_pgt)", &pgt) &&
+            vmcoreinfo_number("SYMBOL(init_level4_pgt)", &pgt) &&
+            vmcoreinfo_number("SYMBOL(swapper_pg_dir)", &pgt)) {
+        if (KDEBUG(1))
+            pr_debug("vmcoreinfo: no kernel page table in the note");
+        goto out;
+    }
+
+    if (kaslr) {
+        kt->relocate = kaslr * -1;
+        kt->flags |= RELOC_SET;
+    }
+    machdep->machspec->phys_base = phys_base;
+
+    vt->kernel_pgd[0] = pgt - __START_KERNEL_map + phys_base;
+    tlb_flush();
+
+    vmcoreinfo.scan_paddr = paddr;
+    vmcoreinfo.scan_size = len;
+
+    if (KDEBUG(1)) {
+        if (paddr)
+            pr_debug("vmcoreinfo: found at %lx, Linux %s", (ulong)paddr,
+                    release);
+        else
+            pr_debug("vmcoreinfo: from the dump file, Linux %s", release);
+        pr_debug("vmcoreinfo: kaslr_offset=%lx phys_base=%lx pgd=%lx",
+                kaslr, phys_base, vt->kernel_pgd[0]);
+    }
+    ret = 0;
+out:
+    if (ret)
+        vmcoreinfo_release();
+    return ret;
+}
+
+static int scan_try(physaddr_t paddr, vmcoreinfo_validate_t validate)
+{
+    char *buf = xmalloc(PAGE_SIZE + 1);
+    int ret = -1;
+
+    if (!readmem(paddr, PHYSADDR, buf, PAGE_SIZE)) {
+        buf[PAGE_SIZE] = '\0';
+        ret = scan_check(buf, strlen(buf), paddr, validate);
+    }
+    xfree(buf);
+    return ret;
+}
+
+/*
+ * Search [start, end) chunk by chunk.  Returns 0 on a validated hit, 1
+ * when the region was searched without one and -1 when memory ended.
+ */
+static int scan_region(char *chunk, uint64_t start, uint64_t end,
+        uint64_t mem_size, vmcoreinfo_validate_t validate)
+{
+    const char *p, *hit;
+    uint64_t addr;
+    size_t len;
+
+    for (addr = start; addr < end; addr += SCAN_CHUNK) {
+        /* overlap the next chunk so a key on the boundary is seen */
+        len = SCAN_CHUNK + SCAN_KEY_LEN - 1;
+        if (mem_size && addr + len > mem_size) {
+            if (addr >= mem_size)
+                return -1;
+            len = mem_size - addr;
+        }
+
+        if (readmem(addr, PHYSADDR, chunk, len)) {
+            /* holes below 4G are normal, above it RAM has ended */
+            if (!mem_size && addr >= SCAN_4G)
+                return -1;
+            continue;
+        }
+
+        for (p = chunk; (hit = scan_find(p, chunk + len)); p = hit + 1) {
+            if (hit - chunk >= (long)SCAN_CHUNK)
+                break;
+            if (!scan_try(addr + (hit - chunk), validate))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+int vmcoreinfo_scan(vmcoreinfo_validate_t validate)
+{
+    uint64_t mem_size = guest_client->mem_size;
+    uint64_t likely_end = SCAN_LIKELY_END;
+    char *chunk;
+    int ret;
+
+    if (!validate)
+        validate = scan_validate_map;
+
+    /* found before, e.g. by --no-map with another check */
+    if (vmcoreinfo.scan_paddr && !scan_try(vmcoreinfo.scan_paddr, validate))
+        return 0;
+
+    /* a dump file may have saved the note, then nothing needs scanning */
+    if (guest_client->vmcoreinfo &&
+            !scan_check(guest_client->vmcoreinfo,
+                strnlen(guest_client->vmcoreinfo,
+                    guest_client->vmcoreinfo_size), 0, validate))
+        return 0;
+
+    if (mem_size && likely_end > mem_size)
+        likely_end = mem_size;
+
+    chunk = xmalloc(SCAN_CHUNK + SCAN_KEY_LEN);
+
+    /* where the kernel is loaded and allocates early first, then the rest */
+    ret = scan_region(chunk, 16UL << 20, likely_end, mem_size, validate);
+    if (ret > 0)
+        ret = scan_region(chunk, 0, 16UL << 20, mem_size, validate);
+    if (ret > 0)
+        ret = scan_region(chunk, likely_end,
+                mem_size ? mem_size : SCAN_MAX, mem_size, validate);
+
+    xfree(chunk);
+
+    return ret ? -1 : 0;
+}
@@ -0,0 +1,34 @@
+/* vmcoreinfo.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __VMCOREINFO_H__
+#define __VMCOREINFO_H__
+
+#include <stddef.h>
+
+/* accept a candidate note given the relocation it implies, 0 if it fits */
+typedef int (*vmcoreinfo_validate_t)(unsigned long kaslr,
+        unsigned long phys_base, const char *release);
+
+void vmcoreinfo_init();
+int vmcoreinfo_parse(const char *data, size_t size);
+const char *vmcoreinfo_lookup(const char *key);
+int vmcoreinfo_number(const char *key, long *value);
+void vmcoreinfo_release(void);
+int vmcoreinfo_scan(vmcoreinfo_validate_t validate);
+int vmcoreinfo_banner_matches(unsigned long banner, unsigned long kaslr,
+        unsigned long phys_base, const char *release);
+
+#endif
@@ -0,0 +1,196 @@
+/* vmlinux.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "vmlinux.h"
+
+/*
+ * vmlinux as a replacement for System.map: the ELF file is mmap'ed and
+ * its .symtab is read in place.  The .BTF section, when the kernel was
+ * built with CONFIG_DEBUG_INFO_BTF, provides the struct layouts.
+ */
+int is_vmlinux_file(const char *path)
+{
+    Elf64_Ehdr ehdr;
+    int fd, ret = FALSE;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return FALSE;
+
+    /* a dump-guest-memory core is ELF too, but it is the guest */
+    if (read(fd, &ehdr, sizeof(ehdr)) == sizeof(ehdr) &&
+            !memcmp(ehdr.e_ident, ELFMAG, SELFMAG) &&
+            ehdr.e_ident[EI_CLASS] == ELFCLASS64 &&
+            ehdr.e_type != ET_CORE)
+        ret = TRUE;
+
+    close(fd);
+    return ret;
+}
+
+int vmlinux_open(const char *path, struct vmlinux *v)
+{
+    struct stat sb;
+    void *base;
+    int fd;
+
+    memset(v, 0, sizeof(*v));
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        pr_err("Error opening file: %s", path);
+        return -1;
+    }
+    if (fstat(fd, &sb) || (size_t)sb.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return -1;
+    }
+    base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        pr_err("Failed to mmap %s", path);
+        return -1;
+    }
+
+    v->base = base;
+    v->len = sb.st_size;
+    v->ehdr = base;
+
+    if (memcmp(v->ehdr->e_ident, ELFMAG, SELFMAG) ||
+            v->ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+            v->ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+            v->ehdr->e_shoff + v->ehdr->e_shnum * sizeof(Elf64_Shdr) > v->len ||
+            v->ehdr->e_shstrndx >= v->ehdr->e_shnum) {
+        pr_err("%s is not a 64-bit ELF file", path);
+        vmlinux_close(v);
+        return -1;
+    }
+
+    v->shdrs = (const Elf64_Shdr *)(v->base + v->ehdr->e_shoff);
+    if (v->shdrs[v->ehdr->e_shstrndx].sh_offset >= v->len) {
+        vmlinux_close(v);
+        return -1;
+    }
+    v->shstrtab = v->base + v->shdrs[v->ehdr->e_shstrndx].sh_offset;
+    return 0;
+}
+
+void vmlinux_close(struct vmlinux *v)
+{
+    if (v->base)
+        munmap((void *)v->base, v->len);
+    memset(v, 0, sizeof(*v));
+}
+
+static const void *section_data(const struct vmlinux *v,
+        const Elf64_Shdr *sh, size_t *len)
+{
+    if (sh->sh_type == SHT_NOBITS || sh->sh_offset + sh->sh_size > v->len)
+        return NULL;
+    *len = sh->sh_size;
+    return v->base + sh->sh_offset;
+}
+
+const void *vmlinux_section(const struct vmlinux *v, const char *name,
+        size_t *len)
+{
+    int i;
+
+    for (i = 0; i < v->ehdr->e_shnum; i++) {
+        if (!strcmp(v->shstrtab + v->shdrs[i].sh_name, name))
+            return section_data(v, &v->shdrs[i], len);
+    }
+    return NULL;
+}
+
+/* The System.map letter nm would print */
+static char symbol_type(const struct vmlinux *v, const Elf64_Sym *sym)
+{
+    const Elf64_Shdr *sh;
+    char type;
+
+    if (sym->st_shndx == SHN_ABS)
+        type = 'a';
+    else if (sym->st_shndx >= v->ehdr->e_shnum)
+        type = 'd';
+    else {
+        sh = &v->shdrs[sym->st_shndx];
+        if (sh->sh_flags & SHF_EXECINSTR)
+            type = 't';
+        else if (sh->sh_type == SHT_NOBITS)
+            type = 'b';
+        else if (!(sh->sh_flags & SHF_WRITE))
+            type = 'r';
+        else
+            type = 'd';
+    }
+
+    if (ELF64_ST_BIND(sym->st_info) != STB_LOCAL)
+        type -= 'a' - 'A';
+    return type;
+}
+
+int vmlinux_read_symbols(const struct vmlinux *v, struct symindex_builder *b)
+{
+    const Elf64_Shdr *symtab = NULL;
+    const Elf64_Sym *syms;
+    const char *strtab;
+    size_t len, strtab_len, i, nr;
+    int type;
+
+    memset(b, 0, sizeof(*b));
+
+    for (i = 0; i < v->ehdr->e_shnum; i++) {
+        if (v->shdrs[i].sh_type == SHT_SYMTAB) {
+            symtab = &v->shdrs[i];
+            break;
+        }
+    }
+    if (!symtab || symtab->sh_link >= v->ehdr->e_shnum ||
+            !(syms = section_data(v, symtab, &len)) ||
+            !(strtab = section_data(v, &v->shdrs[symtab->sh_link],
+                    &strtab_len))) {
+        pr_err("vmlinux has no symbol table");
+        return -1;
+    }
+
+    nr = len / sizeof(Elf64_Sym);
+    for (i = 1; i < nr; i++) {
+        type = ELF64_ST_TYPE(syms[i].st_info);
+        if (type == STT_SECTION || type == STT_FILE ||
+                syms[i].st_shndx == SHN_UNDEF ||
+                syms[i].st_name >= strtab_len ||
+                !strtab[syms[i].st_name])
+            continue;
+        symindex_builder_add(b, syms[i].st_value, symbol_type(v, &syms[i]),
+                strtab + syms[i].st_name,
+                strnlen(strtab + syms[i].st_name,
+                    strtab_len - syms[i].st_name));
+    }
+    b->map_size = v->len;
+
+    /* .symtab is not sorted by address */
+    symindex_builder_sort(b);
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* vmlinux.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __VMLINUX_H__
+#define __VMLINUX_H__
+
+#include <stddef.h>
+#include <elf.h>
+
+#include "symindex.h"
+
+struct vmlinux {
+    const char *base;
+    size_t len;
+    const Elf64_Ehdr *ehdr;
+    const Elf64_Shdr *shdrs;
+    const char *shstrtab;
+};
+
+int is_vmlinux_file(const char *path);
+int vmlinux_open(const char *path, struct vmlinux *v);
+void vmlinux_close(struct vmlinux *v);
+const void *vmlinux_section(const struct vmlinux *v, const char *name,
+        size_t *len);
+int vmlinux_read_symbols(const struct vmlinux *v, struct symindex_builder *b);
+
+#endif
@@ -0,0 +1,538 @@
+/* watch.c
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include "defs.h"
+#include "log.h"
+#include "xutil.h"
+#include "client.h"
+#include "printk.h"
+#include "startup.h"
+#include "watch.h"
+
+/*
+ * --watch-crash: instead of the log, poll the few kernel variables that
+ * change when a guest panics or oopses, and save the log the moment one
+ * of them does.  Everything bootstrap derives is global, so each guest is
+ * watched by its own child process; the parent only restarts children,
+ * after a crash once the guest had time to reboot, and with a backoff
+ * while a guest cannot be reached.
+ *
+ * With --events the child sleeps on the monitor instead (QMP events, or
+ * libvirt lifecycle callbacks) and only reads the guest once qemu says
+ * it panicked, stopped, reset or shut down; --interval then adds polling
+ * for the oopses that do not panic.
+ *
+ * With --storm the child also reads the log's record counter (head_id, or
+ * log_next_seq) on every poll, and saves the log as soon as the guest logs
+ * faster than the given rate, while the records that led up to the storm
+ * are still in the ring.  Only the counter is read, never the text.
+ */
+struct watch_word {
+    const char *name;
+    int size;
+    int is_signed;
+    ulong mask;                 /* the bits that signal a crash, 0 for none */
+    ulong kaddr;
+};
+
+static const struct watch_word watch_words[] = {
+    /* atomic_t, PANIC_CPU_INVALID (-1) until a CPU panics */
+    { "panic_cpu",                  sizeof(int),   TRUE,  ~0UL, 0 },
+    /* raised while an oops or a panic is being printed */
+    { "oops_in_progress",           sizeof(int),   TRUE,  ~0UL, 0 },
+    /*
+     * TAINT_DIE and TAINT_WARN stay set after an oops or a WARN; the
+     * other taints come from loading a module or a sysctl
+     */
+    { "tainted_mask",               sizeof(ulong), FALSE,
+        (1UL << TAINT_DIE) | (1UL << TAINT_WARN), 0 },
+    /* whether the next oops panics, and kdump: reported, not watched */
+    { "panic_on_oops",              sizeof(int),   TRUE,  0,    0 },
+    { "crash_kexec_post_notifiers", sizeof(char),  FALSE, 0,    0 },
+};
+
+#define NR_WATCH_WORDS  (sizeof(watch_words) / sizeof(watch_words[0]))
+
+/* named as in QMP, libvirt lifecycle events are translated to these */
+static const char *watch_events[] = {
+    "GUEST_PANICKED",
+    "GUEST_CRASHLOADED",
+    "STOP",                 /* e.g. -action panic=pause, a watchdog */
+    "RESET",
+    "SHUTDOWN",
+};
+
+#define NR_WATCH_EVENTS (sizeof(watch_events) / sizeof(watch_events[0]))
+
+/* words close to each other in the kernel image are read together */
+struct watch_run {
+    ulong kaddr;
+    ulong len;
+};
+
+static struct {
+    const char *guest;
+    struct watch_word words[NR_WATCH_WORDS];    /* resolved, by address */
+    int nr_words;
+    struct watch_run runs[NR_WATCH_WORDS];
+    int nr_runs;
+    long values[NR_WATCH_WORDS];
+
+    /* --storm */
+    ulong storm_rate;           /* records per second, 0 if not watched */
+    ulong seq_kaddr;
+    ulong seq_size;
+    ulong seq_mask;
+    ulong seq;                  /* the counter at window_ms */
+    uint64_t window_ms;         /* 0 to start a new window */
+    int storming;
+    ulong peak;
+} watch;
+
+enum {
+    WATCH_EXIT_CRASHED = 10,        /* a word changed, the log was saved */
+    WATCH_EXIT_LOST,                /* the guest went away while watched */
+    WATCH_EXIT_RETRY,               /* the guest could not be bootstrapped */
+    WATCH_EXIT_FATAL,               /* watching this guest cannot work */
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static int watch_word_cmp(const void *a, const void *b)
+{
+    const struct watch_word *x = a, *y = b;
+
+    return x->kaddr < y->kaddr ? -1 : x->kaddr > y->kaddr;
+}
+
+static int watch_resolve(void)
+{
+    struct watch_word *w;
+    struct watch_run *r = NULL;
+    int sentinels = 0;
+    size_t i;
+
+    for (i = 0; i < NR_WATCH_WORDS; i++) {
+        if (!kernel_symbol_exists((char *)watch_words[i].name))
+            continue;
+        w = &watch.words[watch.nr_words++];
+        *w = watch_words[i];
+        w->kaddr = relocate(symbol_value((char *)w->name));
+        if (w->mask)
+            sentinels++;
+    }
+    if (!sentinels)
+        return -1;
+
+    qsort(watch.words, watch.nr_words, sizeof(struct watch_word),
+            watch_word_cmp);
+
+    for (i = 0; i < (size_t)watch.nr_words; i++) {
+        w = &watch.words[i];
+        if (r && w->kaddr + w->size - r->kaddr <= WATCH_RUN_MAX) {
+            r->len = MAX(r->len, w->kaddr + w->size - r->kaddr);
+            continue;
+        }
+        r = &watch.runs[watch.nr_runs++];
+        r->kaddr = w->kaddr;
+        r->len = w->size;
+    }
+
+    if (KDEBUG(1))
+        pr_debug("%s: %d crash sentinels, %d words in %d reads",
+                watch.guest, sentinels, watch.nr_words, watch.nr_runs);
+    return 0;
+}
+
+static long watch_word_value(const struct watch_word *w, const char *p)
+{
+    switch (w->size) {
+        case sizeof(char):
+            return *(const unsigned char *)p;
+        case sizeof(int):
+            return w->is_signed ? (long)(int)UINT(p) : (long)UINT(p);
+        default:
+            return ULONG(p);
+    }
+}
+
+static int watch_read(long *values)
+{
+    char buf[WATCH_RUN_MAX];
+    struct watch_run *r;
+    struct watch_word *w;
+    int i, j = 0;
+
+    for (i = 0; i < watch.nr_runs; i++) {
+        r = &watch.runs[i];
+        if (readmem(r->kaddr, KVADDR, buf, r->len))
+            return -1;
+
+        for (; j < watch.nr_words; j++) {
+            w = &watch.words[j];
+            if (w->kaddr >= r->kaddr + r->len)
+                break;
+            values[j] = watch_word_value(w, buf + (w->kaddr - r->kaddr));
+        }
+    }
+    return 0;
+}
+
+static void watch_sleep(ulong ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+static uint64_t watch_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void watch_save_log(const char *what)
+{
+    const char *base;
+    char path[PATH_MAX], stamp[32];
+    struct tm tm;
+    time_t now;
+
+    base = strrchr(watch.guest, '/') ? strrchr(watch.guest, '/') + 1 :
+        watch.guest;
+    now = time(NULL);
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(path, sizeof(path), "%s-%s-%s.log", base, what, stamp);
+
+    if (!(fp = fopen(path, "w"))) {
+        fp = stdout;
+        pr_err("%s: cannot create %s", watch.guest, path);
+        return;
+    }
+    dump_kernel_log();
+    fclose(fp);
+    fp = stdout;
+
+    fprintf(stdout, "%s: log saved to %s\n", watch.guest, path);
+    fflush(stdout);
+}
+
+static void watch_report(const struct watch_word *w, long old, long new)
+{
+    if (w->is_signed)
+        fprintf(stdout, "%s: %s %ld -> %ld\n", watch.guest, w->name,
+                old, new);
+    else
+        fprintf(stdout, "%s: %s %#lx -> %#lx\n", watch.guest, w->name,
+                (ulong)old, (ulong)new);
+    fflush(stdout);
+}
+
+/* the settings a crash was handled with */
+static void watch_report_context(const long *values)
+{
+    const struct watch_word *w;
+    int i;
+
+    for (i = 0; i < watch.nr_words; i++) {
+        w = &watch.words[i];
+        if (!w->mask)
+            fprintf(stdout, "%s: %s %ld\n", watch.guest, w->name, values[i]);
+    }
+    fflush(stdout);
+}
+
+static int watch_event_wanted(const char *event)
+{
+    size_t i;
+
+    for (i = 0; i < NR_WATCH_EVENTS; i++) {
+        if (!strcmp(event, watch_events[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * The rate is taken over windows of at least WATCH_STORM_WINDOW_MS, so
+ * that polls a few records apart do not make a storm.  A storm is over
+ * once the rate falls below half the threshold.
+ */
+static int watch_storm_poll(void)
+{
+    ulong seq = 0, n, rate;
+    uint64_t now, ms;
+
+    if (readmem(watch.seq_kaddr, KVADDR, &seq, watch.seq_size))
+        return -1;
+
+    now = watch_now_ms();
+    if (!watch.window_ms) {
+        watch.seq = seq;
+        watch.window_ms = now;
+        return 0;
+    }
+    if ((ms = now - watch.window_ms) < WATCH_STORM_WINDOW_MS)
+        return 0;
+
+    n = (seq - watch.seq) & watch.seq_mask;
+    watch.seq = seq;
+    watch.window_ms = now;
+
+    /* a counter that went back is a guest that rebooted */
+    if (n > watch.seq_mask / 2)
+        return 0;
+    rate = n * 1000 / ms;
+
+    if (watch.storming) {
+        watch.peak = MAX(watch.peak, rate);
+        if (rate >= watch.storm_rate / 2)
+            return 0;
+        fprintf(stdout, "%s: log storm over, peak %lu records/s\n",
+                watch.guest, watch.peak);
+        fflush(stdout);
+        watch.storming = FALSE;
+        return 0;
+    }
+
+    if (rate < watch.storm_rate)
+        return 0;
+
+    fprintf(stdout, "%s: log storm, %lu records/s\n", watch.guest, rate);
+    fflush(stdout);
+    watch.storming = TRUE;
+    watch.peak = rate;
+
+    watch_save_log("storm");
+    /* not counting what was logged while the log was read */
+    watch.window_ms = 0;
+    return 0;
+}
+
+/*
+ * Returns 1 once a crash event came, 0 when it is time to poll, -1 when
+ * the monitor went away.
+ */
+static int watch_wait(ulong interval_ms)
+{
+    char event[32];
+    int r;
+
+    if (!(pc->flags & WATCH_EVENTS)) {
+        watch_sleep(interval_ms);
+        return 0;
+    }
+
+    for (;;) {
+        r = guest_client->wait_event(interval_ms ? (int)interval_ms : -1,
+                event, sizeof(event));
+        if (r <= 0)
+            return r;
+        if (watch_event_wanted(event))
+            break;
+        if (KDEBUG(1))
+            pr_debug("%s: ignoring event %s", watch.guest, event);
+    }
+
+    fprintf(stdout, "%s: event %s\n", watch.guest, event);
+    fflush(stdout);
+    return 1;
+}
+
+static int watch_guest(char *guest, char *symmap_file, char *map_dir,
+        ulong interval_ms, ulong storm_rate)
+{
+    long values[NR_WATCH_WORDS];
+    guest_access_t ty;
+    int i, r, changed;
+
+    watch.guest = guest;
+
+    if (guest_access_type(guest, &ty))
+        return WATCH_EXIT_FATAL;
+    if (ty == GUEST_MEMORY) {
+        pr_err("%s: a memory image does not change, nothing to watch", guest);
+        return WATCH_EXIT_FATAL;
+    }
+
+    if (startup_run(guest, ty, symmap_file, map_dir))
+        return WATCH_EXIT_RETRY;
+
+    if ((pc->flags & WATCH_EVENTS) && !guest_client->wait_event) {
+        pr_err("%s: this guest has no monitor events to wait for", guest);
+        return WATCH_EXIT_FATAL;
+    }
+
+    if (!interval_ms) {
+        /* events only, nothing to poll */
+    } else if (watch_resolve()) {
+        pr_err("%s: none of the crash sentinels is in the symbol table",
+                guest);
+        return WATCH_EXIT_FATAL;
+    } else if (watch_read(watch.values)) {
+        return WATCH_EXIT_RETRY;
+    }
+
+    if (!storm_rate || !interval_ms) {
+        /* no storm watching */
+    } else if (printk_seq(&watch.seq_kaddr, &watch.seq_size,
+                &watch.seq_mask)) {
+        pr_warning("%s: no record counter (log_next_seq before 5.10, "
+                "none before 3.5), not watching for log storms", guest);
+    } else {
+        watch.storm_rate = storm_rate;
+    }
+
+    for (;;) {
+        if ((r = watch_wait(interval_ms)) < 0)
+            return WATCH_EXIT_LOST;
+        if (r > 0)
+            break;
+
+        if (watch_read(values))
+            return WATCH_EXIT_LOST;
+        if (watch.storm_rate && watch_storm_poll())
+            return WATCH_EXIT_LOST;
+
+        for (i = 0, changed = FALSE; i < watch.nr_words; i++) {
+            if (!((values[i] ^ watch.values[i]) & watch.words[i].mask))
+                continue;
+            watch_report(&watch.words[i], watch.values[i], values[i]);
+            changed = TRUE;
+        }
+        if (changed) {
+            watch_report_context(values);
+            break;
+        }
+        /* a taint or a sysctl that is not a crash */
+        memcpy(watch.values, values, sizeof(values));
+    }
+
+    watch_save_log("crash");
+    return WATCH_EXIT_CRASHED;
+}
+
+static pid_t watch_spawn(char *guest, char *symmap_file, char *map_dir,
+        ulong interval_ms, ulong storm_rate, ulong delay_ms)
+{
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) == -1) {
+        pr_err("%s: cannot fork: %s", guest, strerror(errno));
+        return -1;
+    }
+    if (pid)
+        return pid;
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (delay_ms)
+        watch_sleep(delay_ms);
+    exit(watch_guest(guest, symmap_file, map_dir, interval_ms, storm_rate));
+}
+
+static void watch_signal(int sig)
+{
+    (void)sig;
+    watch_stop = 1;
+}
+
+int watch_crash(char **guests, int nr_guests, char *symmap_file,
+        char *map_dir, ulong interval_ms, ulong storm_rate)
+{
+    struct sigaction sa;
+    pid_t *pids, pid;
+    ulong *retry_ms;
+    int i, status, code, running = 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pids = xcalloc(nr_guests, sizeof(pid_t));
+    retry_ms = xcalloc(nr_guests, sizeof(ulong));
+
+    for (i = 0; i < nr_guests; i++) {
+        if ((pids[i] = watch_spawn(guests[i], symmap_file, map_dir,
+                        interval_ms, storm_rate, 0)) > 0)
+            running++;
+    }
+
+    while (running && !watch_stop) {
+        if ((pid = waitpid(-1, &status, 0)) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < nr_guests && pids[i] != pid; i++)
+            ;
+        if (i == nr_guests)
+            continue;
+
+        code = WIFEXITED(status) ? WEXITSTATUS(status) : WATCH_EXIT_LOST;
+        switch (code) {
+            case WATCH_EXIT_CRASHED:
+            case WATCH_EXIT_LOST:
+                retry_ms[i] = WATCH_RETRY_MIN_MS;
+                break;
+            case WATCH_EXIT_RETRY:
+                retry_ms[i] = retry_ms[i] ?
+                    MIN(retry_ms[i] * 2, WATCH_RETRY_MAX_MS) :
+                    WATCH_RETRY_MIN_MS;
+                break;
+            default:
+                pr_err("%s: no longer watched", guests[i]);
+                pids[i] = 0;
+                running--;
+                continue;
+        }
+
+        if (KDEBUG(1))
+            pr_debug("%s: watching again in %lums", guests[i], retry_ms[i]);
+        if ((pids[i] = watch_spawn(guests[i], symmap_file, map_dir,
+                        interval_ms, storm_rate, retry_ms[i])) <= 0)
+            running--;
+    }
+
+    for (i = 0; i < nr_guests; i++) {
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    }
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+
+    xfree(retry_ms);
+    xfree(pids);
+    return watch_stop ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+/* watch.h
+ *
+ * Copyright (C) 2024 Ray Lee
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#define WATCH_INTERVAL_MS       (200)
+#define WATCH_RUN_MAX           (256)   /* words this close share a read */
+#define WATCH_RETRY_MIN_MS      (1000)
+#define WATCH_RETRY_MAX_MS      (60000)
+#define WATCH_STORM_WINDOW_MS   (1000)  /* the rate is taken over this */
+
+#define TAINT_DIE               (7)
+#define TAINT_WARN              (9)
+
+int watch_crash(char **guests, int nr_guests, char *symmap_file,
+        char *map_dir, unsigned long interval_ms, unsigned long storm_rate);
+
+#endif